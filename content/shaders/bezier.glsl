@@ -0,0 +1,18 @@
+// Cubic bezier from its four control points
+vec3 bezier(vec3 p1, vec3 p2, vec3 p3, vec3 p4, float t)
+{
+    vec3 sub1 = mix(p1, p2, t);
+    vec3 sub2 = mix(p2, p3, t);
+    vec3 sub3 = mix(p3, p4, t);
+
+    vec3 subsub1 = mix(sub1, sub2, t);
+    vec3 subsub2 = mix(sub2, sub3, t);
+
+    return mix(subsub1, subsub2, t);
+}
+
+// The same curve in power basis, ((a*t + b)*t + c)*t + d, see GLBezierStrips::BuildSegmentData
+vec3 bezierPowerBasis(vec3 a, vec3 b, vec3 c, vec3 d, float t)
+{
+    return ((a*t + b)*t + c)*t + d;
+}
\ No newline at end of file
@@ -3,13 +3,8 @@
 layout(lines) in;
 layout(line_strip, max_vertices = 20) out; // 6*2 for start/end coordinate axis (x2, start/end) + 2n segments (max 4 subdivisions)
 
-layout (std140, binding = 1) uniform Camera
-{
-    mat4 projection;       // 0 Column1, 16 Column2, 32 Column3, 48 Column4
-    mat4 view;             // 64 Column1, 80 Column2, 96 Column3, 112 Column4
-    vec3 camera_position;  // 128
-};
-uniform mat4 model;
+#include "uniform_blocks.glsl"
+#include "bezier.glsl"
 
 in CPAttrib
 {
@@ -32,18 +27,6 @@ out VertexAttrib
     vec4 tcoord;
 } vertex;
 
-vec3 bezier(vec3 p1, vec3 p2, vec3 p3, vec3 p4, float t)
-{
-    vec3 sub1 = mix(p1, p2, t);
-    vec3 sub2 = mix(p2, p3, t);
-    vec3 sub3 = mix(p3, p4, t);
-
-    vec3 subsub1 = mix(sub1, sub2, t);
-    vec3 subsub2 = mix(sub2, sub3, t);
-
-    return mix(subsub1, subsub2, t);
-}
-
 void EmitSegment(vec3 start, vec3 end, vec4 color)
 {
     // world space
@@ -51,7 +34,7 @@ void EmitSegment(vec3 start, vec3 end, vec4 color)
     vec4 endws = model * vec4(end, 1.0f);
 
     // clip space
-    mat4 vp = projection * view;
+    mat4 vp = view_projection;
     vec4 startcs = vp * startws;
     vec4 endcs = vp * endws;
 
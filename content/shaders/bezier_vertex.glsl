@@ -9,8 +9,10 @@ layout(location = 5) in float vertexThickness;
 layout(location = 6) in int vertexSegmentShape;
 layout(location = 7) in int vertexSegmentSubdivisions;
 
+#ifdef OVERRIDES
 uniform int shapeOverride = -1;
 uniform int subdivisionsOverride = -1;
+#endif
 
 out CPAttrib
 {
@@ -33,6 +35,11 @@ void main()
     controlpoint.texcoord = vertexTexcoord;
     controlpoint.width = vertexWidth;
     controlpoint.thickness = vertexThickness;
+#ifdef OVERRIDES
     controlpoint.shape = (shapeOverride >= 0)? shapeOverride : vertexSegmentShape;
     controlpoint.subdivisions = (subdivisionsOverride >= 0)? subdivisionsOverride : vertexSegmentSubdivisions;
+#else
+    controlpoint.shape = vertexSegmentShape;
+    controlpoint.subdivisions = vertexSegmentSubdivisions;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#version 420 core
+
+// Vertices captured from hair_planes_geometry.glsl, see GLFeedbackMesh
+layout(location = 0) in vec3 vertexPosition; // world space
+layout(location = 1) in vec3 vertexNormal;   // world space
+layout(location = 3) in vec4 vertexTCoord;
+
+#include "uniform_blocks.glsl"
+
+// World space attributes
+out VertexAttrib
+{
+    vec3 position_ws;
+    vec3 normal_ws;
+    vec4 color;
+    vec4 tcoord;
+} vertex;
+
+// Depth has to match between the hair depth pre-pass and the shading pass
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = view_projection * vec4(vertexPosition, 1.0f);
+    vertex.position_ws = vertexPosition;
+    vertex.normal_ws = vertexNormal;
+    vertex.color = vec4(vertexPosition, 1.0f);
+    vertex.tcoord = vertexTCoord;
+}
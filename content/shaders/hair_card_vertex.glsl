@@ -0,0 +1,98 @@
+#version 420 core
+
+// Unit card template, see GLCardTemplates
+layout(location = 0) in vec4 vertexTemplate; // t along the segment, u across the card, thickness side, shape
+
+#include "uniform_blocks.glsl"
+#include "unified_normals.glsl"
+
+// One instance per segment, see GLBezierStrips::BuildSegmentData for the texel layout
+layout(binding = 3) uniform samplerBuffer segmentData;
+const int SEGMENT_TEXELS = 8;
+
+#ifdef INDIRECT
+// Written by hair_cull_compute.glsl, the base instance of each indirect draw selects its group
+layout(location = 1) in int cardSegment;
+#else
+layout(binding = 5) uniform isamplerBuffer cardSegments; // segment ids sorted by template
+uniform int firstInstance = 0;
+#endif
+
+uniform float ribbonDistance = 0.0f; // cards further away from the camera use the ribbon shape, 0 = disabled
+
+// World space attributes
+out VertexAttrib
+{
+    vec3 position_ws;
+    vec3 normal_ws;
+    vec4 color;
+    vec4 tcoord;
+} vertex;
+
+// Depth has to match between the hair depth pre-pass and the shading pass
+invariant gl_Position;
+
+void main()
+{
+#ifdef INDIRECT
+    int segment = cardSegment;
+#else
+    int segment = texelFetch(cardSegments, firstInstance + gl_InstanceID).r;
+#endif
+    int base = segment * SEGMENT_TEXELS;
+    vec4 t0 = texelFetch(segmentData, base + 0);
+    vec4 t1 = texelFetch(segmentData, base + 1);
+    vec4 t2 = texelFetch(segmentData, base + 2);
+    vec4 t3 = texelFetch(segmentData, base + 3);
+    vec4 t4 = texelFetch(segmentData, base + 4);
+    vec4 t5 = texelFetch(segmentData, base + 5);
+    vec4 t6 = texelFetch(segmentData, base + 6);
+    vec4 t7 = texelFetch(segmentData, base + 7);
+
+    float t = vertexTemplate.x;
+    float u = vertexTemplate.y;
+    float side = vertexTemplate.z;
+    int shape = int(vertexTemplate.w); // the last division can differ from the others
+
+    // Distant cards become ribbons as in hair_planes_geometry.glsl, measured at the segment start.
+    // The thickness planes of the other templates collapse into the ribbon plane.
+    if (ribbonDistance > 0.0f && distance((model * vec4(t3.xyz, 1.0f)).xyz, camera_position) > ribbonDistance)
+    {
+        shape = 3;
+    }
+    if (shape == 3)
+    {
+        side = 0.0f;
+    }
+
+    // Bend the template along the segment
+    vec3 center = ((t0.xyz*t + t1.xyz)*t + t2.xyz)*t + t3.xyz;
+    vec3 widthVector = mix(t4.xyz, t5.xyz, t);
+    vec3 normal = normalize(mix(t6.xyz, t7.xyz, t));
+    float curvatureHeight = mix(t0.w, t1.w, t);
+    vec3 texcoord = mix(vec3(t2.w, t4.w, t6.w), vec3(t3.w, t5.w, t7.w), t); // ustart, v, uend
+
+    vec3 position_ls = center + widthVector*(1.0f - 2.0f*u) + normal*(side*curvatureHeight/2.0f);
+    vec4 position_ws = model * vec4(position_ls, 1.0f);
+
+    if (shape == 3) // camera facing ribbon
+    {
+        // Ribbon: replace the width vector with a side vector perpendicular to the curve and the camera direction
+        vec3 tangent = (3.0f*t0.xyz*t + 2.0f*t1.xyz)*t + t2.xyz;
+        vec3 center_ws = (model * vec4(center, 1.0f)).xyz;
+        vec3 width_ws = (model * vec4(widthVector, 0.0f)).xyz;
+        vec3 sideVector = cross((model * vec4(tangent, 0.0f)).xyz, camera_position - center_ws);
+        if (dot(sideVector, sideVector) < 1e-12f)
+        {
+            sideVector = width_ws; // looking along the curve
+        }
+        sideVector = normalize(sideVector) * sign(dot(sideVector, width_ws) + 1e-12f);
+        position_ws = vec4(center_ws + sideVector*length(width_ws)*(1.0f - 2.0f*u), 1.0f);
+    }
+
+    gl_Position = view_projection * position_ws;
+    vertex.position_ws = position_ws.xyz;
+    vertex.normal_ws = (model * vec4(GetUnifiedNormalLocalSpace(position_ls, normal), 0.0f)).xyz;
+    vertex.color = position_ws;
+    vertex.tcoord = vec4(mix(texcoord.r, texcoord.b, u), texcoord.g, 0.0f, 1.0f);
+}
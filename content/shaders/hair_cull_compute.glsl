@@ -0,0 +1,171 @@
+#version 430 core
+
+// One invocation per card, in the order of GLBezierStrips::BuildCardGroups.
+// SEGMENT_LIST: one invocation per segment, visible segment ids are compacted for the geometry shader path.
+layout(local_size_x = 64) in;
+
+// See GLBezierStrips::BuildSegmentData for the texel layout
+layout(binding = 3) uniform samplerBuffer segmentData;
+const int SEGMENT_TEXELS = 8;
+
+#ifdef SEGMENT_LIST
+// Matches the layout glDrawArraysIndirect reads
+layout(std430, binding = 1) buffer DrawCommand
+{
+    uint count; // zero before the dispatch, one atomic increment per visible segment
+    uint instanceCount;
+    uint first;
+    uint baseInstance;
+};
+layout(std430, binding = 2) writeonly buffer VisibleSegments { int visibleSegments[]; };
+#else
+layout(binding = 5) uniform isamplerBuffer cardSegments; // segment ids sorted by template
+
+struct CardGroup
+{
+    int first;  // first card of the group, also the base instance of its draw
+    int count;
+};
+
+// Matches the layout glMultiDrawElementsIndirect reads
+struct DrawCommand
+{
+    uint count;
+    uint instanceCount; // zero before the dispatch, one atomic increment per visible card
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+layout(std430, binding = 0) readonly buffer CardGroups { CardGroup groups[]; };
+layout(std430, binding = 1) buffer DrawCommands { DrawCommand commands[]; };
+layout(std430, binding = 2) writeonly buffer VisibleCards { int visibleCards[]; }; // segment ids
+
+uniform int numGroups = 0;
+#endif
+
+uniform mat4 cullMatrix; // view_projection * model, the test runs in local space
+uniform int numCards = 0;
+
+// Max depth pyramid of the occluders, see GLHiZBuffer. Level 0 is half the depth buffer resolution.
+layout(binding = 6) uniform sampler2D hizTexture;
+uniform int occlusionCulling = 0;
+uniform int hizLevels = 0;
+uniform int depthWidth = 1; // depth buffer resolution in pixels
+uniform int depthHeight = 1;
+
+bool SphereInFrustum(vec3 center, float radius)
+{
+    // Gribb-Hartmann, the planes are rows of the matrix added to or subtracted from the last row
+    mat4 m = transpose(cullMatrix);
+    for (int i = 0; i < 6; ++i)
+    {
+        vec4 plane = m[3] + ((i & 1) == 0 ? m[i / 2] : -m[i / 2]);
+        if (dot(plane.xyz, center) + plane.w < -radius * length(plane.xyz))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// True when the box around the sphere lies behind the occluders everywhere it covers the screen
+bool SphereOccluded(vec3 center, float radius)
+{
+    vec3 rectMin = vec3(1.0f);
+    vec3 rectMax = vec3(-1.0f);
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0f : -1.0f, (i & 2) != 0 ? 1.0f : -1.0f, (i & 4) != 0 ? 1.0f : -1.0f);
+        vec4 clip = cullMatrix * vec4(corner, 1.0f);
+        if (clip.w <= 0.0f)
+        {
+            return false; // crosses the camera plane
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        rectMin = min(rectMin, ndc);
+        rectMax = max(rectMax, ndc);
+    }
+
+    vec2 depthSize = vec2(depthWidth, depthHeight);
+    ivec2 pixelMin = ivec2(clamp(rectMin.xy * 0.5f + 0.5f, 0.0f, 1.0f) * depthSize);
+    ivec2 pixelMax = ivec2(clamp(rectMax.xy * 0.5f + 0.5f, 0.0f, 1.0f) * depthSize);
+    float nearestDepth = rectMin.z * 0.5f + 0.5f;
+
+    // Level 0 texels cover 2x2 pixels, pick the first level where the rectangle covers at most 2x2 texels
+    int level = 0;
+    while (level + 1 < hizLevels && any(greaterThan((pixelMax >> (level + 1)) - (pixelMin >> (level + 1)), ivec2(1))))
+    {
+        level++;
+    }
+
+    ivec2 levelSize = textureSize(hizTexture, level);
+    ivec2 texelMin = min(pixelMin >> (level + 1), levelSize - 1);
+    ivec2 texelMax = min(pixelMax >> (level + 1), levelSize - 1);
+    float occluderDepth = max(
+        max(texelFetch(hizTexture, texelMin, level).r, texelFetch(hizTexture, ivec2(texelMax.x, texelMin.y), level).r),
+        max(texelFetch(hizTexture, ivec2(texelMin.x, texelMax.y), level).r, texelFetch(hizTexture, texelMax, level).r)
+    );
+    return nearestDepth > occluderDepth;
+}
+
+void main()
+{
+    int card = int(gl_GlobalInvocationID.x);
+    if (card >= numCards)
+    {
+        return;
+    }
+
+#ifdef SEGMENT_LIST
+    int segment = card;
+#else
+    int segment = texelFetch(cardSegments, card).r;
+#endif
+    int base = segment * SEGMENT_TEXELS;
+    vec4 t0 = texelFetch(segmentData, base + 0);
+    vec4 t1 = texelFetch(segmentData, base + 1);
+    vec4 t2 = texelFetch(segmentData, base + 2);
+    vec4 t3 = texelFetch(segmentData, base + 3);
+    vec4 t4 = texelFetch(segmentData, base + 4);
+    vec4 t5 = texelFetch(segmentData, base + 5);
+
+    // Bezier control points from the power basis, the curve stays inside their hull
+    vec3 p0 = t3.xyz;
+    vec3 p1 = p0 + t2.xyz / 3.0f;
+    vec3 p2 = p1 + (t2.xyz + t1.xyz) / 3.0f;
+    vec3 p3 = t0.xyz + t1.xyz + t2.xyz + t3.xyz;
+
+    vec3 center = (p0 + p1 + p2 + p3) * 0.25f;
+    float radius = max(max(distance(center, p0), distance(center, p1)), max(distance(center, p2), distance(center, p3)));
+    radius += max(length(t4.xyz), length(t5.xyz)) + max(t0.w, t1.w); // card width and curvature height
+
+    if (!SphereInFrustum(center, radius) || (occlusionCulling != 0 && SphereOccluded(center, radius)))
+    {
+        return;
+    }
+
+#ifdef SEGMENT_LIST
+    uint slot = atomicAdd(count, 1u);
+    visibleSegments[slot] = segment;
+#else
+    // Up to one group per card template, binary search for the last group starting at or before the card
+    int group = 0;
+    int lastGroup = numGroups - 1;
+    while (group < lastGroup)
+    {
+        int middle = (group + lastGroup + 1) / 2;
+        if (card >= groups[middle].first)
+        {
+            group = middle;
+        }
+        else
+        {
+            lastGroup = middle - 1;
+        }
+    }
+
+    uint slot = atomicAdd(commands[group].instanceCount, 1u);
+    visibleCards[groups[group].first + int(slot)] = segment;
+#endif
+}
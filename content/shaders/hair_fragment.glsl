@@ -2,28 +2,68 @@
 
 layout(location = 0) out vec4 color;
 
-layout (std140, binding = 1) uniform Camera
-{
-    mat4 projection;       // 0 Column1, 16 Column2, 32 Column3, 48 Column4
-    mat4 view;             // 64 Column1, 80 Column2, 96 Column3, 112 Column4
-    vec3 camera_position;  // 128
-};
-uniform mat4 model;
-uniform bool bRenderHairFlat = false;
-uniform bool bDrawDebugNormals = false;
+#include "uniform_blocks.glsl"
+
 uniform vec3 darkColor = vec3(33.0f/255.0f, 17.0f/255.0f, 4.0f/255.0f);
 uniform vec3 lightColor = vec3(145.0f/255.0f, 123.0f/255.0f, 104.0f/255.0f)*0.7;
 uniform float maskCutoff = 0.25f;
 
-layout (std140, binding = 2) uniform Light
+#ifdef EQUAL_DEPTH
+// The depth pre-pass has done the alpha test, only the nearest fragment of each pixel passes GL_EQUAL
+layout(early_fragment_tests) in;
+#endif
+
+#ifdef OVERDRAW
+// Low 16 bits count the shaded fragments, high 16 bits the ones that pass the alpha test. See GLOverdrawCounter.
+layout(binding = 1, r32ui) uniform coherent uimage2D overdrawCounter;
+#endif
+
+// BC5, red is the root to tip color blend and green the alpha mask. See GLPackedTexture.
+layout(binding = 0) uniform sampler2D hairSampler;
+
+#ifdef SELF_SHADOW
+// Card area per voxel of the groom, in voxel faces. See DensityVolume.
+layout(binding = 9) uniform sampler3D hairDensity;
+uniform mat4 densityMatrix;           // world space to [0, 1] volume coordinates
+uniform float shadowDensity = 0.5f;  // share of the card area that blocks light
+const int SHADOW_STEPS = 16;
+const float AMBIENT_VOXELS = 2.0f;    // distance the ambient occlusion looks through
+
+// Light that reaches the fragment through the hair in front of it, from the optical depth
+// between the fragment and the light (or where the ray leaves the volume)
+float HairTransmittance(vec3 start)
 {
-    vec3 light_position;  // 0+16 (occupies 4N when alone)
-    vec4 light_color;     // 16+16
-};
+    vec3 light = (densityMatrix * vec4(light_position, 1.0f)).xyz;
+    vec3 direction = light - start;
+    direction = mix(direction, vec3(1e-6f), lessThan(abs(direction), vec3(1e-6f)));
 
-layout(binding = 0) uniform sampler2D colorSampler;
-layout(binding = 1) uniform sampler2D alphaSampler;
-layout(binding = 2) uniform sampler2D idSampler;
+    vec3 exitDistances = max(-start / direction, (1.0f - start) / direction);
+    float exitDistance = clamp(min(min(exitDistances.x, exitDistances.y), exitDistances.z), 0.0f, 1.0f);
+
+    // Start one voxel toward the light, the card of the fragment itself is in its own voxel
+    vec3 resolution = vec3(textureSize(hairDensity, 0));
+    float voxelDistance = 1.0f / max(length(direction * resolution), 1e-6f);
+    float firstDistance = min(voxelDistance, exitDistance);
+    float stepDistance = (exitDistance - firstDistance) / float(SHADOW_STEPS);
+
+    float density = 0.0f;
+    for (int i = 0; i < SHADOW_STEPS; ++i)
+    {
+        density += texture(hairDensity, start + direction * (firstDistance + (float(i) + 0.5f) * stepDistance)).r;
+    }
+    float opticalDepth = density * stepDistance / voxelDistance;
+    return exp(-shadowDensity * opticalDepth);
+}
+#endif
+
+#ifdef MARSCHNER
+// Marschner lobes baked by GLHairShadingTables. R reflects off the surface, TT passes through
+// the fiber and TRT reflects once inside it, the last two are tinted by the hair color.
+layout(binding = 10) uniform sampler2D longitudinalTable; // (sin theta_i, sin theta_r): M_R, M_TT, M_TRT, cos theta_d
+layout(binding = 11) uniform sampler2D azimuthalTable;    // (cos phi, cos theta_d): N_R, N_TT, N_TRT
+uniform float specularStrength = 1.0f;
+vec3 hairTangent = vec3(0.0f); // set in main, along increasing v
+#endif
 
 // World space attributes
 in VertexAttrib
@@ -34,50 +74,115 @@ in VertexAttrib
     vec4 tcoord;
 } fragment;
 
-// Light is computed in World Space
-vec4 PhongLight()
+#ifdef MARSCHNER
+// Gradient of v on the card from the screen space derivatives (Schuler's surface gradient).
+// Must be called before the discard, derivatives are undefined in non-uniform control flow.
+vec3 HairTangent(vec3 normal)
+{
+    vec3 dpdx = dFdx(fragment.position_ws);
+    vec3 dpdy = dFdy(fragment.position_ws);
+    vec3 r1 = cross(dpdy, normal);
+    vec3 r2 = cross(normal, dpdx);
+    float determinant = dot(dpdx, r1);
+    vec3 gradient = (r1 * dFdx(fragment.tcoord.g) + r2 * dFdy(fragment.tcoord.g)) * sign(determinant);
+    return gradient * inversesqrt(max(dot(gradient, gradient), 1e-20f));
+}
+
+vec3 HairSpecular(vec3 lightDir, vec3 camDir, vec3 albedo)
+{
+    float sinThetaI = clamp(dot(lightDir, hairTangent), -1.0f, 1.0f);
+    float sinThetaR = clamp(dot(camDir, hairTangent), -1.0f, 1.0f);
+    vec4 longitudinal = texture(longitudinalTable, vec2(sinThetaI, sinThetaR) * 0.5f + 0.5f);
+
+    // Azimuth between the light and the camera around the fiber
+    vec3 lightPerpendicular = lightDir - sinThetaI * hairTangent;
+    vec3 cameraPerpendicular = camDir - sinThetaR * hairTangent;
+    float cosPhi = dot(lightPerpendicular, cameraPerpendicular) * inversesqrt(max(dot(lightPerpendicular, lightPerpendicular) * dot(cameraPerpendicular, cameraPerpendicular), 1e-8f));
+    float cosThetaD = longitudinal.a;
+    vec3 azimuthal = texture(azimuthalTable, vec2(cosPhi * 0.5f + 0.5f, cosThetaD)).rgb;
+
+    vec3 lobes = vec3(longitudinal.r * azimuthal.r) + (longitudinal.g * azimuthal.g + longitudinal.b * azimuthal.b) * albedo;
+    float cosThetaI = sqrt(1.0f - sinThetaI * sinThetaI);
+    return specularStrength * lobes * cosThetaI / max(cosThetaD * cosThetaD, 0.05f);
+}
+#endif
+
+// Light is computed in World Space, returns the lit color of a fragment with the albedo
+vec3 PhongLight(vec3 albedo)
 {
     // Light computation
     vec3 lightDir = normalize(light_position-fragment.position_ws);
     vec3 camDir = normalize(camera_position-fragment.position_ws);
     vec3 normal = normalize(fragment.normal_ws);
 
+#ifdef SELF_SHADOW
+    // Ambient light is blocked by the hair around the fragment, direct light by the hair toward the light
+    vec3 volumePosition = (densityMatrix * vec4(fragment.position_ws, 1.0f)).xyz;
+    float ambientOcclusion = exp(-shadowDensity * AMBIENT_VOXELS * texture(hairDensity, volumePosition).r);
+    vec3 ambientLight = ambientOcclusion * vec3(0.2);
+    float lightStrength = light_color.a * HairTransmittance(volumePosition);
+#else
     // Give ambient regions some depth based on camera direction (otherwise the non-lit regions become flat)
     float cameraContrib = clamp(dot(normal, camDir), 0.0, 1.0);
     vec3 ambientLight = cameraContrib * vec3(0.2);
+    float lightStrength = light_color.a;
+#endif
 
     // Ordinary phong diffuse model
     float directLightDot = clamp(dot(normal, lightDir), 0.0, 1.0);
-    float lightStrength = light_color.a;
     vec3 diffuseLight = lightStrength * directLightDot * light_color.rgb;
 
-    // Specular not yet implemented
+#ifdef MARSCHNER
+    vec3 specularLight = lightStrength * light_color.rgb * HairSpecular(lightDir, camDir, albedo);
+#else
     vec3 specularLight = vec3(0.0);
+#endif
 
-    return vec4(ambientLight + diffuseLight + specularLight, 1.0);
+    return (ambientLight + diffuseLight) * albedo + specularLight;
 }
 
 void main()
 {
     vec2 texCoord = fragment.tcoord.rg;
+    vec2 hairSample = texture(hairSampler, texCoord).rg;
+    float alpha = hairSample.g;
 
+#ifdef MARSCHNER
+    hairTangent = HairTangent(normalize(fragment.normal_ws));
+#endif
+
+#ifdef OVERDRAW
+    imageAtomicAdd(overdrawCounter, ivec2(gl_FragCoord.xy), (alpha < maskCutoff) ? 1u : 0x10001u);
+#endif
+
+#if defined(ALPHA_TO_COVERAGE)
+    // No discard, the alpha selects the covered samples. Sharpened so that the edge at maskCutoff
+    // fades over about one pixel instead of the whole (blurry) alpha gradient.
+    float coverage = clamp((alpha - maskCutoff) / max(fwidth(alpha), 0.0001f) + 0.5f, 0.0f, 1.0f);
+#elif !defined(EQUAL_DEPTH)
     // Masked discard
-    vec4 alphaSample = texture(alphaSampler, texCoord);
-    if (alphaSample.r < maskCutoff)
+    if (alpha < maskCutoff)
     {
         discard;
     }
+#endif
     
-    float colorBlend = bRenderHairFlat? 0.5f : texture(colorSampler, texCoord).r;
+#if defined(DEPTH_ONLY)
+    color = vec4(0.0f); // color writes are masked
+#elif defined(DEBUG_NORMALS)
+    color = vec4(normalize(fragment.normal_ws), 1.0f);
+#else
+  #ifdef FLAT_COLOR
+    float colorBlend = 0.5f;
+  #else
+    float colorBlend = hairSample.r;
+  #endif
     vec4 colorSample = vec4(mix(darkColor, lightColor, colorBlend), 1.0f);
-    vec4 idSample = texture(idSampler, texCoord);
-
-    if (bDrawDebugNormals)
-    {
-        color = vec4(normalize(fragment.normal_ws), 1.0f);
-    }
-    else
-    {
-        color = PhongLight() * colorSample;
-    }
+    color = vec4(PhongLight(colorSample.rgb), 1.0f);
+  #if defined(ALPHA_TO_COVERAGE)
+    color.a = coverage;
+  #elif defined(BLENDED)
+    color.a = alpha; // drawn back to front, see GLBezierStrips::SortSegmentsByDepth
+  #endif
+#endif
 }
\ No newline at end of file
@@ -1,30 +1,31 @@
 #version 420 core
 
-layout(lines) in;
-layout(triangle_strip, max_vertices = 72) out; // max segments 4 (subdivisions) as each segment has 6 to 18 vertices. Hardware can only emit 73 vertices in total
+layout(points) in; // one point per precomputed segment
+layout(triangle_strip, max_vertices = 72) out; // max segments 4 (subdivisions) as each segment has 4 to 18 vertices. Hardware can only emit 73 vertices in total
 
-layout (std140, binding = 1) uniform Camera
-{
-    mat4 projection;       // 0 Column1, 16 Column2, 32 Column3, 48 Column4
-    mat4 view;             // 64 Column1, 80 Column2, 96 Column3, 112 Column4
-    vec3 camera_position;  // 128
-};
-uniform mat4 model;
-uniform vec3 unifiedNormalsCapsuleStart = vec3(0.0f, 0.0f, 0.0f);
-uniform vec3 unifiedNormalsCapsuleEnd = vec3(0.0f, 15.0f, 0.0f);
-uniform float normalBlend = 0.9f;
+#include "uniform_blocks.glsl"
+#include "unified_normals.glsl"
+#include "bezier.glsl"
+uniform float ribbonDistance = 0.0f; // segments further away from the camera use the ribbon shape, 0 = disabled
 
-in CPAttrib
+in SegmentAttrib
 {
-    vec3 normal;
-    vec3 tangent;
-    vec3 bitangent;
-    vec3 texcoord;
-    float width;
-    float thickness;
-    int shape;
-    int subdivisions; // max 4
-} controlpoint[];
+    vec3 a;             // bezier in power basis: ((a*t + b)*t + c)*t + start
+    vec3 b;
+    vec3 c;
+    vec3 start;
+    vec3 startWidthVector;
+    vec3 endWidthVector;
+    vec3 startNormal;
+    vec3 endNormal;
+    vec3 startTexcoord; // ustart, v, uend
+    vec3 endTexcoord;
+    float startThickness;
+    float endThickness;
+    int startShape;
+    int endShape;
+    int subdivisions;   // max 4
+} segment[];
 
 // World space attributes
 out VertexAttrib
@@ -35,6 +36,9 @@ out VertexAttrib
     vec4 tcoord;
 } vertex;
 
+// Depth has to match between the hair depth pre-pass and the shading pass
+invariant gl_Position;
+
 // This data is used to define a strip of hair
 struct SegmentData
 {
@@ -67,44 +71,9 @@ struct QuadData
     PointData p4;
 };
 
-
-/*
-    Used to compute normals for all vertices so that the hair gets a smoother appearance.
-*/
-vec3 GetUnifiedNormalLocalSpace(vec3 point_ls, vec3 defaultnormal)
-{
-    vec3 u = unifiedNormalsCapsuleEnd - unifiedNormalsCapsuleStart;
-    vec3 v = point_ls - unifiedNormalsCapsuleStart;
-
-    // Determine if the point_ls is outside the line segment
-    float w_scalar = dot(v, normalize(u));
-    if (w_scalar < 0.0f)
-    {
-        return normalize(mix(defaultnormal, normalize(point_ls-unifiedNormalsCapsuleStart), normalBlend));
-    }
-    else if (w_scalar > length(u))
-    {
-        return normalize(mix(defaultnormal, normalize(point_ls-unifiedNormalsCapsuleEnd), normalBlend));
-    }
-    else
-    {
-        vec3 perpendicular = normalize(u)*w_scalar;
-        return normalize(mix(defaultnormal, normalize(v-perpendicular), normalBlend));
-    }
-
-    return defaultnormal;
-}
-
-vec3 bezier(vec3 p1, vec3 p2, vec3 p3, vec3 p4, float t)
+vec3 bezier(float t)
 {
-    vec3 sub1 = mix(p1, p2, t);
-    vec3 sub2 = mix(p2, p3, t);
-    vec3 sub3 = mix(p3, p4, t);
-
-    vec3 subsub1 = mix(sub1, sub2, t);
-    vec3 subsub2 = mix(sub2, sub3, t);
-
-    return mix(subsub1, subsub2, t);
+    return bezierPowerBasis(segment[0].a, segment[0].b, segment[0].c, segment[0].start, t);
 }
 
 bool ShouldFlipTriangle(vec3 start, vec3 end, vec3 topright, vec3 topleft)
@@ -176,13 +145,12 @@ void GenerateSingleQuad(SegmentData data)
     p4.position_ws = model * p4.position;
 
     // Project into clip space
-    mat4 vp = projection * view;
+    mat4 vp = view_projection;
     p1.position = vp * p1.position_ws;
     p2.position = vp * p2.position_ws;
     p3.position = vp * p3.position_ws;
     p4.position = vp * p4.position_ws;
 
-
     if (bFlipTriangle)
     {
         EmitTriangle(p1, p2, p4);
@@ -260,7 +228,7 @@ void GenerateDoubleQuad(SegmentData data)
     p6.position_ws = model * p6.position;
 
     // Project into clip space
-    mat4 vp = projection * view;
+    mat4 vp = view_projection;
     p1.position = vp * p1.position_ws;
     p2.position = vp * p2.position_ws;
     p3.position = vp * p3.position_ws;
@@ -382,7 +350,7 @@ void GenerateTripleQuad(SegmentData data)
     p8.position_ws = model * p8.position;
 
     // Project into clip space
-    mat4 vp = projection * view;
+    mat4 vp = view_projection;
     p1.position = vp * p1.position_ws;
     p2.position = vp * p2.position_ws;
     p3.position = vp * p3.position_ws;
@@ -426,6 +394,67 @@ void GenerateTripleQuad(SegmentData data)
     }
 }
 
+void GenerateRibbon(SegmentData data)
+{
+    /*
+        p4 --- end --- p3
+        |             / |
+        |          /    |       The width vectors are replaced by side vectors that are
+        |       /       |       perpendicular to the segment and the camera direction,
+        |    /          |       emitted as a single strip of 4 vertices.
+        | /             |
+        p1 ---start--- p2
+    */
+
+    PointData p1;
+    PointData p2;
+    PointData p3;
+    PointData p4;
+
+    // texcoord.rgb = (r=ustart, g=v, b=uend)
+    p1.texcoord = vec2(data.startTexcoord.r, data.startTexcoord.g);
+    p2.texcoord = vec2(data.startTexcoord.b, data.startTexcoord.g);
+    p3.texcoord = vec2(data.endTexcoord.b, data.endTexcoord.g);
+    p4.texcoord = vec2(data.endTexcoord.r, data.endTexcoord.g);
+
+    // Normals are based on the unaligned card, the ribbon is only used at a distance
+    p1.normal = (model * vec4(GetUnifiedNormalLocalSpace(data.start + data.startWidthVector, data.startNormal), 0.0f)).xyz;
+    p2.normal = (model * vec4(GetUnifiedNormalLocalSpace(data.start - data.startWidthVector, data.startNormal), 0.0f)).xyz;
+    p3.normal = (model * vec4(GetUnifiedNormalLocalSpace(data.end - data.endWidthVector, data.endNormal), 0.0f)).xyz;
+    p4.normal = (model * vec4(GetUnifiedNormalLocalSpace(data.end + data.endWidthVector, data.endNormal), 0.0f)).xyz;
+
+    // World space, the side vectors keep the direction of the width vectors so the texture is not mirrored
+    vec3 start_ws = (model * vec4(data.start, 1.0f)).xyz;
+    vec3 end_ws = (model * vec4(data.end, 1.0f)).xyz;
+    vec3 startWidth_ws = (model * vec4(data.startWidthVector, 0.0f)).xyz;
+    vec3 endWidth_ws = (model * vec4(data.endWidthVector, 0.0f)).xyz;
+
+    vec3 side = cross(end_ws - start_ws, camera_position - start_ws);
+    if (dot(side, side) < 1e-12f)
+    {
+        side = startWidth_ws; // looking along the segment
+    }
+    side = normalize(side) * sign(dot(side, startWidth_ws) + 1e-12f);
+
+    p1.position_ws = vec4(start_ws + side*length(startWidth_ws), 1.0f);
+    p2.position_ws = vec4(start_ws - side*length(startWidth_ws), 1.0f);
+    p3.position_ws = vec4(end_ws - side*length(endWidth_ws), 1.0f);
+    p4.position_ws = vec4(end_ws + side*length(endWidth_ws), 1.0f);
+
+    // Project into clip space
+    mat4 vp = view_projection;
+    p1.position = vp * p1.position_ws;
+    p2.position = vp * p2.position_ws;
+    p3.position = vp * p3.position_ws;
+    p4.position = vp * p4.position_ws;
+
+    EmitPointData(p1);
+    EmitPointData(p2);
+    EmitPointData(p4);
+    EmitPointData(p3);
+    EndPrimitive();
+}
+
 void GenerateSegment(SegmentData data)
 {
     switch (data.shape)
@@ -433,61 +462,68 @@ void GenerateSegment(SegmentData data)
         case 0: { GenerateSingleQuad(data); break; }
         case 1: { GenerateDoubleQuad(data); break; }
         case 2: { GenerateTripleQuad(data); break; }
+        case 3: { GenerateRibbon(data); break; }
+    }
+}
+
+// Picks the ribbon for distant segments, the thickness of the other shapes is not visible there
+int SelectShape(int shape)
+{
+    if (ribbonDistance > 0.0f)
+    {
+        vec3 start_ws = (model * vec4(segment[0].start, 1.0f)).xyz;
+        if (distance(start_ws, camera_position) > ribbonDistance)
+        {
+            return 3;
+        }
     }
+    return shape;
 }
 
 void main()
 {
-    vec3 start = gl_in[0].gl_Position.xyz;
-    vec3 end = gl_in[1].gl_Position.xyz;
-    vec3 startWidthVector = controlpoint[0].bitangent*controlpoint[0].width;
-    vec3 endWidthVector = controlpoint[1].bitangent*controlpoint[1].width;
-
-    // Bezier control points
-    vec3 bcp1 = start;
-    vec3 bcp2 = start + controlpoint[0].tangent;
-    vec3 bcp3 = end - controlpoint[1].tangent;
-    vec3 bcp4 = end;
-
-    SegmentData segment;
-    segment.shape = controlpoint[0].shape; // all divisions except the last have the same shape as the first control point
-    segment.start = start;
-    segment.startWidthVector = startWidthVector;
-    segment.startCurvatureHeight = controlpoint[0].thickness;
-    segment.startNormal = controlpoint[0].normal;
-    segment.startTexcoord = controlpoint[0].texcoord;
-
-    if (controlpoint[0].subdivisions > 0)
+    vec3 start = segment[0].start;
+    vec3 end = segment[0].a + segment[0].b + segment[0].c + start;
+
+    SegmentData data;
+    data.shape = SelectShape(segment[0].startShape); // all divisions except the last have the same shape as the first control point
+    data.start = start;
+    data.startWidthVector = segment[0].startWidthVector;
+    data.startCurvatureHeight = segment[0].startThickness;
+    data.startNormal = segment[0].startNormal;
+    data.startTexcoord = segment[0].startTexcoord;
+
+    if (segment[0].subdivisions > 0)
     {
-        float timestep = 1.0f/controlpoint[0].subdivisions;
-        for (int i=1; i<controlpoint[0].subdivisions; i++)
+        float timestep = 1.0f/segment[0].subdivisions;
+        for (int i=1; i<segment[0].subdivisions; i++)
         {
             // Endpoints
             float t = i*timestep;
-            segment.end = bezier(bcp1, bcp2, bcp3, bcp4, t);
-            segment.endWidthVector = mix(startWidthVector, endWidthVector, t);
-            segment.endCurvatureHeight = mix(controlpoint[0].thickness, controlpoint[1].thickness, t);
-            segment.endNormal = normalize(mix(controlpoint[0].normal, controlpoint[1].normal, t));
-            segment.endTexcoord = mix(controlpoint[0].texcoord, controlpoint[1].texcoord, t);
+            data.end = bezier(t);
+            data.endWidthVector = mix(segment[0].startWidthVector, segment[0].endWidthVector, t);
+            data.endCurvatureHeight = mix(segment[0].startThickness, segment[0].endThickness, t);
+            data.endNormal = normalize(mix(segment[0].startNormal, segment[0].endNormal, t));
+            data.endTexcoord = mix(segment[0].startTexcoord, segment[0].endTexcoord, t);
 
             // Generate
-            GenerateSegment(segment);
+            GenerateSegment(data);
 
             // Update startpoints for next iteration
-            segment.start = segment.end;
-            segment.startWidthVector = segment.endWidthVector;
-            segment.startCurvatureHeight = segment.endCurvatureHeight;
-            segment.startNormal = segment.endNormal;
-            segment.startTexcoord = segment.endTexcoord;
+            data.start = data.end;
+            data.startWidthVector = data.endWidthVector;
+            data.startCurvatureHeight = data.endCurvatureHeight;
+            data.startNormal = data.endNormal;
+            data.startTexcoord = data.endTexcoord;
         }
     }
 
     // Generate last segment
-    segment.shape = controlpoint[1].shape; // todo: solve transition
-    segment.end = end;
-    segment.endWidthVector = endWidthVector;
-    segment.endCurvatureHeight = controlpoint[1].thickness;
-    segment.endNormal = controlpoint[1].normal;
-    segment.endTexcoord = controlpoint[1].texcoord;
-    GenerateSegment(segment);
+    data.shape = SelectShape(segment[0].endShape); // todo: solve transition
+    data.end = end;
+    data.endWidthVector = segment[0].endWidthVector;
+    data.endCurvatureHeight = segment[0].endThickness;
+    data.endNormal = segment[0].endNormal;
+    data.endTexcoord = segment[0].endTexcoord;
+    GenerateSegment(data);
 }
\ No newline at end of file
@@ -0,0 +1,77 @@
+#version 420 core
+
+// One vertex per segment, see GLBezierStrips::BuildSegmentData for the texel layout
+layout(binding = 3) uniform samplerBuffer segmentData;
+layout(binding = 4) uniform isamplerBuffer segmentFlags;
+const int SEGMENT_TEXELS = 8;
+
+#ifdef CULLED
+// Segments that passed hair_cull_compute.glsl, drawn with glDrawArraysIndirect
+layout(binding = 7) uniform isamplerBuffer visibleSegments;
+#endif
+
+#ifdef OVERRIDES
+uniform int shapeOverride = -1;
+uniform int subdivisionsOverride = -1;
+#endif
+
+out SegmentAttrib
+{
+    vec3 a;             // bezier in power basis: ((a*t + b)*t + c)*t + start
+    vec3 b;
+    vec3 c;
+    vec3 start;
+    vec3 startWidthVector;
+    vec3 endWidthVector;
+    vec3 startNormal;
+    vec3 endNormal;
+    vec3 startTexcoord; // ustart, v, uend
+    vec3 endTexcoord;
+    float startThickness;
+    float endThickness;
+    int startShape;
+    int endShape;
+    int subdivisions;   // max 4
+} segment;
+
+void main()
+{
+#ifdef CULLED
+    int segmentId = texelFetch(visibleSegments, gl_VertexID).r;
+#else
+    int segmentId = gl_VertexID;
+#endif
+    int base = segmentId * SEGMENT_TEXELS;
+    vec4 t0 = texelFetch(segmentData, base + 0);
+    vec4 t1 = texelFetch(segmentData, base + 1);
+    vec4 t2 = texelFetch(segmentData, base + 2);
+    vec4 t3 = texelFetch(segmentData, base + 3);
+    vec4 t4 = texelFetch(segmentData, base + 4);
+    vec4 t5 = texelFetch(segmentData, base + 5);
+    vec4 t6 = texelFetch(segmentData, base + 6);
+    vec4 t7 = texelFetch(segmentData, base + 7);
+    ivec4 flags = texelFetch(segmentFlags, segmentId);
+
+    gl_Position = vec4(t3.xyz, 1.0f);
+    segment.a = t0.xyz;
+    segment.b = t1.xyz;
+    segment.c = t2.xyz;
+    segment.start = t3.xyz;
+    segment.startWidthVector = t4.xyz;
+    segment.endWidthVector = t5.xyz;
+    segment.startNormal = t6.xyz;
+    segment.endNormal = t7.xyz;
+    segment.startTexcoord = vec3(t2.w, t4.w, t6.w);
+    segment.endTexcoord = vec3(t3.w, t5.w, t7.w);
+    segment.startThickness = t0.w;
+    segment.endThickness = t1.w;
+#ifdef OVERRIDES
+    segment.startShape = (shapeOverride >= 0)? shapeOverride : flags.x;
+    segment.endShape = (shapeOverride >= 0)? shapeOverride : flags.y;
+    segment.subdivisions = (subdivisionsOverride >= 0)? subdivisionsOverride : flags.z;
+#else
+    segment.startShape = flags.x;
+    segment.endShape = flags.y;
+    segment.subdivisions = flags.z;
+#endif
+}
@@ -2,19 +2,7 @@
 
 layout(location = 0) out vec4 color;
 
-layout (std140, binding = 1) uniform Camera
-{
-    mat4 projection;       // 0 Column1, 16 Column2, 32 Column3, 48 Column4
-    mat4 view;             // 64 Column1, 80 Column2, 96 Column3, 112 Column4
-    vec3 camera_position;  // 128
-};
-uniform mat4 model;
-
-layout (std140, binding = 2) uniform Light
-{
-    vec3 light_position;  // 0+16 (occupies 4N when alone)
-    vec4 light_color;     // 16+16
-};
+#include "uniform_blocks.glsl"
 
 uniform sampler2D textureSampler;
 
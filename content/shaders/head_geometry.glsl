@@ -1,12 +1,13 @@
 #version 420 core
 
+// Debug stage, only compiled into the FLAT_SHADING variant of the head program
 layout(triangles) in;
 layout(triangle_strip, max_vertices = 3) out;
 
 // World space attributes
 in VertexAttrib
 {
-    vec3 position; // discarded
+    vec3 position;
     vec3 normal;
     vec4 color;
     vec4 tcoord;
@@ -36,9 +37,8 @@ void main()
     {
         gl_Position = gl_in[i].gl_Position;
 
-        vertexout.position = gl_in[i].gl_Position.xyz;
-        //vertexout.normal = avgNormal;
-        vertexout.normal = vertex[i].normal;
+        vertexout.position = vertex[i].position;
+        vertexout.normal = avgNormal;
         vertexout.color = vertex[i].color;
         vertexout.tcoord = vertex[i].tcoord;
         EmitVertex();
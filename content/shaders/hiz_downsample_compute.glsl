@@ -0,0 +1,26 @@
+#version 430 core
+
+// One level of GLHiZBuffer, every texel keeps the farthest depth of the 2x2 source texels below it
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0) uniform sampler2D source; // the depth buffer for level 0, the previous level otherwise
+layout(r32f, binding = 0) writeonly uniform image2D destination;
+uniform int sourceLevel = 0;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(texel, imageSize(destination))))
+    {
+        return;
+    }
+
+    // Odd sizes are rounded up, the texels past the edge repeat the last row or column
+    ivec2 sourceMax = textureSize(source, sourceLevel) - 1;
+    ivec2 base = texel * 2;
+    float depth = max(
+        max(texelFetch(source, min(base, sourceMax), sourceLevel).r, texelFetch(source, min(base + ivec2(1, 0), sourceMax), sourceLevel).r),
+        max(texelFetch(source, min(base + ivec2(0, 1), sourceMax), sourceLevel).r, texelFetch(source, min(base + ivec2(1, 1), sourceMax), sourceLevel).r)
+    );
+    imageStore(destination, texel, vec4(depth));
+}
@@ -3,13 +3,7 @@
 layout(location = 0) in vec3 vertexPosition;
 layout(location = 2) in vec4 vertexColor;
 
-layout (std140, binding = 1) uniform Camera
-{
-    mat4 projection;       // 0 Column1, 16 Column2, 32 Column3, 48 Column4
-    mat4 view;             // 64 Column1, 80 Column2, 96 Column3, 112 Column4
-    vec3 camera_position;  // 128
-};
-uniform mat4 model;
+#include "uniform_blocks.glsl"
 
 uniform bool transformVerticesInVertexShader = true;
 uniform bool useUniformColor = false;
@@ -26,7 +20,7 @@ out VertexAttrib
 
 void main()
 {
-    gl_Position = transformVerticesInVertexShader? projection * view * model * vec4(vertexPosition, 1.0f) : vec4(vertexPosition, 1.0f);
+    gl_Position = transformVerticesInVertexShader? view_projection * model * vec4(vertexPosition, 1.0f) : vec4(vertexPosition, 1.0f);
     vertex.position = transformVerticesInVertexShader? (model * gl_Position).xyz : gl_Position.xyz;
     vertex.color = useUniformColor? uniformColor : vertexColor;
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#version 420 core
+
+layout(location = 0) out vec4 color;
+
+// Written by the OVERDRAW variant of hair_fragment.glsl, see GLOverdrawCounter
+layout(binding = 8) uniform usampler2D overdrawCounter;
+uniform int maxOverdraw = 32;      // fragment count at the top of the color ramp
+uniform int showDiscarded = 0;     // heat of the discarded fragments instead of all shaded ones
+
+// Black, blue, green, yellow, red, white
+vec3 Heat(float x)
+{
+    const vec3 ramp[6] = vec3[6](
+        vec3(0.0f), vec3(0.0f, 0.2f, 1.0f), vec3(0.0f, 0.9f, 0.3f),
+        vec3(1.0f, 0.9f, 0.0f), vec3(1.0f, 0.1f, 0.0f), vec3(1.0f)
+    );
+    float position = clamp(x, 0.0f, 1.0f) * 5.0f;
+    int index = min(int(position), 4);
+    return mix(ramp[index], ramp[index + 1], position - float(index));
+}
+
+void main()
+{
+    uint counts = texelFetch(overdrawCounter, ivec2(gl_FragCoord.xy), 0).r;
+    uint shaded = counts & 0xFFFFu;
+    uint passed = counts >> 16;
+    uint value = (showDiscarded != 0) ? shaded - passed : shaded;
+
+    color = vec4(Heat(float(value) / float(max(maxOverdraw, 1))), 1.0f);
+}
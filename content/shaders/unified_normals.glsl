@@ -0,0 +1,30 @@
+uniform vec3 unifiedNormalsCapsuleStart = vec3(0.0f, 0.0f, 0.0f);
+uniform vec3 unifiedNormalsCapsuleEnd = vec3(0.0f, 15.0f, 0.0f);
+uniform float normalBlend = 0.9f;
+
+/*
+    Used to compute normals for all vertices so that the hair gets a smoother appearance.
+*/
+vec3 GetUnifiedNormalLocalSpace(vec3 point_ls, vec3 defaultnormal)
+{
+    vec3 u = unifiedNormalsCapsuleEnd - unifiedNormalsCapsuleStart;
+    vec3 v = point_ls - unifiedNormalsCapsuleStart;
+
+    // Determine if the point_ls is outside the line segment
+    float w_scalar = dot(v, normalize(u));
+    if (w_scalar < 0.0f)
+    {
+        return normalize(mix(defaultnormal, normalize(point_ls-unifiedNormalsCapsuleStart), normalBlend));
+    }
+    else if (w_scalar > length(u))
+    {
+        return normalize(mix(defaultnormal, normalize(point_ls-unifiedNormalsCapsuleEnd), normalBlend));
+    }
+    else
+    {
+        vec3 perpendicular = normalize(u)*w_scalar;
+        return normalize(mix(defaultnormal, normalize(v-perpendicular), normalBlend));
+    }
+
+    return defaultnormal;
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+// Shared by all scene shaders, mirrored in C++ by source/opengl/uniformbuffer.h
+// std140 has an explicit memory layout. A bit wasteful if not careful, but will always be the same.
+// float, int, bool = 4 bytes (N)
+// vector = 2N or 4N
+//  vec2 = 2N
+//  vec3 = 4N
+//  vec4 = 4N
+// matrices
+//  stored as array of column vectors. aligned as vec4 (4N)
+// struct
+//  padded to align with a multiple of 4N
+// With the calculated offset values, based on the rules of the std140 layout, we can fill the buffer with the variable data at each offset using functions like glBufferSubData.
+layout (std140, binding = 1) uniform Camera
+{
+    mat4 projection;       // 0 Column1, 16 Column2, 32 Column3, 48 Column4
+    mat4 view;             // 64 Column1, 80 Column2, 96 Column3, 112 Column4
+    mat4 view_projection;  // 128 Column1, 144 Column2, 160 Column3, 176 Column4
+    vec3 camera_position;  // 192
+};
+
+layout (std140, binding = 2) uniform Light
+{
+    vec3 light_position;  // 0+16 (occupies 4N when alone)
+    vec4 light_color;     // 16+16
+};
+
+layout (std140, binding = 3) uniform Object
+{
+    mat4 model;            // 0 Column1, 16 Column2, 32 Column3, 48 Column4
+};
\ No newline at end of file
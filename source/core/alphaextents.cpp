@@ -0,0 +1,148 @@
+#include "alphaextents.h"
+#include "threads.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+static int FloorDivide(int value, int divisor)
+{
+	return (value >= 0) ? value / divisor : -((-value + divisor - 1) / divisor);
+}
+
+void AlphaExtents::Build(const uint8_t* pixels, int textureWidth, int textureHeight, int channel, float cutoff)
+{
+	width = textureWidth;
+	height = textureHeight;
+	nextOpaque.resize(size_t(width) * height);
+	previousOpaque.resize(size_t(width) * height);
+
+	int threshold = int(std::ceil(cutoff * 255.0f));
+	Threads::ParallelFor(size_t(height), [&](size_t beginRow, size_t endRow) {
+		for (size_t y = beginRow; y < endRow; ++y)
+		{
+			const uint8_t* row = pixels + y * width * 4;
+			int* next = nextOpaque.data() + y * width;
+			int* previous = previousOpaque.data() + y * width;
+
+			int last = -1;
+			for (int x = 0; x < width; ++x)
+			{
+				if (row[x * 4 + channel] >= threshold) last = x;
+				previous[x] = last;
+			}
+			int first = width;
+			for (int x = width - 1; x >= 0; --x)
+			{
+				if (row[x * 4 + channel] >= threshold) first = x;
+				next[x] = first;
+			}
+		}
+	}, 16);
+}
+
+bool AlphaExtents::RowExtent(int row, int x0, int x1, int& first, int& last) const
+{
+	int offset = FloorDivide(x0, width) * width;
+	x0 -= offset;
+	x1 -= offset;
+	first = INT_MAX;
+	last = INT_MIN;
+
+	const int* next = nextOpaque.data() + size_t(row) * width;
+	const int* previous = previousOpaque.data() + size_t(row) * width;
+
+	// The range starts in [0, width) and wraps into the next copy of the texture at most once
+	int end = std::min(x1, width - 1);
+	if (next[x0] <= end)
+	{
+		first = next[x0] + offset;
+		last = previous[end] + offset;
+	}
+	if (x1 >= width && next[0] <= x1 - width)
+	{
+		first = std::min(first, next[0] + offset + width);
+		last = previous[x1 - width] + offset + width;
+	}
+	return first <= last;
+}
+
+void AlphaExtents::SymmetricTrim(const glm::fvec3& startTexcoord, const glm::fvec3& endTexcoord, float& startTrim, float& endTrim) const
+{
+	startTrim = endTrim = 0.0f;
+	if (!IsValid())
+	{
+		return;
+	}
+
+	// Texel rows whose bilinear footprint touches the v band
+	float vMin = std::min(startTexcoord.y, endTexcoord.y);
+	float vMax = std::max(startTexcoord.y, endTexcoord.y);
+	int rowMin = int(std::floor(vMin * height - 0.5f));
+	int rowMax = int(std::ceil(vMax * height - 0.5f));
+	rowMax = std::min(rowMax, rowMin + height - 1);
+	float vLength = endTexcoord.y - startTexcoord.y;
+
+	// The largest trim allowed where the card crosses each row, as {t along the card, trim}
+	std::vector<glm::fvec2> bounds;
+	bounds.reserve(size_t(rowMax - rowMin + 1) * 2);
+	for (int row = rowMin; row <= rowMax; ++row)
+	{
+		// Cards that run along u cross every row at both ends
+		float t0 = 0.0f, t1 = 1.0f;
+		if (std::abs(vLength) * height >= 1.0f)
+		{
+			t0 = t1 = std::clamp(((row + 0.5f) / height - startTexcoord.y) / vLength, 0.0f, 1.0f);
+		}
+
+		for (float t : { t0, t1 })
+		{
+			float uStart = startTexcoord.x + (endTexcoord.x - startTexcoord.x) * t;
+			float uEnd = startTexcoord.z + (endTexcoord.z - startTexcoord.z) * t;
+			float uLength = uEnd - uStart;
+			int x0 = int(std::floor(std::min(uStart, uEnd) * width - 0.5f));
+			int x1 = int(std::ceil(std::max(uStart, uEnd) * width - 0.5f));
+			if (std::abs(uLength) * width < 1.0f || x1 - x0 >= width)
+			{
+				return; // narrower than a texel or wrapping around the whole texture
+			}
+
+			float trim = 0.5f;
+			int first = 0, last = 0;
+			int wrappedRow = row - FloorDivide(row, height) * height;
+			if (RowExtent(wrappedRow, x0, x1, first, last))
+			{
+				float cardFirst = ((first + 0.5f - MARGIN_TEXELS) / width - uStart) / uLength;
+				float cardLast = ((last + 0.5f + MARGIN_TEXELS) / width - uStart) / uLength;
+				trim = std::clamp(std::min(std::min(cardFirst, cardLast), 1.0f - std::max(cardFirst, cardLast)), 0.0f, 0.5f);
+			}
+			bounds.push_back(glm::fvec2(t, trim));
+		}
+	}
+
+	// Small linear fit: for a few start trims, the largest end trim that stays below every bound
+	const int START_STEPS = 8;
+	float bestSum = 0.0f;
+	for (int step = 0; step <= START_STEPS; ++step)
+	{
+		float start = 0.5f * step / START_STEPS;
+		float end = 0.5f;
+		for (const glm::fvec2& bound : bounds)
+		{
+			if (bound.x < 1e-4f)
+			{
+				if (start > bound.y) end = -1.0f;
+			}
+			else
+			{
+				end = std::min(end, (bound.y - start * (1.0f - bound.x)) / bound.x);
+			}
+		}
+
+		if (end >= 0.0f && start + end > bestSum)
+		{
+			bestSum = start + end;
+			startTrim = start;
+			endTrim = end;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "math.h"
+
+/*
+	Opaque extents of an alpha mask, used to shrink hair cards to the part of their texture
+	strip that survives the alpha test.
+
+	Every texel stores the column of the next opaque texel to its right and the previous one
+	to its left in the same row, so the opaque span of any row range is found with two reads.
+	Cards map their width to a texture u range {ustart, uend} and their length to a v range.
+	SymmetricTrim walks the texel rows of that band, finds how much of the card width holds
+	no texel at or above the cutoff where it crosses each row, and fits a trim at both ends
+	of the card whose linear blend stays within that bound.
+*/
+class AlphaExtents
+{
+protected:
+	int width = 0;
+	int height = 0;
+	std::vector<int> nextOpaque;     // width when there is none to the right
+	std::vector<int> previousOpaque; // -1 when there is none to the left
+
+	// Opaque span of a row within [x0, x1], in unwrapped texel columns less than a width apart
+	bool RowExtent(int row, int x0, int x1, int& first, int& last) const;
+
+public:
+	// Texels past the opaque span that are kept, covers the bilinear footprint and mip bleeding
+	static constexpr float MARGIN_TEXELS = 1.5f;
+
+	// pixels is RGBA8, channel holds the alpha mask
+	void Build(const uint8_t* pixels, int width, int height, int channel, float cutoff);
+	bool IsValid() const { return width > 0 && height > 0; }
+
+	/*
+		Fractions of the card width, in [0, 0.5], that can be removed from both sides at the
+		start and end of a card with the given {ustart, v, uend} texcoords. Both sides are
+		trimmed by the same amount so the card center, and the fold of the multi-plane shapes,
+		stay on the curve. 0.5 removes the card. Texcoords wrap like GL_REPEAT.
+	*/
+	void SymmetricTrim(const glm::fvec3& startTexcoord, const glm::fvec3& endTexcoord, float& startTrim, float& endTrim) const;
+};
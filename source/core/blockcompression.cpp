@@ -0,0 +1,192 @@
+#include "blockcompression.h"
+#include "threads.h"
+#include <algorithm>
+
+static void BuildPalette(uint8_t endpoint0, uint8_t endpoint1, uint8_t palette[8])
+{
+	palette[0] = endpoint0;
+	palette[1] = endpoint1;
+	if (endpoint0 > endpoint1)
+	{
+		for (int i = 1; i < 7; ++i)
+		{
+			palette[i + 1] = uint8_t(((7 - i) * endpoint0 + i * endpoint1 + 3) / 7);
+		}
+	}
+	else
+	{
+		for (int i = 1; i < 5; ++i)
+		{
+			palette[i + 1] = uint8_t(((5 - i) * endpoint0 + i * endpoint1 + 2) / 5);
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+// Picks the nearest palette entry per texel, returns the squared error
+static int FitIndices(const uint8_t texels[16], const uint8_t palette[8], uint8_t indices[16])
+{
+	int totalError = 0;
+	for (int t = 0; t < 16; ++t)
+	{
+		int bestError = 256 * 256;
+		for (int i = 0; i < 8; ++i)
+		{
+			int difference = int(texels[t]) - int(palette[i]);
+			int error = difference * difference;
+			if (error < bestError)
+			{
+				bestError = error;
+				indices[t] = uint8_t(i);
+			}
+		}
+		totalError += bestError;
+	}
+	return totalError;
+}
+
+static void WriteBlock(uint8_t endpoint0, uint8_t endpoint1, const uint8_t indices[16], uint8_t* output)
+{
+	output[0] = endpoint0;
+	output[1] = endpoint1;
+
+	// 48 bits of indices, texel 0 in the lowest bits
+	uint64_t bits = 0;
+	for (int t = 0; t < 16; ++t)
+	{
+		bits |= uint64_t(indices[t]) << (3 * t);
+	}
+	for (int i = 0; i < 6; ++i)
+	{
+		output[2 + i] = uint8_t(bits >> (8 * i));
+	}
+}
+
+// Copies a 4x4 block of one channel, texels past the edge repeat the last row or column
+static void GatherBlock(const uint8_t* pixels, int width, int height, int blockX, int blockY, int channel, uint8_t texels[16])
+{
+	for (int y = 0; y < 4; ++y)
+	{
+		int sourceY = std::min(blockY * 4 + y, height - 1);
+		for (int x = 0; x < 4; ++x)
+		{
+			int sourceX = std::min(blockX * 4 + x, width - 1);
+			texels[y * 4 + x] = pixels[(size_t(sourceY) * width + sourceX) * 4 + channel];
+		}
+	}
+}
+
+static std::vector<uint8_t> EncodeChannels(const uint8_t* pixels, int width, int height, const int* channels, int numChannels)
+{
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	size_t blockBytes = size_t(BlockCompression::BC4_BLOCK_BYTES) * numChannels;
+	std::vector<uint8_t> output(size_t(blocksX) * blocksY * blockBytes);
+
+	Threads::ParallelFor(size_t(blocksY), [&](size_t beginRow, size_t endRow) {
+		uint8_t texels[16];
+		for (size_t blockY = beginRow; blockY < endRow; ++blockY)
+		{
+			for (int blockX = 0; blockX < blocksX; ++blockX)
+			{
+				uint8_t* block = output.data() + (blockY * blocksX + blockX) * blockBytes;
+				for (int c = 0; c < numChannels; ++c)
+				{
+					GatherBlock(pixels, width, height, blockX, int(blockY), channels[c], texels);
+					BlockCompression::EncodeBC4Block(texels, block + c * BlockCompression::BC4_BLOCK_BYTES);
+				}
+			}
+		}
+	}, 4);
+	return output;
+}
+
+namespace BlockCompression
+{
+	void EncodeBC4Block(const uint8_t texels[16], uint8_t* output)
+	{
+		uint8_t minValue = 255, maxValue = 0;
+		uint8_t innerMin = 255, innerMax = 0; // ignoring 0 and 255, which the 6 value mode stores exactly
+		for (int t = 0; t < 16; ++t)
+		{
+			minValue = std::min(minValue, texels[t]);
+			maxValue = std::max(maxValue, texels[t]);
+			if (texels[t] != 0 && texels[t] != 255)
+			{
+				innerMin = std::min(innerMin, texels[t]);
+				innerMax = std::max(innerMax, texels[t]);
+			}
+		}
+
+		uint8_t palette[8];
+		uint8_t indices[16];
+		if (minValue == maxValue)
+		{
+			BuildPalette(minValue, minValue, palette);
+			FitIndices(texels, palette, indices);
+			WriteBlock(minValue, minValue, indices, output);
+			return;
+		}
+
+		// 8 values between the extremes
+		BuildPalette(maxValue, minValue, palette);
+		int error8 = FitIndices(texels, palette, indices);
+
+		// 6 values between the inner extremes plus 0 and 255
+		if (innerMin > innerMax)
+		{
+			innerMin = innerMax = minValue; // only 0 and 255 in the block
+		}
+		uint8_t palette6[8];
+		uint8_t indices6[16];
+		BuildPalette(innerMin, innerMax, palette6);
+		int error6 = FitIndices(texels, palette6, indices6);
+
+		if (error6 < error8)
+		{
+			WriteBlock(innerMin, innerMax, indices6, output);
+		}
+		else
+		{
+			WriteBlock(maxValue, minValue, indices, output);
+		}
+	}
+
+	void DecodeBC4Block(const uint8_t* block, uint8_t texels[16])
+	{
+		uint8_t palette[8];
+		BuildPalette(block[0], block[1], palette);
+
+		uint64_t bits = 0;
+		for (int i = 0; i < 6; ++i)
+		{
+			bits |= uint64_t(block[2 + i]) << (8 * i);
+		}
+		for (int t = 0; t < 16; ++t)
+		{
+			texels[t] = palette[(bits >> (3 * t)) & 7];
+		}
+	}
+
+	size_t BC4Size(int width, int height)
+	{
+		return size_t((width + 3) / 4) * ((height + 3) / 4) * BC4_BLOCK_BYTES;
+	}
+
+	size_t BC5Size(int width, int height)
+	{
+		return size_t((width + 3) / 4) * ((height + 3) / 4) * BC5_BLOCK_BYTES;
+	}
+
+	std::vector<uint8_t> EncodeBC4(const uint8_t* pixels, int width, int height, int channel)
+	{
+		return EncodeChannels(pixels, width, height, &channel, 1);
+	}
+
+	std::vector<uint8_t> EncodeBC5(const uint8_t* pixels, int width, int height, int channelX, int channelY)
+	{
+		int channels[2] = { channelX, channelY };
+		return EncodeChannels(pixels, width, height, channels, 2);
+	}
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/*
+	CPU encoder for the RGTC block formats, BC4 (one channel) and BC5 (two channels).
+
+	A BC4 block stores 4x4 texels of one channel in 8 bytes: two endpoints and a 3 bit
+	palette index per texel. With endpoint0 > endpoint1 the palette holds 8 evenly spaced
+	values, otherwise 6 plus exact 0 and 255. Both modes are tried and the one with the
+	lower squared error is kept, the second mode suits alpha masks where most blocks mix
+	fully transparent or opaque texels with a few in between. BC5 is two BC4 blocks, red
+	first. Block rows are encoded in parallel.
+*/
+namespace BlockCompression
+{
+	const int BLOCK_SIZE = 4;
+	const int BC4_BLOCK_BYTES = 8;
+	const int BC5_BLOCK_BYTES = 16;
+
+	void EncodeBC4Block(const uint8_t texels[16], uint8_t* output);
+	void DecodeBC4Block(const uint8_t* block, uint8_t texels[16]);
+
+	// Bytes of a width x height image, partial blocks at the edges are padded
+	size_t BC4Size(int width, int height);
+	size_t BC5Size(int width, int height);
+
+	// The source is RGBA8, channel selects the encoded component(s)
+	std::vector<uint8_t> EncodeBC4(const uint8_t* pixels, int width, int height, int channel);
+	std::vector<uint8_t> EncodeBC5(const uint8_t* pixels, int width, int height, int channelX, int channelY);
+}
@@ -0,0 +1,121 @@
+#include "marschner.h"
+#include "math.h"
+#include "threads.h"
+#include <algorithm>
+#include <cmath>
+
+static const int NUM_LOBES = 3;
+static const int OFFSET_SAMPLES = 512; // across the fiber cross section, for N_p
+
+static float Gaussian(float width, float x)
+{
+	return std::exp(-x * x / (2.0f * width * width)) / (width * std::sqrt(2.0f * PI_f));
+}
+
+float Marschner::Fresnel(float refraction, float cosIncident)
+{
+	cosIncident = std::clamp(cosIncident, 0.0f, 1.0f);
+	float sinTransmitted = std::sqrt(1.0f - cosIncident * cosIncident) / refraction;
+	if (sinTransmitted >= 1.0f)
+	{
+		return 1.0f;
+	}
+
+	float cosTransmitted = std::sqrt(1.0f - sinTransmitted * sinTransmitted);
+	float perpendicular = (cosIncident - refraction * cosTransmitted) / (cosIncident + refraction * cosTransmitted);
+	float parallel = (refraction * cosIncident - cosTransmitted) / (refraction * cosIncident + cosTransmitted);
+	return 0.5f * (perpendicular * perpendicular + parallel * parallel);
+}
+
+std::vector<float> Marschner::BakeLongitudinal(const Parameters& parameters, int size)
+{
+	const float shifts[NUM_LOBES] = { parameters.shift, -parameters.shift / 2.0f, -3.0f * parameters.shift / 2.0f };
+	const float widths[NUM_LOBES] = { parameters.width, parameters.width / 2.0f, parameters.width * 2.0f };
+
+	std::vector<float> texels(size_t(size) * size * 4);
+	Threads::ParallelFor(size_t(size), [&](size_t begin, size_t end) {
+		for (size_t y = begin; y < end; ++y)
+		{
+			float thetaR = std::asin((float(y) + 0.5f) / float(size) * 2.0f - 1.0f);
+			for (int x = 0; x < size; ++x)
+			{
+				float thetaI = std::asin((float(x) + 0.5f) / float(size) * 2.0f - 1.0f);
+				float thetaH = (thetaI + thetaR) * 0.5f;
+				float thetaD = (thetaR - thetaI) * 0.5f;
+
+				float* texel = &texels[(y * size + x) * 4];
+				for (int lobe = 0; lobe < NUM_LOBES; ++lobe)
+				{
+					texel[lobe] = Gaussian(widths[lobe], thetaH - shifts[lobe]);
+				}
+				texel[3] = std::cos(thetaD);
+			}
+		}
+	}, 1);
+	return texels;
+}
+
+std::vector<float> Marschner::BakeAzimuthal(const Parameters& parameters, int size)
+{
+	std::vector<float> texels(size_t(size) * size * 4);
+	Threads::ParallelFor(size_t(size), [&](size_t begin, size_t end) {
+		// Exit azimuth and attenuation of every offset, per lobe
+		std::vector<float> exitAzimuths(NUM_LOBES * OFFSET_SAMPLES);
+		std::vector<float> attenuations(NUM_LOBES * OFFSET_SAMPLES);
+
+		for (size_t y = begin; y < end; ++y)
+		{
+			float cosThetaD = (float(y) + 0.5f) / float(size);
+			float sinThetaD = std::sqrt(1.0f - cosThetaD * cosThetaD);
+
+			// Bravais index for the projection onto the cross section, and the absorption
+			// along the refracted ray that is tilted by theta_t
+			float refraction = std::sqrt(parameters.refraction * parameters.refraction - sinThetaD * sinThetaD) / cosThetaD;
+			float sinThetaT = sinThetaD / parameters.refraction;
+			float absorption = parameters.absorption / std::sqrt(1.0f - sinThetaT * sinThetaT);
+
+			for (int i = 0; i < OFFSET_SAMPLES; ++i)
+			{
+				float h = (float(i) + 0.5f) / float(OFFSET_SAMPLES) * 2.0f - 1.0f;
+				float gammaI = std::asin(h);
+				float gammaT = std::asin(h / refraction);
+				float fresnel = Fresnel(refraction, std::cos(gammaI));
+				float transmittance = std::exp(-2.0f * absorption * (1.0f + std::cos(2.0f * gammaT)));
+
+				float attenuation = 1.0f;
+				for (int lobe = 0; lobe < NUM_LOBES; ++lobe)
+				{
+					// R: F, TT: (1 - F)^2 T, TRT: (1 - F)^2 F T^2
+					if (lobe == 0) attenuation = fresnel;
+					else if (lobe == 1) attenuation = (1.0f - fresnel) * (1.0f - fresnel) * transmittance;
+					else attenuation *= fresnel * transmittance;
+
+					float phi = 2.0f * float(lobe) * gammaT - 2.0f * gammaI + float(lobe) * PI_f;
+					phi = std::remainder(phi, 2.0f * PI_f);
+					exitAzimuths[lobe * OFFSET_SAMPLES + i] = phi;
+					attenuations[lobe * OFFSET_SAMPLES + i] = attenuation;
+				}
+			}
+
+			for (int x = 0; x < size; ++x)
+			{
+				float phi = std::acos((float(x) + 0.5f) / float(size) * 2.0f - 1.0f);
+				float* texel = &texels[(y * size + x) * 4];
+				for (int lobe = 0; lobe < NUM_LOBES; ++lobe)
+				{
+					// N_p(phi) = 1/2 * integral of A_p(h) D(phi - phi_p(h)) dh, with D wrapped around the circle
+					float sum = 0.0f;
+					for (int i = 0; i < OFFSET_SAMPLES; ++i)
+					{
+						float difference = std::abs(phi - exitAzimuths[lobe * OFFSET_SAMPLES + i]);
+						difference = std::min(difference, 2.0f * PI_f - difference);
+						sum += attenuations[lobe * OFFSET_SAMPLES + i] * Gaussian(parameters.azimuthalSmoothing, difference);
+					}
+					texel[lobe] = sum / float(OFFSET_SAMPLES); // dh / 2 = 1 / OFFSET_SAMPLES
+				}
+				texel[3] = 0.0f;
+			}
+		}
+	}, 1);
+	return texels;
+}
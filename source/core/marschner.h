@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+
+/*
+	Lookup tables for the Marschner hair shading model (Marschner et al. 2003), laid out
+	like the textures of Nguyen and Donnelly (GPU Gems 2, chapter 23).
+
+	The scattering of a fiber splits into three lobes: R reflects off the surface, TT is
+	transmitted through the fiber and TRT is reflected once on the inside. Each lobe is a
+	longitudinal Gaussian M_p over the half angle theta_h, shifted by the tilt of the
+	cuticle scales, times an azimuthal term N_p over the angle phi around the fiber.
+
+	N_p integrates the Fresnel and absorption attenuation of every path through the fiber
+	cross section (offsets h in [-1, 1]) into the azimuth it leaves at. The integral is taken
+	with a narrow wrapped Gaussian around each exit azimuth, which keeps the caustics of
+	TRT finite without the cubic root solve. Absorption is a single coefficient, the shader
+	tints TT and TRT with the hair color, so both tables stay 2D.
+
+	Rows are baked in parallel. All angles are in radians.
+*/
+namespace Marschner
+{
+	struct Parameters
+	{
+		float refraction = 1.55f;          // index of refraction of the fiber
+		float absorption = 0.2f;           // per fiber radius
+		float shift = -0.1309f;            // alpha_R, -7.5 degrees, TT shifts by -shift/2 and TRT by -3*shift/2
+		float width = 0.1309f;             // beta_R, 7.5 degrees, TT is half as wide and TRT twice
+		float azimuthalSmoothing = 0.09f;  // width of the Gaussian around each exit azimuth, about 5 degrees
+	};
+
+	// RGBA float texels of a size x size table, x = sin(theta_i), y = sin(theta_r), both from -1 to 1.
+	// Holds M_R, M_TT, M_TRT and cos(theta_d).
+	std::vector<float> BakeLongitudinal(const Parameters& parameters, int size);
+
+	// RGBA float texels of a size x size table, x = cos(phi) from -1 to 1, y = cos(theta_d) from 0 to 1.
+	// Holds N_R, N_TT, N_TRT and 0.
+	std::vector<float> BakeAzimuthal(const Parameters& parameters, int size);
+
+	// Unpolarized reflectance of a dielectric for light arriving from the outside
+	float Fresnel(float refraction, float cosIncident);
+}
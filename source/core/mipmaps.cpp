@@ -0,0 +1,189 @@
+#include "mipmaps.h"
+#include "threads.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MIPMAPS_SSE2 1
+#endif
+
+// Histogram of one channel, filled in parallel
+static std::array<int, 256> ChannelHistogram(const uint8_t* pixels, int numPixels, int channel)
+{
+	std::array<std::atomic<int>, 256> shared{};
+	Threads::ParallelFor(size_t(numPixels), [&](size_t begin, size_t end) {
+		int local[256] = {};
+		for (size_t i = begin; i < end; ++i)
+		{
+			local[pixels[i * 4 + channel]]++;
+		}
+		for (int bin = 0; bin < 256; ++bin)
+		{
+			if (local[bin]) shared[bin] += local[bin];
+		}
+	}, 64 * 1024);
+
+	std::array<int, 256> histogram;
+	for (int bin = 0; bin < 256; ++bin)
+	{
+		histogram[bin] = shared[bin];
+	}
+	return histogram;
+}
+
+// Smallest channel value that passes value / 255 >= cutoff
+static int FirstCoveredValue(float cutoff)
+{
+	return std::clamp(int(std::ceil(cutoff * 255.0f)), 0, 256);
+}
+
+static int CoveredCount(const std::array<int, 256>& histogram, float cutoff)
+{
+	int count = 0;
+	for (int bin = FirstCoveredValue(cutoff); bin < 256; ++bin)
+	{
+		count += histogram[bin];
+	}
+	return count;
+}
+
+// Scales the channel so that about targetCount pixels end up at or above the cutoff
+static void ScaleToCoverage(Mipmaps::Level& level, int channel, float cutoff, int targetCount)
+{
+	int numPixels = level.width * level.height;
+	std::array<int, 256> histogram = ChannelHistogram(level.pixels.data(), numPixels, channel);
+
+	// Smallest value that has to pass, walking down from the largest values
+	int threshold = 256;
+	int count = 0;
+	while (threshold > 1 && count < targetCount)
+	{
+		threshold--;
+		count += histogram[threshold];
+	}
+	int firstCovered = FirstCoveredValue(cutoff);
+	if (threshold >= 256 || count == 0 || firstCovered == 0 || firstCovered > 255)
+	{
+		return;
+	}
+
+	// The threshold maps exactly onto the first covered value, rounding down keeps everything below it out
+	float scale = float(firstCovered) / float(threshold);
+	uint8_t lookup[256];
+	for (int value = 0; value < 256; ++value)
+	{
+		lookup[value] = uint8_t(std::min(255, int(value * scale + 0.001f)));
+	}
+
+	uint8_t* pixels = level.pixels.data();
+	Threads::ParallelFor(size_t(numPixels), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			pixels[i * 4 + channel] = lookup[pixels[i * 4 + channel]];
+		}
+	}, 64 * 1024);
+}
+
+namespace Mipmaps
+{
+	std::vector<Level> Generate(const uint8_t* pixels, int width, int height, int coverageChannel, float coverageCutoff)
+	{
+		std::vector<Level> levels;
+		if (width <= 0 || height <= 0)
+		{
+			return levels;
+		}
+
+		float coverage = 0.0f;
+		if (coverageChannel >= 0)
+		{
+			coverage = Coverage(pixels, width * height, coverageChannel, coverageCutoff);
+		}
+
+		// Every level is filtered from the unscaled level above, the scale is not compounded
+		std::vector<uint8_t> source(pixels, pixels + size_t(width) * height * 4);
+		int sourceWidth = width;
+		int sourceHeight = height;
+		while (sourceWidth > 1 || sourceHeight > 1)
+		{
+			Level level;
+			level.width = std::max(sourceWidth / 2, 1);
+			level.height = std::max(sourceHeight / 2, 1);
+			level.pixels.resize(size_t(level.width) * level.height * 4);
+			Downsample(source.data(), sourceWidth, sourceHeight, level.pixels.data());
+
+			source = level.pixels;
+			sourceWidth = level.width;
+			sourceHeight = level.height;
+
+			if (coverageChannel >= 0 && coverage > 0.0f)
+			{
+				int targetCount = int(std::round(coverage * level.width * level.height));
+				ScaleToCoverage(level, coverageChannel, coverageCutoff, targetCount);
+			}
+			levels.push_back(std::move(level));
+		}
+		return levels;
+	}
+
+	void Downsample(const uint8_t* source, int sourceWidth, int sourceHeight, uint8_t* destination)
+	{
+		int width = std::max(sourceWidth / 2, 1);
+		int height = std::max(sourceHeight / 2, 1);
+		size_t sourceStride = size_t(sourceWidth) * 4;
+
+		Threads::ParallelFor(size_t(height), [&](size_t beginRow, size_t endRow) {
+			for (size_t y = beginRow; y < endRow; ++y)
+			{
+				const uint8_t* row0 = source + std::min<size_t>(y * 2, sourceHeight - 1) * sourceStride;
+				const uint8_t* row1 = source + std::min<size_t>(y * 2 + 1, sourceHeight - 1) * sourceStride;
+				uint8_t* output = destination + y * width * 4;
+
+				int x = 0;
+#ifdef MIPMAPS_SSE2
+				// Two output pixels from 4 source pixels of each row, summed in 16 bit lanes
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i rounding = _mm_set1_epi16(2);
+				for (; x + 1 < width && x * 2 + 3 < sourceWidth; x += 2)
+				{
+					__m128i top = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+					__m128i bottom = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+					__m128i low = _mm_add_epi16(_mm_unpacklo_epi8(top, zero), _mm_unpacklo_epi8(bottom, zero));   // pixels 0, 1
+					__m128i high = _mm_add_epi16(_mm_unpackhi_epi8(top, zero), _mm_unpackhi_epi8(bottom, zero)); // pixels 2, 3
+
+					// Add the two pixels of each half, the result is in the low 64 bits
+					low = _mm_add_epi16(low, _mm_srli_si128(low, 8));
+					high = _mm_add_epi16(high, _mm_srli_si128(high, 8));
+					__m128i sum = _mm_unpacklo_epi64(low, high);
+					sum = _mm_srli_epi16(_mm_add_epi16(sum, rounding), 2);
+
+					_mm_storel_epi64((__m128i*)(output + x * 4), _mm_packus_epi16(sum, zero));
+				}
+#endif
+				for (; x < width; ++x)
+				{
+					int x0 = std::min(x * 2, sourceWidth - 1) * 4;
+					int x1 = std::min(x * 2 + 1, sourceWidth - 1) * 4;
+					for (int c = 0; c < 4; ++c)
+					{
+						int sum = row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c];
+						output[x * 4 + c] = uint8_t((sum + 2) >> 2);
+					}
+				}
+			}
+		}, 64);
+	}
+
+	float Coverage(const uint8_t* pixels, int numPixels, int channel, float cutoff)
+	{
+		if (numPixels <= 0)
+		{
+			return 0.0f;
+		}
+		std::array<int, 256> histogram = ChannelHistogram(pixels, numPixels, channel);
+		return CoveredCount(histogram, cutoff) / float(numPixels);
+	}
+}
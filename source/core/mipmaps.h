@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+/*
+	CPU mip chain generation for RGBA8 images.
+
+	Each level is a 2x2 box filter of the one above it, with SSE2 for pairs of output pixels
+	and rows split across threads. For alpha tested textures, averaging makes thin features
+	like hair strands fade below the cutoff and disappear at distance. With a coverage
+	channel the alpha of every level is rescaled so that the fraction of texels at or above
+	the cutoff matches level 0 (alpha to coverage preserving mipmaps, Castano 2010). The
+	scale comes from a 256 bin histogram, so it is exact up to 8 bit rounding.
+*/
+namespace Mipmaps
+{
+	struct Level
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<uint8_t> pixels; // RGBA8, rows without padding
+	};
+
+	// Returns the levels below the source image, down to 1x1. coverageChannel < 0 disables the rescale.
+	std::vector<Level> Generate(const uint8_t* pixels, int width, int height, int coverageChannel = -1, float coverageCutoff = 0.5f);
+
+	// 2x2 box filter, odd edges repeat the last row or column
+	void Downsample(const uint8_t* source, int sourceWidth, int sourceHeight, uint8_t* destination);
+
+	// Fraction of pixels with channel / 255 >= cutoff
+	float Coverage(const uint8_t* pixels, int numPixels, int channel, float cutoff);
+}
@@ -0,0 +1,299 @@
+#include "offsetallocator.h"
+#include <cassert>
+
+static const uint32_t MANTISSA_BITS = 3;
+static const uint32_t MANTISSA_VALUE = 1 << MANTISSA_BITS;
+static const uint32_t MANTISSA_MASK = MANTISSA_VALUE - 1;
+
+static uint32_t HighestSetBit(uint32_t value)
+{
+	uint32_t bit = 0;
+	while (value >>= 1) bit++;
+	return bit;
+}
+
+// Index of the lowest set bit at or above startBit, NO_SPACE when there is none
+static uint32_t LowestSetBitAfter(uint32_t mask, uint32_t startBit)
+{
+	if (startBit >= 32) return OffsetAllocator::NO_SPACE;
+
+	mask &= ~((1u << startBit) - 1);
+	if (mask == 0) return OffsetAllocator::NO_SPACE;
+
+	uint32_t bit = 0;
+	while ((mask & 1) == 0)
+	{
+		mask >>= 1;
+		bit++;
+	}
+	return bit;
+}
+
+/*
+	Sizes below MANTISSA_VALUE are stored exactly (denormals), larger sizes keep their
+	top MANTISSA_BITS below the highest set bit. Rounding up is used for requests, so any
+	range in the found bin fits; rounding down for free ranges, so a bin never holds a
+	range smaller than the bin size.
+*/
+static uint32_t SizeToBinRoundUp(uint32_t size)
+{
+	if (size < MANTISSA_VALUE) return size;
+
+	uint32_t mantissaStartBit = HighestSetBit(size) - MANTISSA_BITS;
+	uint32_t exponent = mantissaStartBit + 1;
+	uint32_t mantissa = (size >> mantissaStartBit) & MANTISSA_MASK;
+
+	uint32_t lowBitsMask = (1u << mantissaStartBit) - 1;
+	if ((size & lowBitsMask) != 0) mantissa++;
+
+	return (exponent << MANTISSA_BITS) + mantissa; // + lets a mantissa overflow carry into the exponent
+}
+
+static uint32_t SizeToBinRoundDown(uint32_t size)
+{
+	if (size < MANTISSA_VALUE) return size;
+
+	uint32_t mantissaStartBit = HighestSetBit(size) - MANTISSA_BITS;
+	uint32_t exponent = mantissaStartBit + 1;
+	uint32_t mantissa = (size >> mantissaStartBit) & MANTISSA_MASK;
+
+	return (exponent << MANTISSA_BITS) | mantissa;
+}
+
+static uint32_t BinToSize(uint32_t bin)
+{
+	uint32_t exponent = bin >> MANTISSA_BITS;
+	uint32_t mantissa = bin & MANTISSA_MASK;
+	if (exponent == 0) return mantissa;
+	return (mantissa | MANTISSA_VALUE) << (exponent - 1);
+}
+
+OffsetAllocator::OffsetAllocator(uint32_t size)
+	: size{ size }
+{
+	for (uint32_t& index : binIndices)
+	{
+		index = NO_SPACE;
+	}
+	InsertNodeIntoBin(size, 0);
+}
+
+OffsetAllocator::Allocation OffsetAllocator::Allocate(uint32_t requestSize)
+{
+	if (requestSize == 0 || requestSize > freeStorage)
+	{
+		return Allocation{};
+	}
+
+	// Smallest bin where every range is large enough
+	uint32_t minBinIndex = SizeToBinRoundUp(requestSize);
+	uint32_t minTopBinIndex = minBinIndex >> TOP_BINS_INDEX_SHIFT;
+	uint32_t minLeafBinIndex = minBinIndex & LEAF_BINS_INDEX_MASK;
+
+	uint32_t topBinIndex = minTopBinIndex;
+	uint32_t leafBinIndex = NO_SPACE;
+	if (usedBinsTop & (1u << topBinIndex))
+	{
+		leafBinIndex = LowestSetBitAfter(usedBins[topBinIndex], minLeafBinIndex);
+	}
+
+	// Otherwise any range in a larger top bin fits
+	if (leafBinIndex == NO_SPACE)
+	{
+		topBinIndex = LowestSetBitAfter(usedBinsTop, minTopBinIndex + 1);
+		if (topBinIndex == NO_SPACE)
+		{
+			return Allocation{};
+		}
+		leafBinIndex = LowestSetBitAfter(usedBins[topBinIndex], 0);
+	}
+
+	uint32_t binIndex = (topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex;
+
+	// Take the first range of the bin
+	uint32_t nodeIndex = binIndices[binIndex];
+	uint32_t nodeTotalSize = nodes[nodeIndex].size;
+	nodes[nodeIndex].size = requestSize;
+	nodes[nodeIndex].used = true;
+	binIndices[binIndex] = nodes[nodeIndex].binListNext;
+	if (nodes[nodeIndex].binListNext != NO_SPACE)
+	{
+		nodes[nodes[nodeIndex].binListNext].binListPrev = NO_SPACE;
+	}
+	freeStorage -= nodeTotalSize;
+
+	if (binIndices[binIndex] == NO_SPACE)
+	{
+		usedBins[topBinIndex] &= ~(1u << leafBinIndex);
+		if (usedBins[topBinIndex] == 0)
+		{
+			usedBinsTop &= ~(1u << topBinIndex);
+		}
+	}
+
+	// The remainder becomes a new free range right after the allocation
+	uint32_t remainder = nodeTotalSize - requestSize;
+	if (remainder > 0)
+	{
+		uint32_t newNodeIndex = InsertNodeIntoBin(remainder, nodes[nodeIndex].offset + requestSize);
+
+		uint32_t neighborNext = nodes[nodeIndex].neighborNext;
+		if (neighborNext != NO_SPACE)
+		{
+			nodes[neighborNext].neighborPrev = newNodeIndex;
+		}
+		nodes[newNodeIndex].neighborPrev = nodeIndex;
+		nodes[newNodeIndex].neighborNext = neighborNext;
+		nodes[nodeIndex].neighborNext = newNodeIndex;
+	}
+
+	return Allocation{ nodes[nodeIndex].offset, nodeIndex };
+}
+
+void OffsetAllocator::Free(Allocation allocation)
+{
+	if (!allocation.IsValid())
+	{
+		return;
+	}
+
+	uint32_t nodeIndex = allocation.node;
+	assert(nodes[nodeIndex].used && "OffsetAllocator: double free");
+
+	uint32_t offset = nodes[nodeIndex].offset;
+	uint32_t freeSize = nodes[nodeIndex].size;
+
+	uint32_t neighborPrev = nodes[nodeIndex].neighborPrev;
+	if (neighborPrev != NO_SPACE && !nodes[neighborPrev].used)
+	{
+		offset = nodes[neighborPrev].offset;
+		freeSize += nodes[neighborPrev].size;
+		RemoveNodeFromBin(neighborPrev);
+		neighborPrev = nodes[neighborPrev].neighborPrev;
+	}
+
+	uint32_t neighborNext = nodes[nodeIndex].neighborNext;
+	if (neighborNext != NO_SPACE && !nodes[neighborNext].used)
+	{
+		freeSize += nodes[neighborNext].size;
+		RemoveNodeFromBin(neighborNext);
+		neighborNext = nodes[neighborNext].neighborNext;
+	}
+
+	nodes[nodeIndex].used = false;
+	freeNodes.push_back(nodeIndex);
+
+	uint32_t combinedIndex = InsertNodeIntoBin(freeSize, offset);
+	if (neighborPrev != NO_SPACE)
+	{
+		nodes[combinedIndex].neighborPrev = neighborPrev;
+		nodes[neighborPrev].neighborNext = combinedIndex;
+	}
+	if (neighborNext != NO_SPACE)
+	{
+		nodes[combinedIndex].neighborNext = neighborNext;
+		nodes[neighborNext].neighborPrev = combinedIndex;
+	}
+}
+
+uint32_t OffsetAllocator::AllocationSize(Allocation allocation) const
+{
+	return allocation.IsValid() ? nodes[allocation.node].size : 0;
+}
+
+OffsetAllocator::StorageReport OffsetAllocator::Report() const
+{
+	StorageReport report;
+	report.totalFree = freeStorage;
+
+	// Ranges in the highest used bin are at least the bin size
+	if (usedBinsTop != 0)
+	{
+		uint32_t topBinIndex = HighestSetBit(usedBinsTop);
+		uint32_t leafBinIndex = HighestSetBit(usedBins[topBinIndex]);
+		report.largestFree = BinToSize((topBinIndex << TOP_BINS_INDEX_SHIFT) | leafBinIndex);
+	}
+	return report;
+}
+
+uint32_t OffsetAllocator::NewNode()
+{
+	if (!freeNodes.empty())
+	{
+		uint32_t nodeIndex = freeNodes.back();
+		freeNodes.pop_back();
+		return nodeIndex;
+	}
+
+	nodes.emplace_back();
+	return uint32_t(nodes.size() - 1);
+}
+
+uint32_t OffsetAllocator::InsertNodeIntoBin(uint32_t nodeSize, uint32_t offset)
+{
+	uint32_t binIndex = SizeToBinRoundDown(nodeSize);
+	uint32_t topBinIndex = binIndex >> TOP_BINS_INDEX_SHIFT;
+	uint32_t leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+
+	if (binIndices[binIndex] == NO_SPACE)
+	{
+		usedBins[topBinIndex] |= 1u << leafBinIndex;
+		usedBinsTop |= 1u << topBinIndex;
+	}
+
+	// New ranges go to the front of the bin list
+	uint32_t topNodeIndex = binIndices[binIndex];
+	uint32_t nodeIndex = NewNode();
+	Node& node = nodes[nodeIndex];
+	node = Node{};
+	node.offset = offset;
+	node.size = nodeSize;
+	node.binListNext = topNodeIndex;
+	if (topNodeIndex != NO_SPACE)
+	{
+		nodes[topNodeIndex].binListPrev = nodeIndex;
+	}
+	binIndices[binIndex] = nodeIndex;
+
+	freeStorage += nodeSize;
+	return nodeIndex;
+}
+
+void OffsetAllocator::RemoveNodeFromBin(uint32_t nodeIndex)
+{
+	Node& node = nodes[nodeIndex];
+
+	if (node.binListPrev != NO_SPACE)
+	{
+		nodes[node.binListPrev].binListNext = node.binListNext;
+		if (node.binListNext != NO_SPACE)
+		{
+			nodes[node.binListNext].binListPrev = node.binListPrev;
+		}
+	}
+	else
+	{
+		// First node of its bin
+		uint32_t binIndex = SizeToBinRoundDown(node.size);
+		uint32_t topBinIndex = binIndex >> TOP_BINS_INDEX_SHIFT;
+		uint32_t leafBinIndex = binIndex & LEAF_BINS_INDEX_MASK;
+
+		binIndices[binIndex] = node.binListNext;
+		if (node.binListNext != NO_SPACE)
+		{
+			nodes[node.binListNext].binListPrev = NO_SPACE;
+		}
+
+		if (binIndices[binIndex] == NO_SPACE)
+		{
+			usedBins[topBinIndex] &= ~(1u << leafBinIndex);
+			if (usedBins[topBinIndex] == 0)
+			{
+				usedBinsTop &= ~(1u << topBinIndex);
+			}
+		}
+	}
+
+	freeNodes.push_back(nodeIndex);
+	freeStorage -= node.size;
+}
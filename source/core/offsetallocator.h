@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+/*
+	Two level segregated fit (TLSF) allocator for offsets into a range that lives elsewhere,
+	like a GPU buffer. It never touches the memory itself.
+
+	Free ranges are kept in 256 bins, indexed by their size as a small float with a 5 bit
+	exponent and 3 bit mantissa, so bins are at most 12.5% apart. A bitmask per top level
+	bin (and one over the top level) finds the first bin large enough for a request in
+	constant time. Freed ranges are merged with free neighbours immediately.
+*/
+class OffsetAllocator
+{
+public:
+	static const uint32_t NO_SPACE = 0xFFFFFFFF;
+
+	struct Allocation
+	{
+		uint32_t offset = NO_SPACE;
+		uint32_t node = NO_SPACE;
+
+		bool IsValid() const { return offset != NO_SPACE; }
+	};
+
+	struct StorageReport
+	{
+		uint32_t totalFree = 0;
+		uint32_t largestFree = 0;
+	};
+
+	OffsetAllocator(uint32_t size);
+
+	// Returns an invalid allocation when no free range is large enough
+	Allocation Allocate(uint32_t size);
+	void Free(Allocation allocation);
+
+	uint32_t AllocationSize(Allocation allocation) const;
+	StorageReport Report() const;
+	bool IsEmpty() const { return freeStorage == size; }
+	uint32_t Size() const { return size; }
+
+private:
+	static const uint32_t NUM_TOP_BINS = 32;
+	static const uint32_t BINS_PER_LEAF = 8;
+	static const uint32_t TOP_BINS_INDEX_SHIFT = 3;
+	static const uint32_t LEAF_BINS_INDEX_MASK = 0x7;
+	static const uint32_t NUM_LEAF_BINS = NUM_TOP_BINS * BINS_PER_LEAF;
+
+	struct Node
+	{
+		uint32_t offset = 0;
+		uint32_t size = 0;
+		uint32_t binListPrev = NO_SPACE;
+		uint32_t binListNext = NO_SPACE;
+		uint32_t neighborPrev = NO_SPACE;
+		uint32_t neighborNext = NO_SPACE;
+		bool used = false;
+	};
+
+	uint32_t size = 0;
+	uint32_t freeStorage = 0;
+
+	uint32_t usedBinsTop = 0;
+	uint8_t usedBins[NUM_TOP_BINS] = {};
+	uint32_t binIndices[NUM_LEAF_BINS];
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> freeNodes;
+
+	uint32_t NewNode();
+	uint32_t InsertNodeIntoBin(uint32_t size, uint32_t offset);
+	void RemoveNodeFromBin(uint32_t nodeIndex);
+};
@@ -0,0 +1,105 @@
+#include "radixsort.h"
+#include "threads.h"
+#include <algorithm>
+#include <cstring>
+
+// 11 bit digits need three passes instead of four, and 2048 counters per block still fit in L1
+static const int RADIX_BITS = 11;
+static const int RADIX_SIZE = 1 << RADIX_BITS;
+static const int NUM_PASSES = (32 + RADIX_BITS - 1) / RADIX_BITS;
+static const size_t MIN_BLOCK_SIZE = 16 * 1024; // below this a thread costs more than it sorts
+
+namespace RadixSort
+{
+	void SortPairs(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, Scratch& scratch)
+	{
+		size_t count = keys.size();
+		std::vector<uint32_t>& scratchKeys = scratch.keys;
+		std::vector<uint32_t>& scratchValues = scratch.values;
+		scratchKeys.resize(count);
+		scratchValues.resize(count);
+
+		size_t numBlocks = std::clamp<size_t>(count / MIN_BLOCK_SIZE, 1, std::max(Threads::Count(), 1u));
+		size_t blockSize = (count + numBlocks - 1) / std::max<size_t>(numBlocks, 1);
+		std::vector<uint32_t>& offsets = scratch.offsets; // [block][digit], counts and then output offsets
+		offsets.resize(numBlocks * RADIX_SIZE);
+
+		uint32_t* sourceKeys = keys.data();
+		uint32_t* sourceValues = values.data();
+		uint32_t* destinationKeys = scratchKeys.data();
+		uint32_t* destinationValues = scratchValues.data();
+
+		for (int pass = 0; pass < NUM_PASSES; ++pass)
+		{
+			int shift = pass * RADIX_BITS;
+
+			// Blocks are processed by index so that both phases see the same split
+			Threads::ParallelFor(numBlocks, [&](size_t firstBlock, size_t lastBlock) {
+				for (size_t block = firstBlock; block < lastBlock; ++block)
+				{
+					uint32_t* counts = &offsets[block * RADIX_SIZE];
+					std::fill(counts, counts + RADIX_SIZE, 0);
+					size_t end = std::min(count, (block + 1) * blockSize);
+					for (size_t i = block * blockSize; i < end; ++i)
+					{
+						counts[(sourceKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+					}
+				}
+			}, 1);
+
+			// Digits in order, and within a digit the blocks in order, keeps the sort stable
+			size_t total = 0;
+			bool bSingleDigit = false;
+			for (int digit = 0; digit < RADIX_SIZE; ++digit)
+			{
+				size_t digitTotal = 0;
+				for (size_t block = 0; block < numBlocks; ++block)
+				{
+					uint32_t blockCount = offsets[block * RADIX_SIZE + digit];
+					offsets[block * RADIX_SIZE + digit] = uint32_t(total + digitTotal);
+					digitTotal += blockCount;
+				}
+				bSingleDigit |= digitTotal == count;
+				total += digitTotal;
+			}
+			if (bSingleDigit)
+			{
+				continue; // the pass would copy the keys in the same order
+			}
+
+			Threads::ParallelFor(numBlocks, [&](size_t firstBlock, size_t lastBlock) {
+				for (size_t block = firstBlock; block < lastBlock; ++block)
+				{
+					uint32_t* blockOffsets = &offsets[block * RADIX_SIZE];
+					size_t end = std::min(count, (block + 1) * blockSize);
+					for (size_t i = block * blockSize; i < end; ++i)
+					{
+						uint32_t target = blockOffsets[(sourceKeys[i] >> shift) & (RADIX_SIZE - 1)]++;
+						destinationKeys[target] = sourceKeys[i];
+						destinationValues[target] = sourceValues[i];
+					}
+				}
+			}, 1);
+
+			std::swap(sourceKeys, destinationKeys);
+			std::swap(sourceValues, destinationValues);
+		}
+
+		// An odd number of scatter passes leaves the result in the scratch arrays
+		if (sourceKeys != keys.data())
+		{
+			keys.swap(scratchKeys);
+			values.swap(scratchValues);
+		}
+	}
+
+	uint32_t FloatToKey(float value)
+	{
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+
+		// Negative floats have their order reversed, flip all their bits; positive ones only the sign
+		uint32_t mask = (bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u;
+		return bits ^ mask;
+	}
+}
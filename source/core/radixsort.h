@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+/*
+	Parallel LSD radix sort of 32 bit keys with a 32 bit payload, in three passes of 11, 11
+	and 10 bits.
+
+	The keys are split into one contiguous block per thread. Each pass counts the digits of
+	every block, a prefix sum over (digit, block) gives each block its own output range per
+	digit, and the blocks scatter in parallel. The sort is stable. Passes where all keys have
+	the same digit are skipped, so keys with few significant bits sort faster.
+*/
+namespace RadixSort
+{
+	// Ping-pong arrays and digit offsets, resized as needed. Keep one between calls to avoid allocations.
+	struct Scratch
+	{
+		std::vector<uint32_t> keys;
+		std::vector<uint32_t> values;
+		std::vector<uint32_t> offsets;
+	};
+
+	// Sorts keys ascending and reorders values with them
+	void SortPairs(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, Scratch& scratch);
+
+	// Maps a float to a key with the same order, including negative values
+	uint32_t FloatToKey(float value);
+}
@@ -1,5 +1,6 @@
 #include "threads.h"
 #include <vector>
+#include <algorithm>
 
 #ifndef USE_MULTITHREADING
 #define USE_MULTITHREADING false
@@ -24,6 +25,36 @@ namespace Threads
 		}
 	}
 
+	void ParallelFor(size_t count, std::function<void(size_t begin, size_t end)> body, size_t minRangeSize)
+	{
+		size_t numRanges = std::min<size_t>(std::max(numThreads, 1u), (count + minRangeSize - 1) / std::max<size_t>(minRangeSize, 1));
+		if (numRanges <= 1)
+		{
+			body(0, count);
+			return;
+		}
+
+		size_t rangeSize = (count + numRanges - 1) / numRanges;
+		std::vector<std::thread> workers;
+		workers.reserve(numRanges - 1);
+		for (size_t i = 1; i < numRanges; ++i)
+		{
+			size_t begin = i * rangeSize;
+			size_t end = std::min(count, begin + rangeSize);
+			if (begin < end)
+			{
+				workers.emplace_back(body, begin, end);
+			}
+		}
+
+		body(0, std::min(count, rangeSize));
+
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
 	bool AreDone()
 	{
 		if constexpr (USE_MULTITHREADING)
@@ -1,10 +1,15 @@
 #pragma once
 #include <thread>
+#include <functional>
 
 namespace Threads
 {
 	unsigned int Count();
 	void Join();
+
+	// Splits [0, count) into one contiguous range per hardware thread and blocks until all are done.
+	// Small counts run on the calling thread.
+	void ParallelFor(size_t count, std::function<void(size_t begin, size_t end)> body, size_t minRangeSize = 1024);
 }
 
 struct ThreadInfo
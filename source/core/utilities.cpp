@@ -37,3 +37,65 @@ bool LoadText(std::filesystem::path filePath, std::string& output)
 
 	return false;
 }
+
+
+bool LoadBinary(std::filesystem::path filePath, std::vector<char>& output)
+{
+	output.clear();
+	if (!std::filesystem::exists(filePath)) return false;
+
+	std::ifstream InputFileStream(filePath.c_str(), std::ios::binary);
+	if (InputFileStream && InputFileStream.is_open())
+	{
+		output.assign((std::istreambuf_iterator<char>(InputFileStream)), std::istreambuf_iterator<char>());
+		return true;
+	}
+
+	return false;
+}
+
+bool SaveBinary(std::filesystem::path filePath, const void* data, size_t size)
+{
+	std::error_code error;
+	std::filesystem::create_directories(filePath.parent_path(), error);
+
+	std::ofstream OutputFileStream(filePath.c_str(), std::ios::binary | std::ios::trunc);
+	if (OutputFileStream && OutputFileStream.is_open())
+	{
+		OutputFileStream.write((const char*)data, std::streamsize(size));
+		return bool(OutputFileStream);
+	}
+
+	return false;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	uint64_t hash = seed;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t HashString(const std::string& text, uint64_t seed)
+{
+	// Include the length so that {"ab", "c"} and {"a", "bc"} hash differently
+	uint64_t length = text.size();
+	return HashBytes(text.data(), text.size(), HashBytes(&length, sizeof(length), seed));
+}
+
+std::string HashToHex(uint64_t hash)
+{
+	const char* digits = "0123456789abcdef";
+	std::string hex(16, '0');
+	for (int i = 15; i >= 0; --i)
+	{
+		hex[i] = digits[hash & 0xF];
+		hash >>= 4;
+	}
+	return hex;
+}
\ No newline at end of file
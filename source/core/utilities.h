@@ -1,7 +1,17 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <filesystem>
 
 std::string TimeString(double time);
 std::string FpsString(double deltaTime);
-bool LoadText(std::filesystem::path filePath, std::string& output);
\ No newline at end of file
+bool LoadText(std::filesystem::path filePath, std::string& output);
+bool LoadBinary(std::filesystem::path filePath, std::vector<char>& output);
+bool SaveBinary(std::filesystem::path filePath, const void* data, size_t size);
+
+// 64-bit FNV-1a, pass the previous result as seed to hash several buffers
+const uint64_t HASH_SEED = 14695981039346656037ull;
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = HASH_SEED);
+uint64_t HashString(const std::string& text, uint64_t seed = HASH_SEED);
+std::string HashToHex(uint64_t hash);
\ No newline at end of file
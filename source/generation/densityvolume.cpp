@@ -0,0 +1,258 @@
+#include "densityvolume.h"
+#include "../opengl/mesh.h"
+#include "../core/threads.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <cmath>
+
+static const float FIXED_ONE = 65536.0f;
+static const int MAX_SAMPLES = 256; // per segment, for segments much longer than the grid
+
+bool DensityVolume::SegmentCurve::operator==(const SegmentCurve& other) const
+{
+	return a == other.a && b == other.b && c == other.c && d == other.d &&
+		startWidth == other.startWidth && endWidth == other.endWidth;
+}
+
+void DensityVolume::ReadCurves(const GLBezierStrips& strips, std::vector<SegmentCurve>& outCurves)
+{
+	const std::vector<glm::fvec4>& data = strips.SegmentData();
+	const int texels = GLBezierStrips::SEGMENT_TEXELS;
+	outCurves.resize(data.size() / texels);
+
+	Threads::ParallelFor(outCurves.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::fvec4* segment = &data[i * texels];
+			SegmentCurve& curve = outCurves[i];
+			curve.a = glm::fvec3{ segment[0] };
+			curve.b = glm::fvec3{ segment[1] };
+			curve.c = glm::fvec3{ segment[2] };
+			curve.d = glm::fvec3{ segment[3] };
+			curve.startWidth = glm::length(glm::fvec3{ segment[4] });
+			curve.endWidth = glm::length(glm::fvec3{ segment[5] });
+		}
+	});
+}
+
+AABB DensityVolume::CurveBounds(const SegmentCurve& curve)
+{
+	// Hull of the bezier control points, see ComputeSegmentBounds
+	AABB bounds;
+	bounds.Grow(curve.d);
+	bounds.Grow(curve.d + curve.c / 3.0f);
+	bounds.Grow(curve.d + (curve.b + 2.0f*curve.c) / 3.0f);
+	bounds.Grow(curve.a + curve.b + curve.c + curve.d);
+	glm::fvec3 radius{ std::max(curve.startWidth, curve.endWidth) };
+	bounds.min -= radius;
+	bounds.max += radius;
+	return bounds;
+}
+
+void DensityVolume::Build(const GLBezierStrips& strips)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	ReadCurves(strips, curves);
+	updatedSegments = int(curves.size());
+
+	bounds = AABB{};
+	std::mutex boundsMutex;
+	Threads::ParallelFor(curves.size(), [&](size_t begin, size_t end) {
+		AABB rangeBounds;
+		for (size_t i = begin; i < end; ++i)
+		{
+			rangeBounds.Grow(CurveBounds(curves[i]));
+		}
+		std::lock_guard<std::mutex> lock{ boundsMutex };
+		bounds.Grow(rangeBounds);
+	});
+
+	fixedDensity.reset();
+	density.clear();
+	resolution = glm::ivec3{ 0 };
+	ClearDirty();
+	if (curves.empty())
+	{
+		return;
+	}
+
+	// One empty voxel around the groom, the trilinear splats and lookups stay inside
+	glm::fvec3 extent = bounds.max - bounds.min;
+	voxelSize = std::max(std::max(extent.x, extent.y), std::max(extent.z, 1e-6f)) / float(MAX_RESOLUTION - 2);
+	resolution = glm::min(glm::ivec3(glm::ceil(extent / voxelSize)) + 2, glm::ivec3(MAX_RESOLUTION));
+	bounds.min -= glm::fvec3(voxelSize);
+	bounds.max = bounds.min + glm::fvec3(resolution) * voxelSize;
+
+	size_t numVoxels = size_t(resolution.x) * resolution.y * resolution.z;
+	fixedDensity.reset(new std::atomic<int32_t>[numVoxels]);
+	density.resize(numVoxels);
+	Threads::ParallelFor(numVoxels, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			fixedDensity[i].store(0, std::memory_order_relaxed);
+		}
+	}, 1 << 16);
+
+	Threads::ParallelFor(curves.size(), [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			Splat(curves[i], 1);
+		}
+	}, 256);
+
+	ResolveSlices(0, resolution.z);
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	buildMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void DensityVolume::Update(const GLBezierStrips& strips)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	std::vector<SegmentCurve> newCurves;
+	ReadCurves(strips, newCurves);
+	if (newCurves.size() != curves.size() || !fixedDensity)
+	{
+		Build(strips);
+		updateMilliseconds = buildMilliseconds;
+		return;
+	}
+
+	std::vector<uint8_t> bChanged(curves.size());
+	Threads::ParallelFor(curves.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			bChanged[i] = !(newCurves[i] == curves[i]);
+		}
+	});
+
+	std::vector<int> changed;
+	for (size_t i = 0; i < bChanged.size(); ++i)
+	{
+		if (bChanged[i]) changed.push_back(int(i));
+	}
+
+	// Removing and adding costs two splats per segment, a rebuild is cheaper past half of them
+	if (changed.size() * 2 > curves.size())
+	{
+		Build(strips);
+		updateMilliseconds = buildMilliseconds;
+		return;
+	}
+
+	// The grid is fitted to the old curves, a changed curve has to keep clear of its border voxels
+	AABB inner{ bounds.min + glm::fvec3(voxelSize), bounds.max - glm::fvec3(voxelSize) };
+	AABB changedBounds;
+	for (int i : changed)
+	{
+		AABB newBounds = CurveBounds(newCurves[i]);
+		if (glm::any(glm::lessThan(newBounds.min, inner.min)) || glm::any(glm::greaterThan(newBounds.max, inner.max)))
+		{
+			Build(strips);
+			updateMilliseconds = buildMilliseconds;
+			return;
+		}
+		changedBounds.Grow(newBounds);
+		changedBounds.Grow(CurveBounds(curves[i]));
+	}
+
+	Threads::ParallelFor(changed.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			int segment = changed[i];
+			Splat(curves[segment], -1);
+			Splat(newCurves[segment], 1);
+			curves[segment] = newCurves[segment];
+		}
+	}, 256);
+
+	if (!changed.empty())
+	{
+		// Splats reach half a voxel past the curve bounds
+		int firstSlice = int(std::floor((changedBounds.min.z - bounds.min.z) / voxelSize - 0.5f));
+		int endSlice = int(std::floor((changedBounds.max.z - bounds.min.z) / voxelSize - 0.5f)) + 2;
+		ResolveSlices(std::max(firstSlice, 0), std::min(endSlice, resolution.z));
+	}
+	updatedSegments = int(changed.size());
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	updateMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void DensityVolume::Splat(const SegmentCurve& curve, int sign)
+{
+	glm::fvec3 p1 = curve.d;
+	glm::fvec3 p2 = curve.d + curve.c / 3.0f;
+	glm::fvec3 p3 = curve.d + (curve.b + 2.0f*curve.c) / 3.0f;
+	glm::fvec3 p4 = curve.a + curve.b + curve.c + curve.d;
+	float length = glm::distance(p1, p2) + glm::distance(p2, p3) + glm::distance(p3, p4);
+
+	// About two samples per voxel, the card area of a sample is its width times its share of the length
+	int samples = std::min(std::max(int(std::ceil(2.0f * length / voxelSize)), 1), MAX_SAMPLES);
+	float sampleLength = length / float(samples);
+	float areaToCoverage = FIXED_ONE / (voxelSize * voxelSize);
+
+	size_t sliceStride = size_t(resolution.x) * resolution.y;
+	for (int i = 0; i < samples; ++i)
+	{
+		float t = (float(i) + 0.5f) / float(samples);
+		glm::fvec3 position = ((curve.a*t + curve.b)*t + curve.c)*t + curve.d;
+		float width = 2.0f * (curve.startWidth + (curve.endWidth - curve.startWidth) * t); // the width vector spans both sides
+		float coverage = width * sampleLength * areaToCoverage;
+
+		// Voxel centers are at integer + 0.5
+		glm::fvec3 grid = (position - bounds.min) / voxelSize - 0.5f;
+		glm::fvec3 base = glm::floor(grid);
+		glm::fvec3 fraction = grid - base;
+		glm::ivec3 voxel{ base };
+
+		for (int corner = 0; corner < 8; ++corner)
+		{
+			glm::ivec3 offset{ corner & 1, (corner >> 1) & 1, (corner >> 2) & 1 };
+			glm::ivec3 target = voxel + offset;
+			if (glm::any(glm::lessThan(target, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(target, resolution)))
+			{
+				continue;
+			}
+
+			glm::fvec3 weights = glm::mix(1.0f - fraction, fraction, glm::fvec3(offset));
+			int32_t value = int32_t(std::lround(coverage * weights.x * weights.y * weights.z));
+			size_t index = target.z * sliceStride + size_t(target.y) * resolution.x + target.x;
+			fixedDensity[index].fetch_add(sign * value, std::memory_order_relaxed);
+		}
+	}
+}
+
+void DensityVolume::ResolveSlices(int firstSlice, int endSlice)
+{
+	if (endSlice <= firstSlice)
+	{
+		return;
+	}
+
+	size_t sliceStride = size_t(resolution.x) * resolution.y;
+	Threads::ParallelFor(size_t(endSlice - firstSlice) * sliceStride, [&](size_t begin, size_t end) {
+		for (size_t i = begin + firstSlice * sliceStride; i < end + firstSlice * sliceStride; ++i)
+		{
+			density[i] = std::max(float(fixedDensity[i].load(std::memory_order_relaxed)), 0.0f) / FIXED_ONE;
+		}
+	}, 1 << 14);
+
+	if (IsDirty())
+	{
+		firstSlice = std::min(firstSlice, dirtyFirstSlice);
+		endSlice = std::max(endSlice, dirtyEndSlice);
+	}
+	dirtyFirstSlice = firstSlice;
+	dirtyEndSlice = endSlice;
+}
+
+glm::mat4 DensityVolume::LocalToVolume() const
+{
+	glm::fvec3 size = glm::fvec3(glm::max(resolution, glm::ivec3(1))) * voxelSize;
+	return glm::scale(glm::mat4{ 1.0f }, 1.0f / size) * glm::translate(glm::mat4{ 1.0f }, -bounds.min);
+}
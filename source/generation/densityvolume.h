@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include "segmentbvh.h"
+
+/*
+	Hair density on a regular grid around the groom, for self-shadowing.
+
+	Every segment is tessellated into samples about half a voxel apart and each sample
+	splats the card area it covers into the eight voxels around it (trilinear weights).
+	A voxel stores the card area inside it divided by the area of one voxel face, so the
+	optical depth along a ray is the sum of the voxels it crosses, in voxel steps.
+
+	Voxels are accumulated in 16.16 fixed point with atomic adds, which makes the result
+	independent of the thread order. Update uses that to subtract the old contribution of
+	the segments that changed and add the new one, the grid then matches a full Build
+	exactly. The slices touched since the last upload are kept as a dirty range.
+*/
+class DensityVolume
+{
+public:
+	static const int MAX_RESOLUTION = 64; // voxels along the longest axis, the voxels are cubes
+
+	double buildMilliseconds = 0.0;
+	double updateMilliseconds = 0.0;
+	int updatedSegments = 0; // by the last Update, all segments after a Build
+
+protected:
+	// What a segment splats, kept to subtract it again in Update
+	struct SegmentCurve
+	{
+		glm::fvec3 a, b, c, d; // power basis, see GLBezierStrips::BuildSegmentData
+		float startWidth = 0.0f;
+		float endWidth = 0.0f;
+
+		bool operator==(const SegmentCurve& other) const;
+	};
+
+	std::vector<SegmentCurve> curves;
+	std::unique_ptr<std::atomic<int32_t>[]> fixedDensity;
+	std::vector<float> density; // fixedDensity converted, in the layout of a 3D texture
+	AABB bounds;
+	glm::ivec3 resolution{ 0 };
+	float voxelSize = 1.0f;
+	int dirtyFirstSlice = 0; // z range of density that changed since ClearDirty
+	int dirtyEndSlice = 0;
+
+public:
+	DensityVolume() = default;
+	~DensityVolume() = default;
+
+	DensityVolume(const DensityVolume& other) = delete;
+
+	// Fits the grid around the segments and splats all of them
+	void Build(const class GLBezierStrips& strips);
+
+	// Re-splats only the segments whose curve or width changed. Falls back to Build when
+	// segments were added or removed, or a changed one leaves the grid.
+	void Update(const class GLBezierStrips& strips);
+
+	// Maps local (model) space of the strips to [0, 1] texture coordinates of the grid
+	glm::mat4 LocalToVolume() const;
+
+	const std::vector<float>& Density() const { return density; }
+	glm::ivec3 Resolution() const { return resolution; }
+	bool IsEmpty() const { return curves.empty(); }
+
+	bool IsDirty() const { return dirtyEndSlice > dirtyFirstSlice; }
+	int DirtyFirstSlice() const { return dirtyFirstSlice; }
+	int DirtySliceCount() const { return dirtyEndSlice - dirtyFirstSlice; }
+	void ClearDirty() { dirtyFirstSlice = dirtyEndSlice = 0; }
+
+protected:
+	static void ReadCurves(const class GLBezierStrips& strips, std::vector<SegmentCurve>& outCurves);
+	static AABB CurveBounds(const SegmentCurve& curve);
+
+	// Adds (sign 1) or removes (sign -1) the samples of a curve
+	void Splat(const SegmentCurve& curve, int sign);
+
+	// Converts fixedDensity to density for the slices [firstSlice, endSlice) and marks them dirty
+	void ResolveSlices(int firstSlice, int endSlice);
+};
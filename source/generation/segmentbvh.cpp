@@ -0,0 +1,469 @@
+#include "segmentbvh.h"
+#include "../opengl/mesh.h"
+#include "../core/threads.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <mutex>
+
+static const int NUM_BINS = 12;
+
+// Below this a node is binned and partitioned by a single thread
+static const int MIN_PARALLEL_COUNT = 4096;
+
+// Splits [first, first + count) into one contiguous chunk per thread and runs them in parallel
+static void ForChunks(int first, int count, int threads, const std::function<void(int chunk, int begin, int end)>& body)
+{
+	int chunkSize = (count + threads - 1) / threads;
+	Threads::ParallelFor(size_t(threads), [&](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; ++chunk)
+		{
+			int chunkBegin = first + int(chunk) * chunkSize;
+			int chunkEnd = std::min(first + count, chunkBegin + chunkSize);
+			if (chunkBegin < chunkEnd)
+			{
+				body(int(chunk), chunkBegin, chunkEnd);
+			}
+		}
+	}, 1);
+}
+
+bool AABB::Overlaps(const AABB& other) const
+{
+	return glm::all(glm::lessThanEqual(min, other.max)) && glm::all(glm::lessThanEqual(other.min, max));
+}
+
+bool AABB::IntersectRay(const glm::fvec3& origin, const glm::fvec3& inverseDirection, float maxDistance, float& tNear) const
+{
+	glm::fvec3 t1 = (min - origin) * inverseDirection;
+	glm::fvec3 t2 = (max - origin) * inverseDirection;
+	glm::fvec3 tMin = glm::min(t1, t2);
+	glm::fvec3 tMax = glm::max(t1, t2);
+
+	tNear = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+	float tFar = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxDistance));
+	return tNear <= tFar;
+}
+
+void ComputeSegmentBounds(const GLBezierStrips& strips, std::vector<AABB>& outBounds)
+{
+	const std::vector<glm::fvec4>& data = strips.SegmentData();
+	const int texels = GLBezierStrips::SEGMENT_TEXELS;
+	outBounds.resize(data.size() / texels);
+
+	Threads::ParallelFor(outBounds.size(), [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			// Back from power basis to bezier control points, see GLBezierStrips::BuildSegmentData
+			const glm::fvec4* segment = &data[i * texels];
+			glm::fvec3 a{ segment[0] }, b{ segment[1] }, c{ segment[2] }, d{ segment[3] };
+			glm::fvec3 p1 = d;
+			glm::fvec3 p2 = d + c / 3.0f;
+			glm::fvec3 p3 = d + (b + 2.0f*c) / 3.0f;
+			glm::fvec3 p4 = a + b + c + d;
+
+			float width = std::max(glm::length(glm::fvec3{ segment[4] }), glm::length(glm::fvec3{ segment[5] }));
+			float thickness = std::max(segment[0].w, segment[1].w) * 0.5f;
+			glm::fvec3 radius{ width + thickness };
+
+			AABB bounds;
+			bounds.Grow(p1);
+			bounds.Grow(p2);
+			bounds.Grow(p3);
+			bounds.Grow(p4);
+			bounds.min -= radius;
+			bounds.max += radius;
+			outBounds[i] = bounds;
+		}
+	});
+}
+
+void SegmentBVH::Build(const GLBezierStrips& strips)
+{
+	std::vector<AABB> bounds;
+	ComputeSegmentBounds(strips, bounds);
+	Build(bounds);
+}
+
+void SegmentBVH::Build(const std::vector<AABB>& bounds)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	segmentBounds = bounds;
+	int count = int(segmentBounds.size());
+
+	nodes.clear();
+	segmentIndices.resize(count);
+	if (count == 0)
+	{
+		return;
+	}
+
+	buildEntries.resize(count);
+	partitionScratch.resize(count);
+	Threads::ParallelFor(count, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			buildEntries[i].bounds = segmentBounds[i];
+			buildEntries[i].segment = int(i);
+		}
+	});
+
+	// A binary tree with at least one segment per leaf never needs more than 2n-1 nodes
+	nodes.resize(2 * size_t(count));
+	numNodes = 1;
+
+	// Twice as many subtrees as threads, the splits are rarely even
+	int threads = 2 * std::max(int(Threads::Count()), 1);
+	AABB centerBounds;
+	ComputeRangeBounds(0, count, threads, nodes[0].bounds, centerBounds);
+	Subdivide(0, 0, count, centerBounds, threads);
+
+	nodes.resize(numNodes);
+	Threads::ParallelFor(count, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			segmentIndices[i] = buildEntries[i].segment;
+		}
+	});
+	buildEntries.clear();
+	buildEntries.shrink_to_fit();
+	partitionScratch.clear();
+	partitionScratch.shrink_to_fit();
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	buildMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void SegmentBVH::ComputeRangeBounds(int first, int count, int threads, AABB& outBounds, AABB& outCenters) const
+{
+	auto GrowRange = [this](int begin, int end, AABB& rangeBounds, AABB& rangeCenters) -> void {
+		for (int i = begin; i < end; ++i)
+		{
+			rangeBounds.Grow(buildEntries[i].bounds);
+			rangeCenters.Grow(buildEntries[i].bounds.Center());
+		}
+	};
+
+	outBounds = AABB{};
+	outCenters = AABB{};
+	if (threads > 1 && count >= MIN_PARALLEL_COUNT)
+	{
+		std::mutex boundsMutex;
+		ForChunks(first, count, threads, [&](int chunk, int begin, int end) {
+			AABB chunkBounds, chunkCenters;
+			GrowRange(begin, end, chunkBounds, chunkCenters);
+			std::lock_guard<std::mutex> lock{ boundsMutex };
+			outBounds.Grow(chunkBounds);
+			outCenters.Grow(chunkCenters);
+		});
+	}
+	else
+	{
+		GrowRange(first, first + count, outBounds, outCenters);
+	}
+}
+
+void SegmentBVH::Subdivide(int nodeIndex, int first, int count, const AABB& centerBounds, int threads)
+{
+	if (count <= MAX_LEAF_SIZE)
+	{
+		nodes[nodeIndex].leftOrFirst = first;
+		nodes[nodeIndex].count = count;
+		return;
+	}
+
+	if (count < MIN_PARALLEL_COUNT)
+	{
+		threads = 1;
+	}
+
+	Split split;
+	if (!Partition(first, count, centerBounds, threads, split))
+	{
+		// All centers coincide, any split is as good as the other
+		split.leftCount = count / 2;
+		ComputeRangeBounds(first, split.leftCount, threads, split.leftBounds, split.leftCenters);
+		ComputeRangeBounds(first + split.leftCount, count - split.leftCount, threads, split.rightBounds, split.rightCenters);
+	}
+
+	int left = numNodes.fetch_add(2);
+	nodes[nodeIndex].leftOrFirst = left;
+	nodes[nodeIndex].count = 0;
+	nodes[left].bounds = split.leftBounds;
+	nodes[left + 1].bounds = split.rightBounds;
+
+	// The threads are shared out between the children, one of them runs on a new thread
+	int leftCount = split.leftCount;
+	if (threads > 1)
+	{
+		std::thread leftThread(&SegmentBVH::Subdivide, this, left, first, leftCount, std::cref(split.leftCenters), threads / 2);
+		Subdivide(left + 1, first + leftCount, count - leftCount, split.rightCenters, threads - threads / 2);
+		leftThread.join();
+	}
+	else
+	{
+		Subdivide(left, first, leftCount, split.leftCenters, 1);
+		Subdivide(left + 1, first + leftCount, count - leftCount, split.rightCenters, 1);
+	}
+}
+
+bool SegmentBVH::Partition(int first, int count, const AABB& centerBounds, int threads, Split& outSplit)
+{
+	// Binned surface area heuristic along the axis with the largest center extent.
+	// Small nodes have most of the calls, they get fewer bins than they have segments.
+	const int numBins = std::min(NUM_BINS, std::max(count / 2, 2));
+
+	glm::fvec3 extent = centerBounds.max - centerBounds.min;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	if (extent[axis] <= 0.0f)
+	{
+		return false;
+	}
+
+	float binScale = numBins / extent[axis];
+	auto BinOf = [&](const BuildEntry& entry) -> int {
+		int bin = int((entry.Center(axis) - centerBounds.min[axis]) * binScale);
+		return std::min(std::max(bin, 0), numBins - 1);
+	};
+
+	struct Bins
+	{
+		AABB bounds[NUM_BINS];
+		AABB centers[NUM_BINS];
+		int counts[NUM_BINS] = {};
+	};
+	auto BinRange = [&](int begin, int end, Bins& bins) -> void {
+		for (int i = begin; i < end; ++i)
+		{
+			const BuildEntry& entry = buildEntries[i];
+			int bin = BinOf(entry);
+			bins.bounds[bin].Grow(entry.bounds);
+			bins.centers[bin].Grow(entry.bounds.Center());
+			bins.counts[bin]++;
+		}
+	};
+
+	Bins bins;
+	if (threads > 1)
+	{
+		std::mutex binMutex;
+		ForChunks(first, count, threads, [&](int chunk, int begin, int end) {
+			Bins chunkBins;
+			BinRange(begin, end, chunkBins);
+			std::lock_guard<std::mutex> lock{ binMutex };
+			for (int bin = 0; bin < numBins; ++bin)
+			{
+				bins.bounds[bin].Grow(chunkBins.bounds[bin]);
+				bins.centers[bin].Grow(chunkBins.centers[bin]);
+				bins.counts[bin] += chunkBins.counts[bin];
+			}
+		});
+	}
+	else
+	{
+		BinRange(first, first + count, bins);
+	}
+
+	// Sweep from both sides to get the cost of every split plane
+	float leftArea[NUM_BINS - 1], rightArea[NUM_BINS - 1];
+	int leftCounts[NUM_BINS - 1], rightCounts[NUM_BINS - 1];
+	AABB leftBox, rightBox;
+	int leftSum = 0, rightSum = 0;
+	for (int i = 0; i < numBins - 1; ++i)
+	{
+		leftBox.Grow(bins.bounds[i]);
+		leftSum += bins.counts[i];
+		leftArea[i] = leftBox.SurfaceArea();
+		leftCounts[i] = leftSum;
+
+		rightBox.Grow(bins.bounds[numBins - 1 - i]);
+		rightSum += bins.counts[numBins - 1 - i];
+		rightArea[numBins - 2 - i] = rightBox.SurfaceArea();
+		rightCounts[numBins - 2 - i] = rightSum;
+	}
+
+	int bestSplit = -1;
+	float bestCost = std::numeric_limits<float>::max();
+	for (int i = 0; i < numBins - 1; ++i)
+	{
+		float cost = leftCounts[i]*leftArea[i] + rightCounts[i]*rightArea[i];
+		if (leftCounts[i] > 0 && rightCounts[i] > 0 && cost < bestCost)
+		{
+			bestCost = cost;
+			bestSplit = i;
+		}
+	}
+	if (bestSplit < 0)
+	{
+		return false; // every center is in one bin
+	}
+
+	outSplit = Split{};
+	for (int bin = 0; bin < numBins; ++bin)
+	{
+		AABB& sideBounds = (bin <= bestSplit) ? outSplit.leftBounds : outSplit.rightBounds;
+		AABB& sideCenters = (bin <= bestSplit) ? outSplit.leftCenters : outSplit.rightCenters;
+		sideBounds.Grow(bins.bounds[bin]);
+		sideCenters.Grow(bins.centers[bin]);
+	}
+	outSplit.leftCount = leftCounts[bestSplit];
+
+	if (threads <= 1)
+	{
+		std::partition(buildEntries.begin() + first, buildEntries.begin() + first + count, [&](const BuildEntry& entry) {
+			return BinOf(entry) <= bestSplit;
+		});
+		return true;
+	}
+
+	// Every chunk scatters both sides to its offsets in the scratch list, the left side of a chunk
+	// starts after the left sides of the chunks before it
+	std::vector<int> chunkLeftCounts(threads, 0);
+	ForChunks(first, count, threads, [&](int chunk, int begin, int end) {
+		for (int i = begin; i < end; ++i)
+		{
+			chunkLeftCounts[chunk] += (BinOf(buildEntries[i]) <= bestSplit) ? 1 : 0;
+		}
+	});
+
+	std::vector<int> leftOffsets(threads), rightOffsets(threads);
+	int leftOffset = first, rightOffset = first + outSplit.leftCount;
+	int chunkSize = (count + threads - 1) / threads;
+	for (int chunk = 0; chunk < threads; ++chunk)
+	{
+		leftOffsets[chunk] = leftOffset;
+		rightOffsets[chunk] = rightOffset;
+		int chunkCount = std::max(std::min(count - chunk * chunkSize, chunkSize), 0);
+		leftOffset += chunkLeftCounts[chunk];
+		rightOffset += chunkCount - chunkLeftCounts[chunk];
+	}
+
+	ForChunks(first, count, threads, [&](int chunk, int begin, int end) {
+		int leftTarget = leftOffsets[chunk];
+		int rightTarget = rightOffsets[chunk];
+		for (int i = begin; i < end; ++i)
+		{
+			const BuildEntry& entry = buildEntries[i];
+			partitionScratch[(BinOf(entry) <= bestSplit) ? leftTarget++ : rightTarget++] = entry;
+		}
+	});
+	ForChunks(first, count, threads, [&](int chunk, int begin, int end) {
+		std::copy(partitionScratch.begin() + begin, partitionScratch.begin() + end, buildEntries.begin() + begin);
+	});
+	return true;
+}
+
+void SegmentBVH::Refit(const GLBezierStrips& strips)
+{
+	std::vector<AABB> bounds;
+	ComputeSegmentBounds(strips, bounds);
+	Refit(bounds);
+}
+
+void SegmentBVH::Refit(const std::vector<AABB>& bounds)
+{
+	if (bounds.size() != segmentBounds.size())
+	{
+		Build(bounds); // segments were added or removed, the topology is no longer valid
+		return;
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	segmentBounds = bounds;
+
+	// Children are stored after their parents
+	for (int i = int(nodes.size()) - 1; i >= 0; --i)
+	{
+		BVHNode& node = nodes[i];
+		node.bounds = AABB{};
+		if (node.IsLeaf())
+		{
+			for (int j = node.leftOrFirst; j < node.leftOrFirst + node.count; ++j)
+			{
+				node.bounds.Grow(segmentBounds[segmentIndices[j]]);
+			}
+		}
+		else
+		{
+			node.bounds.Grow(nodes[node.leftOrFirst].bounds);
+			node.bounds.Grow(nodes[node.leftOrFirst + 1].bounds);
+		}
+	}
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	refitMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void SegmentBVH::QueryRay(glm::fvec3 origin, glm::fvec3 direction, float maxDistance, std::vector<int>& outSegments) const
+{
+	if (nodes.empty()) return;
+
+	glm::fvec3 inverseDirection = 1.0f / direction;
+	std::vector<int> stack{ 0 };
+	stack.reserve(64);
+
+	while (!stack.empty())
+	{
+		const BVHNode& node = nodes[stack.back()];
+		stack.pop_back();
+
+		float tNear = 0.0f;
+		if (!node.bounds.IntersectRay(origin, inverseDirection, maxDistance, tNear))
+		{
+			continue;
+		}
+
+		if (node.IsLeaf())
+		{
+			for (int i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+			{
+				if (segmentBounds[segmentIndices[i]].IntersectRay(origin, inverseDirection, maxDistance, tNear))
+				{
+					outSegments.push_back(segmentIndices[i]);
+				}
+			}
+		}
+		else
+		{
+			stack.push_back(node.leftOrFirst);
+			stack.push_back(node.leftOrFirst + 1);
+		}
+	}
+}
+
+void SegmentBVH::QueryBounds(const AABB& box, std::vector<int>& outSegments) const
+{
+	if (nodes.empty()) return;
+
+	std::vector<int> stack{ 0 };
+	stack.reserve(64);
+
+	while (!stack.empty())
+	{
+		const BVHNode& node = nodes[stack.back()];
+		stack.pop_back();
+		if (!node.bounds.Overlaps(box))
+		{
+			continue;
+		}
+
+		if (node.IsLeaf())
+		{
+			for (int i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+			{
+				if (segmentBounds[segmentIndices[i]].Overlaps(box))
+				{
+					outSegments.push_back(segmentIndices[i]);
+				}
+			}
+		}
+		else
+		{
+			stack.push_back(node.leftOrFirst);
+			stack.push_back(node.leftOrFirst + 1);
+		}
+	}
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <limits>
+#include "../core/math.h"
+
+struct AABB
+{
+	glm::fvec3 min{ std::numeric_limits<float>::max() };
+	glm::fvec3 max{ -std::numeric_limits<float>::max() };
+
+	// Inline, the BVH build calls these for every bin of every node
+	void Grow(const glm::fvec3& point) { min = glm::min(min, point); max = glm::max(max, point); }
+	void Grow(const AABB& other) { min = glm::min(min, other.min); max = glm::max(max, other.max); }
+	glm::fvec3 Center() const { return (min + max) * 0.5f; }
+	float SurfaceArea() const
+	{
+		glm::fvec3 extent = glm::max(max - min, glm::fvec3{ 0.0f });
+		return 2.0f * (extent.x*extent.y + extent.y*extent.z + extent.z*extent.x);
+	}
+	bool Overlaps(const AABB& other) const;
+
+	// Slab test, tNear is the entry distance along the ray
+	bool IntersectRay(const glm::fvec3& origin, const glm::fvec3& inverseDirection, float maxDistance, float& tNear) const;
+};
+
+struct BVHNode
+{
+	AABB bounds;
+	int leftOrFirst = 0; // first child (the second is leftOrFirst+1) or first entry in the segment index list for leaves
+	int count = 0;       // number of segments in a leaf, 0 for inner nodes
+
+	bool IsLeaf() const { return count > 0; }
+};
+
+/*
+	Bounding volume hierarchy over hair segments.
+
+	Segments are bounded by the convex hull of their bezier control points, grown by the
+	card width and thickness. The tree is built top-down with binned SAH splits. Large
+	subtrees are built on separate threads, and the first levels, where there are fewer
+	subtrees than threads, split their binning and partitioning between the threads they
+	were given. Children are always stored after their parent,
+	so Refit can update all bounds with a single reverse pass when the segments move.
+*/
+class SegmentBVH
+{
+protected:
+	std::vector<BVHNode> nodes;
+	std::vector<int> segmentIndices; // leaves reference ranges of this list
+	std::vector<AABB> segmentBounds;
+	std::atomic<int> numNodes = 0;
+
+	// Only during Build. The bounds are partitioned along with the ids, so every pass over
+	// a node reads memory in order instead of looking the bounds up by id.
+	struct BuildEntry
+	{
+		AABB bounds;
+		int segment = 0;
+
+		float Center(int axis) const { return (bounds.min[axis] + bounds.max[axis]) * 0.5f; }
+	};
+	std::vector<BuildEntry> buildEntries;
+	std::vector<BuildEntry> partitionScratch; // target of the parallel partition, same ranges as buildEntries
+
+public:
+	static const int MAX_LEAF_SIZE = 4;
+
+	double buildMilliseconds = 0.0;
+	double refitMilliseconds = 0.0;
+
+	SegmentBVH() = default;
+	~SegmentBVH() = default;
+
+	void Build(const std::vector<AABB>& bounds);
+	void Build(const class GLBezierStrips& strips);
+
+	// Updates the node bounds for new segment bounds, the tree topology is kept.
+	// Builds instead when the number of segments changed.
+	void Refit(const std::vector<AABB>& bounds);
+	void Refit(const class GLBezierStrips& strips);
+
+	// Segments whose bounds are hit by the ray, in no particular order
+	void QueryRay(glm::fvec3 origin, glm::fvec3 direction, float maxDistance, std::vector<int>& outSegments) const;
+
+	// Segments whose bounds overlap the box
+	void QueryBounds(const AABB& box, std::vector<int>& outSegments) const;
+
+	const std::vector<BVHNode>& Nodes() const { return nodes; }
+	const std::vector<int>& SegmentIndices() const { return segmentIndices; }
+	AABB Bounds() const { return nodes.empty() ? AABB{} : nodes.front().bounds; }
+	bool IsEmpty() const { return nodes.empty(); }
+
+protected:
+	// Sides of a split, the children get their bounds from the bins instead of another pass
+	struct Split
+	{
+		int leftCount = 0;
+		AABB leftBounds, leftCenters;
+		AABB rightBounds, rightCenters;
+	};
+
+	// threads is the number of threads the subtree may use, the node bounds are already set
+	void Subdivide(int nodeIndex, int first, int count, const AABB& centerBounds, int threads);
+
+	// False when the centers coincide on every axis and no plane separates them
+	bool Partition(int first, int count, const AABB& centerBounds, int threads, Split& outSplit);
+	void ComputeRangeBounds(int first, int count, int threads, AABB& outBounds, AABB& outCenters) const;
+};
+
+// Bounds of every segment, in the order of GLBezierStrips::SegmentData
+void ComputeSegmentBounds(const class GLBezierStrips& strips, std::vector<AABB>& outBounds);
@@ -7,6 +7,9 @@
 #include <fstream>
 #include <filesystem>
 #include <functional>
+#include <map>
+#include <memory>
+#include <algorithm>
 
 // Application includes
 #include "opengl/window.h"
@@ -18,11 +21,25 @@
 #include "opengl/grid.h"
 #include "opengl/canvas.h"
 #include "opengl/shadermanager.h"
+#include "opengl/timerquery.h"
+#include "opengl/uniformbuffer.h"
+#include "opengl/renderstate.h"
+#include "opengl/drawlist.h"
+#include "opengl/glextensions.h"
+#include "opengl/hizbuffer.h"
+#include "opengl/framebuffer.h"
+#include "opengl/packedtexture.h"
+#include "opengl/overdraw.h"
+#include "opengl/volumetexture.h"
+#include "opengl/hairshading.h"
+#include "generation/segmentbvh.h"
+#include "generation/densityvolume.h"
 #include "core/application.h"
 #include "core/clock.h"
 #include "core/randomization.h"
 #include "core/threads.h"
 #include "core/utilities.h"
+#include "core/alphaextents.h"
 #include "core/input.h"
 
 /*
@@ -48,6 +65,7 @@ int main()
 	fs::path shaderFolder = fs::current_path().parent_path() / "content" / "shaders";
 	fs::path meshFolder = fs::current_path().parent_path() / "content" / "meshes";
 	fs::path curvesFolder = fs::current_path().parent_path() / "content" / "curves";
+	fs::path cacheFolder = fs::current_path().parent_path() / "content" / "cache";
 	InitializeApplication(ApplicationSettings{
 		WINDOW_VSYNC, WINDOW_FULLSCREEN, WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_RATIO, contentFolder
 	});
@@ -61,7 +79,7 @@ int main()
 
 	GLuint defaultVao = 0;
 	glGenVertexArrays(1, &defaultVao);
-	glBindVertexArray(defaultVao);
+	GLState::BindVertexArray(defaultVao);
 
 	FileListener fileListener;
 	fileListener.StartThread(curvesFolder);
@@ -106,55 +124,98 @@ printf(R"(
 		Load and initialize shaders
 	*/
 	GLTexture defaultTexture{ textureFolder / "default.png" };
-	GLTexture hair_color{ textureFolder / "sparrow_roots.png" };
-	GLTexture hair_alpha{ textureFolder / "sparrow_alpha.png" };
-	GLTexture hair_id{ textureFolder / "sparrow_id.png" };
+	// Root gradient in red, alpha mask in green
+	GLPackedTexture hairTexture{ textureFolder / "sparrow_roots.png", textureFolder / "sparrow_alpha.png", cacheFolder / "textures" };
+	float hairMaskCutoff = 0.25f;
+	hairTexture.Build(hairMaskCutoff);
 	defaultTexture.UseForDrawing();
 
-	// Uniform Buffer Object containing matrices and light information
-	GLUBO CameraUBO, LightUBO;
-	CameraUBO.Bind(1);
-	CameraUBO.Allocate(16 * 8 + 16); // 2 matrices => 8 columns => 16 bytes per column, +vec3 16 bytes
-	LightUBO.Bind(2);
-	LightUBO.Allocate(16 * 2);
+	// Hair cards are trimmed to the opaque part of the alpha mask when they are sent to the GPU
+	AlphaExtents hairAlphaExtents;
+	hairAlphaExtents.Build(hairTexture.Pixels().data(), hairTexture.width, hairTexture.height, 1, hairMaskCutoff);
+	bool trimHairCards = true;
+
+	// Marschner lookup tables for the hair specular, baked once and then loaded from the cache
+	GLHairShadingTables hairShadingTables{ cacheFolder / "tables" };
+	Marschner::Parameters hairShadingParameters;
+	hairShadingTables.Build(hairShadingParameters);
+
+	// Camera, light and per-draw model matrices are streamed through one ring buffer
+	GLUniformRing uniformRing;
+	uniformRing.Allocate(64 * 1024);
 
 	// Change each LoadShader call to LoadLiveShader for live editing
-	GLProgram lineShader, backgroundShader, headShader, hairShader, bezierLinesShader;
+	GLProgram lineShader, backgroundShader;
 	ShaderManager shaderManager;
 	shaderManager.InitializeFolder(shaderFolder);
+	shaderManager.EnableBinaryCache(cacheFolder / "programs");
 	shaderManager.LoadShader(lineShader, L"line_vertex.glsl", L"line_fragment.glsl");
 	shaderManager.LoadShader(backgroundShader, L"background_vertex.glsl", L"background_fragment.glsl");
+	UniformHandle useUniformColorHandle = lineShader.GetUniformHandle("useUniformColor");
+
+	// Live programs with debug features, a variant is compiled for each combination of defines in use
+	ShaderPermutations& headShaders = shaderManager.AddPermutations(L"head_vertex.glsl", L"head_fragment.glsl", L"head_geometry.glsl");
+	headShaders.geometryDefine = "FLAT_SHADING";
+	ShaderPermutations& hairShaders = shaderManager.AddPermutations(L"hair_segment_vertex.glsl", L"hair_fragment.glsl", L"hair_planes_geometry.glsl");
+	hairShaders.feedbackVaryings = { "VertexAttrib.position_ws", "VertexAttrib.normal_ws", "VertexAttrib.tcoord" };
+	ShaderPermutations& hairCachedShaders = shaderManager.AddPermutations(L"hair_cached_vertex.glsl", L"hair_fragment.glsl");
+	ShaderPermutations& hairCardShaders = shaderManager.AddPermutations(L"hair_card_vertex.glsl", L"hair_fragment.glsl");
+	ShaderPermutations& bezierLinesShaders = shaderManager.AddPermutations(L"bezier_vertex.glsl", L"line_fragment.glsl", L"bezier_lines_geometry.glsl");
+
+	// Load the production variants now rather than on the first frame
+	for (ShaderPermutations* permutations : { &headShaders, &hairShaders, &hairCachedShaders, &hairCardShaders, &bezierLinesShaders })
+	{
+		shaderManager.GetProgram(*permutations);
+	}
+
+	// Frustum and Hi-Z occlusion culling of the hair, needs compute shaders and multi draw indirect (GL 4.3)
+	GLProgram hairCullShader, hairSegmentCullShader, hizDownsampleShader;
+	bool bGpuCullingSupported = HasComputeShader() && HasMultiDrawIndirect();
+	if (bGpuCullingSupported)
+	{
+		shaderManager.LoadLiveComputeShader(hairCullShader, L"hair_cull_compute.glsl");
+		shaderManager.LoadLiveComputeShader(hairSegmentCullShader, L"hair_cull_compute.glsl", { "SEGMENT_LIST" });
+		shaderManager.LoadLiveComputeShader(hizDownsampleShader, L"hiz_downsample_compute.glsl");
+	}
+
+	// Overdraw heatmap of the hair, counted with image atomics (GL 4.2)
+	GLProgram overdrawShader;
+	bool bOverdrawSupported = HasComputeShader();
+	if (bOverdrawSupported)
+	{
+		shaderManager.LoadShader(overdrawShader, L"background_vertex.glsl", L"overdraw_fragment.glsl");
+	}
+	UniformHandle maxOverdrawHandle = overdrawShader.GetUniformHandle("maxOverdraw");
+	UniformHandle showDiscardedHandle = overdrawShader.GetUniformHandle("showDiscarded");
+	shaderManager.PrintLoadStatistics();
 
-	shaderManager.LoadLiveShader(headShader, L"head_vertex.glsl", L"head_fragment.glsl", L"head_geometry.glsl");
-	shaderManager.LoadLiveShader(hairShader, L"bezier_vertex.glsl", L"hair_fragment.glsl", L"hair_planes_geometry.glsl");
-	shaderManager.LoadLiveShader(bezierLinesShader, L"bezier_vertex.glsl", L"line_fragment.glsl", L"bezier_lines_geometry.glsl");
-
-	// Initialize model values
-	glm::mat4 identity_transform{ 1.0f };
-	lineShader.Use();
-	lineShader.SetUniformMat4("model", identity_transform);
-	headShader.Use(); 
-	headShader.SetUniformMat4("model", identity_transform);
-	hairShader.Use();
-	hairShader.SetUniformMat4("model", identity_transform);
-	bezierLinesShader.Use();
-	bezierLinesShader.SetUniformMat4("model", identity_transform);
-
-	// Initialize light source in shaders
+	// Initialize light source
 	glm::vec4 lightColor{ 1.0f, 1.0f, 1.0f, 1.0f };
 	glm::vec3 lightPosition{ 999999.0f };
-	LightUBO.SetData(glm::value_ptr(lightPosition), 0, 12);
-	LightUBO.SetData(glm::value_ptr(lightColor), 16, 16);
 
 	/*
 		Load hair curve data
 	*/
 	GLBezierStrips longHairMesh;
+	GLFeedbackMesh longHairCache; // tessellated hair, reused while the geometry inputs are unchanged
+	GLCardTemplates hairCardTemplates;
+	GLBezierStrips benchmarkHairMesh; // copies of longHairMesh for measuring large grooms
+	int builtHairBenchmark = 0;       // groom size in benchmarkHairMesh, -1 rebuilds it along with the BVH and density
+	SegmentBVH hairBVH;               // segment bounds of the displayed groom, nothing queries it yet, its build time is shown in the UI
+	DensityVolume hairDensity;        // voxelized displayed groom for self-shadowing, uploaded when dirty
+	GLVolumeTexture hairDensityTexture;
+	const GLuint HAIR_DENSITY_TEXTURE_UNIT = 9; // hair_fragment.glsl
+	longHairMesh.SetCardTrimming(&hairAlphaExtents);
+	benchmarkHairMesh.SetCardTrimming(&hairAlphaExtents);
 	GLMesh::LoadCurves(curvesFolder / "longhair.json", longHairMesh);
-	fileListener.Bind(L"longhair.json", [&longHairMesh](fs::path filePath) -> void 
+	hairBVH.Build(longHairMesh);
+	hairDensity.Build(longHairMesh);
+	fileListener.Bind(L"longhair.json", [&longHairMesh, &longHairCache, &builtHairBenchmark](fs::path filePath) -> void 
 		{
 			GLMesh::LoadCurves(filePath, longHairMesh);
 			longHairMesh.SendToGPU();
+			longHairCache.Invalidate();
+			builtHairBenchmark = -1; // the displayed groom, its BVH and density are rebuilt together in the frame loop
 		}
 	);
 
@@ -186,14 +247,16 @@ printf(R"(
 		User interaction parameters in the UI
 	*/
 	bool renderHead = true;
+	bool renderHeadFlat = false;
 	bool renderHair = true;
 	bool renderWireframe = false;
 	bool renderBezierLines = false;
 	bool lightFollowsCamera = false;
 	bool renderHairFlat = false;
 	bool drawDebugNormals = false;
+	bool cacheHairGeometry = true;
 	float hairUnifiedNormalBlend = 0.9f;
-	float hairMaskCutoff = 0.25f;
+	float hairRibbonDistance = 0.0f;
 	glm::fvec3 unifiedNormalsCapsuleStart = glm::fvec3(0.0f, 0.0f, 0.0f);
 	glm::fvec3 unifiedNormalsCapsuleEnd = glm::fvec3(0.0f, 15.0f, 0.0f);
 	glm::fvec3 hairDarkColor = glm::fvec3(33.0f/255.0f, 17.0f/255.0f, 4.0f/255.0f);
@@ -202,6 +265,127 @@ printf(R"(
 	int RenderHairMesh = 0;
 	int shapeOverride = -1;
 	int subdivisionsOverride = -1;
+	int hairRenderPath = 0; // 0 = geometry shader, 1 = instanced cards
+	bool gpuCulling = true;
+	bool occlusionCulling = true; // hair behind the head, part of GPU culling
+	bool hairDepthPrepass = false;
+	bool sortedBlending = false;     // geometry shader path only
+	float sortMoveThreshold = 1.0f; // camera distance in hair space before the segments are sorted again
+	int hairEdges = 0;               // 0 = alpha test, otherwise alpha to coverage with 2, 4 or 8 samples
+	bool showOverdraw = false;
+	bool overdrawDiscards = false;   // heatmap of the discarded fragments instead of all shaded ones
+	int overdrawRange = 32;          // fragments per pixel at the top of the heatmap
+	bool hairSelfShadow = true;
+	bool hairSpecular = true;
+	float hairSpecularStrength = 1.0f;
+	float hairShadowDensity = 0.5f;  // share of the card area that blocks light, see DensityVolume
+	double hairMilliseconds[2] = { 0.0, 0.0 }; // last hair GPU time without and with the depth pre-pass
+	int hairBenchmark = 0;  // index into benchmarkSegmentCounts
+	const int benchmarkSegmentCounts[] = { 0, 10000, 100000, 1000000 };
+
+	// GPU time per pass. Whole layers are timed by the draw list, the scene and transparent layers per object.
+	// Time queries cannot nest, so the multisampled resolve is its own pass.
+	enum GPUPass { PASS_OCCLUDERS, PASS_BACKGROUND, PASS_HEAD, PASS_HAIR, PASS_GRID, PASS_DEBUG_VIEW, PASS_LINES, PASS_RESOLVE, PASS_IMGUI, NUM_PASSES };
+	const char* passNames[NUM_PASSES] = { "Occluders", "Background", "Head", "Hair", "Grid", "Debug view", "Lines", "Resolve", "ImGui" };
+	GLTimerQuery passTimers[NUM_PASSES];
+	bool passDrawn[NUM_PASSES] = {}; // this frame, the timers keep the result of the last frame that drew them
+	auto BeginPass = [&](int pass) -> void {
+		passTimers[pass].Begin();
+		passDrawn[pass] = true;
+	};
+	auto EndPass = [&](int pass) -> void {
+		passTimers[pass].End();
+	};
+
+	// Geometry shader and fragment counts of the hair pass
+	const bool bPipelineStatisticsSupported = HasPipelineStatistics();
+	std::unique_ptr<GLPipelineQuery> hairPipelineQuery = bPipelineStatisticsSupported ? std::make_unique<GLPipelineQuery>() : nullptr;
+	bool logGpuPasses = false;
+	double lastGpuPassLog = 0.0;
+
+	// Hair pass time of both render paths on every benchmark groom, see StepPathBenchmark
+	struct PathBenchmark
+	{
+		bool bRunning = false;
+		int step = 0;  // (benchmark groom - 1) * 2 + render path
+		int frame = 0;
+		double totalMilliseconds = 0.0;
+		int savedBenchmark = 0;
+		int savedRenderPath = 0;
+	} pathBenchmark;
+	const int PATH_BENCHMARK_WARMUP = 30; // frames, the groom is rebuilt and the timers lag behind
+	const int PATH_BENCHMARK_FRAMES = 120;
+	GLHiZBuffer hizBuffer{ WINDOW_WIDTH, WINDOW_HEIGHT }; // depth of the head
+	GLMultisampleFramebuffer sceneFramebuffer{ WINDOW_WIDTH, WINDOW_HEIGHT };
+	GLOverdrawCounter overdrawCounter{ WINDOW_WIDTH, WINDOW_HEIGHT };
+
+	// Draw list layers, submitted in this order. Within a layer the order follows the program ids,
+	// which change at runtime, so anything that must come after the opaque scene gets its own layer.
+	// Blended hair comes after the grid, the last opaque geometry, so that the grid shows through its edges.
+	enum DrawLayer : uint8_t { LAYER_OCCLUDERS, LAYER_BACKGROUND, LAYER_SCENE, LAYER_GRID, LAYER_TRANSPARENT, LAYER_DEBUG_VIEW, LAYER_OVERLAY, LAYER_RESOLVE };
+	const int layerPasses[] = { PASS_OCCLUDERS, PASS_BACKGROUND, -1, PASS_GRID, -1, PASS_DEBUG_VIEW, PASS_LINES, PASS_RESOLVE };
+	GLDrawList drawList;
+	GLState::Statistics renderStateStatistics;
+
+	// Everything that changes the output of hair_planes_geometry.glsl
+	struct HairGeometryKey
+	{
+		int shapeOverride = -1;
+		int subdivisionsOverride = -1;
+		glm::fvec3 capsuleStart{ 0.0f };
+		glm::fvec3 capsuleEnd{ 0.0f };
+		float normalBlend = 0.0f;
+		glm::mat4 model{ 1.0f };
+		GLuint programId = 0;
+		GLuint programRevision = 0;
+		float ribbonDistance = 0.0f;
+		glm::fvec3 cameraPosition{ 0.0f }; // only used by the ribbon shape
+
+		bool operator==(const HairGeometryKey& other) const
+		{
+			return shapeOverride == other.shapeOverride && subdivisionsOverride == other.subdivisionsOverride &&
+				capsuleStart == other.capsuleStart && capsuleEnd == other.capsuleEnd &&
+				normalBlend == other.normalBlend && model == other.model &&
+				programId == other.programId && programRevision == other.programRevision &&
+				ribbonDistance == other.ribbonDistance && cameraPosition == other.cameraPosition;
+		}
+	};
+	HairGeometryKey cachedHairKey;
+
+	// Handles of the per-frame uniforms of the hair and bezier line permutations, looked up once
+	// per program instead of hashing the names on every set. Names a program lacks stay unused.
+	struct SceneUniformHandles
+	{
+		GLuint revision = 0;
+		UniformHandle darkColor, lightColor, maskCutoff;
+		UniformHandle densityMatrix, shadowDensity, specularStrength;
+		UniformHandle capsuleStart, capsuleEnd, normalBlend;
+		UniformHandle shapeOverride, subdivisionsOverride, ribbonDistance;
+	};
+	std::map<GLProgram*, SceneUniformHandles> sceneUniformHandles;
+	auto GetSceneUniformHandles = [&](GLProgram& program) -> const SceneUniformHandles& {
+		auto it = sceneUniformHandles.find(&program);
+		if (it != sceneUniformHandles.end() && it->second.revision == program.Revision())
+		{
+			return it->second;
+		}
+
+		SceneUniformHandles& handles = sceneUniformHandles[&program];
+		handles.revision = program.Revision();
+		handles.darkColor = program.GetUniformHandle("darkColor");
+		handles.lightColor = program.GetUniformHandle("lightColor");
+		handles.maskCutoff = program.GetUniformHandle("maskCutoff");
+		handles.densityMatrix = program.GetUniformHandle("densityMatrix");
+		handles.shadowDensity = program.GetUniformHandle("shadowDensity");
+		handles.specularStrength = program.GetUniformHandle("specularStrength");
+		handles.capsuleStart = program.GetUniformHandle("unifiedNormalsCapsuleStart");
+		handles.capsuleEnd = program.GetUniformHandle("unifiedNormalsCapsuleEnd");
+		handles.normalBlend = program.GetUniformHandle("normalBlend");
+		handles.shapeOverride = program.GetUniformHandle("shapeOverride");
+		handles.subdivisionsOverride = program.GetUniformHandle("subdivisionsOverride");
+		handles.ribbonDistance = program.GetUniformHandle("ribbonDistance");
+		return handles;
+	};
 
 	/*
 		IMGUI callback
@@ -213,6 +397,7 @@ printf(R"(
 		{
 			ImGui::Text("Scene");
 			ImGui::Checkbox("Render head", &renderHead);
+			ImGui::Checkbox("Flat shaded head", &renderHeadFlat);
 			ImGui::Checkbox("Render hair", &renderHair);
 			ImGui::Checkbox("Wireframe", &renderWireframe);
 			ImGui::Checkbox("Light follows camera", &lightFollowsCamera);
@@ -220,6 +405,45 @@ printf(R"(
 			ImGui::ColorEdit3("Dark Color", (float*)& hairDarkColor);
 			ImGui::ColorEdit3("Light Color", (float*)& hairLightColor);
 			ImGui::SliderFloat("Mask cutoff", (float*)& hairMaskCutoff, 0.0f, 1.0f);
+			bool bRetrimHairCards = false;
+			if (ImGui::IsItemDeactivatedAfterEdit())
+			{
+				hairTexture.Build(hairMaskCutoff);
+				hairAlphaExtents.Build(hairTexture.Pixels().data(), hairTexture.width, hairTexture.height, 1, hairMaskCutoff);
+				bRetrimHairCards = trimHairCards;
+			}
+			bRetrimHairCards |= ImGui::Checkbox("Trim cards to alpha", &trimHairCards);
+			if (bRetrimHairCards)
+			{
+				// Rebuilds the segment data, the benchmark groom and the BVH follow below
+				const AlphaExtents* extents = trimHairCards ? &hairAlphaExtents : nullptr;
+				longHairMesh.SetCardTrimming(extents);
+				benchmarkHairMesh.SetCardTrimming(extents);
+				longHairMesh.SendToGPU();
+				longHairCache.Invalidate();
+				builtHairBenchmark = -1;
+			}
+			ImGui::Checkbox("Self shadowing", &hairSelfShadow);
+			ImGui::Checkbox("Marschner specular", &hairSpecular);
+			if (hairSpecular)
+			{
+				// Angles are shown in degrees, the tables are rebaked when a slider is released
+				float shiftDegrees = glm::degrees(hairShadingParameters.shift);
+				float widthDegrees = glm::degrees(hairShadingParameters.width);
+				ImGui::SliderFloat("Specular strength", &hairSpecularStrength, 0.0f, 4.0f);
+				bool bRebakeShading = false;
+				if (ImGui::SliderFloat("Cuticle tilt", &shiftDegrees, -15.0f, 0.0f)) hairShadingParameters.shift = glm::radians(shiftDegrees);
+				bRebakeShading |= ImGui::IsItemDeactivatedAfterEdit();
+				if (ImGui::SliderFloat("Lobe width", &widthDegrees, 2.0f, 20.0f)) hairShadingParameters.width = glm::radians(widthDegrees);
+				bRebakeShading |= ImGui::IsItemDeactivatedAfterEdit();
+				ImGui::SliderFloat("Absorption", &hairShadingParameters.absorption, 0.0f, 2.0f);
+				bRebakeShading |= ImGui::IsItemDeactivatedAfterEdit();
+				if (bRebakeShading)
+				{
+					hairShadingTables.Build(hairShadingParameters);
+				}
+			}
+			ImGui::SliderFloat("Shadow density", &hairShadowDensity, 0.0f, 2.0f);
 			ImGui::Checkbox("Debug bezier", &renderBezierLines);
 			ImGui::Checkbox("Flat color", &renderHairFlat);
 			ImGui::Text("Hair Normals Capsule");
@@ -228,14 +452,200 @@ printf(R"(
 			ImGui::SliderFloat("Amount", &hairUnifiedNormalBlend, 0.0f, 1.0f);
 			ImGui::Checkbox("Draw debug normals", &drawDebugNormals);
 			ImGui::Text("Hair Overrides");
-			ImGui::SliderInt("Shape", &shapeOverride, -1, 2);
+			ImGui::SliderInt("Shape", &shapeOverride, -1, 3);
+			ImGui::SliderFloat("Ribbon distance", &hairRibbonDistance, 0.0f, 5.0f);
 			ImGui::SliderInt("Subdivisions", &subdivisionsOverride, -1, 4);
+			ImGui::Checkbox("Cache tessellation", &cacheHairGeometry);
+			ImGui::Combo("Render path", &hairRenderPath, "Geometry shader\0Instanced cards\0");
+			if (bGpuCullingSupported)
+			{
+				// The geometry shader path only culls when it is not drawn from the tessellation cache
+				ImGui::Checkbox("GPU culling", &gpuCulling);
+				ImGui::Checkbox("Occlusion culling", &occlusionCulling);
+			}
+			ImGui::Combo("Hair edges", &hairEdges, "Alpha test\0" "Alpha to coverage 2x\0" "Alpha to coverage 4x\0" "Alpha to coverage 8x\0");
+			ImGui::Checkbox("Depth pre-pass", &hairDepthPrepass);
+			if (hairRenderPath == 0)
+			{
+				ImGui::Checkbox("Sorted blending", &sortedBlending);
+				ImGui::SliderFloat("Re-sort distance", &sortMoveThreshold, 0.0f, 10.0f);
+			}
+			ImGui::Combo("Benchmark", &hairBenchmark, "Off\0" "10k segments\0" "100k segments\0" "1M segments\0");
+			if (pathBenchmark.bRunning)
+			{
+				ImGui::Text("Benchmarking render paths, step %d of 6", pathBenchmark.step + 1);
+			}
+			else if (ImGui::Button("Benchmark render paths"))
+			{
+				pathBenchmark = PathBenchmark{};
+				pathBenchmark.bRunning = true;
+				pathBenchmark.savedBenchmark = hairBenchmark;
+				pathBenchmark.savedRenderPath = hairRenderPath;
+				hairBenchmark = 1;
+				hairRenderPath = 0;
+			}
+			if (bOverdrawSupported)
+			{
+				ImGui::Checkbox("Overdraw heatmap", &showOverdraw);
+				if (showOverdraw)
+				{
+					ImGui::SliderInt("Heatmap range", &overdrawRange, 1, 128);
+					ImGui::Checkbox("Heatmap of discards", &overdrawDiscards);
+				}
+			}
+			ImGui::Text("Stats");
+			ImGui::Text("Hair segments: %d", (hairBenchmark > 0) ? benchmarkHairMesh.SegmentCount() : longHairMesh.SegmentCount());
+			ImGui::Text("Trimmed card width: %.1f%%", 100.0f * ((hairBenchmark > 0) ? benchmarkHairMesh.trimmedCardWidth : longHairMesh.trimmedCardWidth));
+			ImGui::Text("Hair BVH: %d nodes, build %.2f ms, refit %.2f ms", int(hairBVH.Nodes().size()), hairBVH.buildMilliseconds, hairBVH.refitMilliseconds);
+			glm::ivec3 densityResolution = hairDensity.Resolution();
+			ImGui::Text("Density volume: %dx%dx%d, build %.2f ms", densityResolution.x, densityResolution.y, densityResolution.z, hairDensity.buildMilliseconds);
+			ImGui::Text("  last update %.2f ms, %d segments", hairDensity.updateMilliseconds, hairDensity.updatedSegments);
+			hairMilliseconds[hairDepthPrepass ? 1 : 0] = passTimers[PASS_HAIR].Milliseconds();
+			ImGui::Text("Hair GPU time: %.3f ms", passTimers[PASS_HAIR].Milliseconds());
+			ImGui::Text("  without pre-pass %.3f ms, with %.3f ms", hairMilliseconds[0], hairMilliseconds[1]);
+			ImGui::Text("Hair texture: BC5 %.2f MB, RGBA8 %.2f MB, %d levels", hairTexture.compressedBytes / (1024.0f * 1024.0f), hairTexture.uncompressedBytes / (1024.0f * 1024.0f), hairTexture.mipLevels);
+			ImGui::Text("  %s in %.1f ms", hairTexture.bLoadedFromCache ? "loaded from cache" : "encoded", hairTexture.buildMilliseconds);
+			ImGui::Text("Shading tables: %s in %.1f ms", hairShadingTables.bLoadedFromCache ? "loaded from cache" : "baked", hairShadingTables.buildMilliseconds);
+			ImGui::Text("MSAA resolve: %.3f ms, %d samples", passTimers[PASS_RESOLVE].Milliseconds(), std::max(sceneFramebuffer.Samples(), 1));
+			if (showOverdraw)
+			{
+				const GLOverdrawCounter::Statistics& overdraw = overdrawCounter.GetStatistics();
+				ImGui::Text("Overdraw: mean %.2f, p95 %d, max %d over %d pixels", overdraw.meanFragments, overdraw.p95Fragments, overdraw.maxFragments, overdraw.coveredPixels);
+				ImGui::Text("  %.1f%% discarded, %.2f passed per pixel", 100.0 * overdraw.discardRatio, overdraw.meanPassed);
+				if (ImGui::Button("Save overdraw stats"))
+				{
+					// One line per click, the label records the settings that change the fragment count
+					const char* renderPaths[] = { "geometry shader", "cards" };
+					char label[256];
+					snprintf(label, sizeof(label), "%s %d segments culling %d occlusion %d trim %d edges %d prepass %d",
+						renderPaths[hairRenderPath], (hairBenchmark > 0) ? benchmarkHairMesh.SegmentCount() : longHairMesh.SegmentCount(),
+						int(gpuCulling && bGpuCullingSupported), int(occlusionCulling), int(trimHairCards), hairEdges, int(hairDepthPrepass));
+					overdrawCounter.SaveStatistics(fs::current_path() / "overdraw_stats.csv", label);
+				}
+			}
+			if (hairRenderPath == 0 && sortedBlending)
+			{
+				GLBezierStrips& sortedMesh = (hairBenchmark > 0) ? benchmarkHairMesh : longHairMesh;
+				ImGui::Text("Hair depth sort: %.2f ms", sortedMesh.sortMilliseconds);
+			}
+			ImGui::Text("State changes: %u issued, %u skipped", renderStateStatistics.issued, renderStateStatistics.skipped);
+			GLBufferHeap::Statistics heapStatistics = GetBufferHeap().GetStatistics();
+			ImGui::Text("Buffer heap: %d allocations, %.1f / %.1f MB in %d pages", heapStatistics.allocations,
+				heapStatistics.usedBytes / (1024.0f * 1024.0f), heapStatistics.reservedBytes / (1024.0f * 1024.0f), heapStatistics.pages);
+
+
+		}
+		ImGui::End();
 
+		ImGui::SetNextWindowSize(ImVec2(WINDOW_WIDTH * 0.2f, 0.0f));
+		ImGui::SetNextWindowPos(ImVec2(WINDOW_WIDTH * 0.8f, 0.0f));
+		ImGui::Begin("GPU passes");
+		{
+			double totalMilliseconds = 0.0;
+			for (int pass = 0; pass < NUM_PASSES; ++pass)
+			{
+				if (!passDrawn[pass]) continue;
+				ImGui::Text("%-12s %7.3f ms", passNames[pass], passTimers[pass].Milliseconds());
+				totalMilliseconds += passTimers[pass].Milliseconds();
+			}
+			ImGui::Text("%-12s %7.3f ms", "Total", totalMilliseconds);
 
+			if (bPipelineStatisticsSupported && passDrawn[PASS_HAIR])
+			{
+				ImGui::Text("Hair pipeline");
+				ImGui::Text("  GS invocations %llu", (unsigned long long)hairPipelineQuery->Result(GLPipelineQuery::GEOMETRY_SHADER_INVOCATIONS));
+				ImGui::Text("  GS primitives  %llu", (unsigned long long)hairPipelineQuery->Result(GLPipelineQuery::GEOMETRY_SHADER_PRIMITIVES_EMITTED));
+				ImGui::Text("  Fragments      %llu", (unsigned long long)hairPipelineQuery->Result(GLPipelineQuery::FRAGMENT_SHADER_INVOCATIONS));
+			}
+			ImGui::Checkbox("Log to gpu_passes.log", &logGpuPasses);
 		}
 		ImGui::End();
 	};
 
+	/*
+		One line per second while logging is enabled, the columns follow passNames
+	*/
+	auto LogGpuPasses = [&]() -> void {
+		fs::path logPath = fs::current_path() / "gpu_passes.log";
+		bool bNewFile = !fs::exists(logPath);
+		std::ofstream file(logPath, std::ios::app);
+		if (!file)
+		{
+			return;
+		}
+
+		if (bNewFile)
+		{
+			file << "time";
+			for (int pass = 0; pass < NUM_PASSES; ++pass)
+			{
+				file << ";" << passNames[pass] << " ms";
+			}
+			file << ";GS invocations;GS primitives;Fragments\n";
+		}
+
+		// Passes that were not drawn this frame are left empty
+		file << clock.time;
+		for (int pass = 0; pass < NUM_PASSES; ++pass)
+		{
+			file << ";";
+			if (passDrawn[pass]) file << passTimers[pass].Milliseconds();
+		}
+		for (int counter = 0; counter < GLPipelineQuery::NUM_COUNTERS; ++counter)
+		{
+			file << ";";
+			if (bPipelineStatisticsSupported && passDrawn[PASS_HAIR]) file << hairPipelineQuery->Result(GLPipelineQuery::Counter(counter));
+		}
+		file << "\n";
+	};
+
+	/*
+		Steps through the benchmark grooms with both render paths and appends the mean hair
+		pass time of each to hair_paths.csv, then restores the groom and the render path.
+	*/
+	auto StepPathBenchmark = [&]() -> void {
+		if (!pathBenchmark.bRunning)
+		{
+			return;
+		}
+
+		if (++pathBenchmark.frame > PATH_BENCHMARK_WARMUP)
+		{
+			pathBenchmark.totalMilliseconds += passTimers[PASS_HAIR].Milliseconds();
+		}
+		if (pathBenchmark.frame < PATH_BENCHMARK_WARMUP + PATH_BENCHMARK_FRAMES)
+		{
+			return;
+		}
+
+		fs::path csvPath = fs::current_path() / "hair_paths.csv";
+		bool bNewFile = !fs::exists(csvPath);
+		std::ofstream file(csvPath, std::ios::app);
+		if (file)
+		{
+			const char* renderPaths[] = { "geometry shader", "cards" };
+			if (bNewFile)
+			{
+				file << "render path;segments;culling;hair ms\n";
+			}
+			file << renderPaths[hairRenderPath] << ";" << benchmarkHairMesh.SegmentCount() << ";" << int(gpuCulling && bGpuCullingSupported) << ";"
+				<< pathBenchmark.totalMilliseconds / PATH_BENCHMARK_FRAMES << "\n";
+		}
+
+		pathBenchmark.step++;
+		pathBenchmark.frame = 0;
+		pathBenchmark.totalMilliseconds = 0.0;
+		if (pathBenchmark.step == 6)
+		{
+			hairBenchmark = pathBenchmark.savedBenchmark;
+			hairRenderPath = pathBenchmark.savedRenderPath;
+			pathBenchmark.bRunning = false;
+			return;
+		}
+		hairBenchmark = 1 + pathBenchmark.step / 2;
+		hairRenderPath = pathBenchmark.step % 2;
+	};
+
 	/*
 		Main application loop
 	*/
@@ -315,24 +725,48 @@ printf(R"(
 
 		/*
 			Render scene
+			Draws are recorded into drawList and submitted sorted by layer, program, texture and vao.
+			Binds go through GLState so state shared by consecutive draws is not set again.
 		*/
 		window.Clear();
+		uniformRing.BeginFrame();
+
+		GLenum scenePolygonMode = renderWireframe ? GL_LINE : GL_FILL;
 
-		// Background color gradient
-		backgroundShader.Use();
-		backgroundQuad.Draw();
-		glClear(GL_DEPTH_BUFFER_BIT);
-		
-		// Set scene render properties
-		glPolygonMode(GL_FRONT_AND_BACK, (renderWireframe? GL_LINE : GL_FILL));
-		glm::mat4 viewmatrix = camera.ViewMatrix();
-		glm::mat4 projectionmatrix = camera.ProjectionMatrix();
-		CameraUBO.SetData(glm::value_ptr(projectionmatrix), 0, 64);
-		CameraUBO.SetData(glm::value_ptr(viewmatrix), 64, 64);
-		CameraUBO.SetData(glm::value_ptr(camera.GetPosition()), 128, 16);
+		CameraBlock cameraBlock;
+		cameraBlock.projection = camera.ProjectionMatrix();
+		cameraBlock.view = camera.ViewMatrix();
+		cameraBlock.view_projection = cameraBlock.projection * cameraBlock.view;
+		cameraBlock.camera_position = camera.GetPosition();
+		uniformRing.Push(CAMERA_BLOCK_BINDING, cameraBlock);
 
 		// Update light source
-		LightUBO.SetData(glm::value_ptr(lightFollowsCamera? camera.GetPosition() : lightPosition), 0, 12);
+		LightBlock lightBlock;
+		lightBlock.light_position = lightFollowsCamera? camera.GetPosition() : lightPosition;
+		lightBlock.light_color = lightColor;
+		uniformRing.Push(LIGHT_BLOCK_BINDING, lightBlock);
+
+		// The scene goes to the multisampled framebuffer when alpha to coverage is used, program 0 sorts first
+		sceneFramebuffer.SetSamples((hairEdges > 0) ? (1 << hairEdges) : 0);
+		bool bAlphaToCoverage = sceneFramebuffer.IsValid();
+		if (bAlphaToCoverage)
+		{
+			drawList.Add(GLDrawList::MakeKey(LAYER_BACKGROUND, 0), [&]() {
+				sceneFramebuffer.Bind();
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+			});
+			drawList.Add(GLDrawList::MakeKey(LAYER_RESOLVE, 0), [&]() {
+				sceneFramebuffer.Resolve();
+			});
+		}
+
+		// Background color gradient, depth is cleared before the first scene draw
+		drawList.Add(GLDrawList::MakeKey(LAYER_BACKGROUND, backgroundShader.Id(), 0, backgroundQuad.VertexArray()), [&]() {
+			GLState::PolygonMode(GL_FILL);
+			backgroundShader.Use();
+			backgroundQuad.Draw();
+			glClear(GL_DEPTH_BUFFER_BIT);
+		});
 
 		if (renderHead)
 		{
@@ -340,53 +774,340 @@ printf(R"(
 			//headmesh.transform.rotation = glm::vec3(0.0f, 360.0f*sinf(clock.time), 0.0f);
 			//longHairMesh.transform = headmesh.transform;
 
-			headShader.Use();
-			headShader.SetUniformMat4("model", headmesh.transform.ModelMatrix());
-			headmesh.Draw();
+			GLProgram* headShader = &shaderManager.GetProgram(headShaders, renderHeadFlat ? ShaderDefines{ "FLAT_SHADING" } : ShaderDefines{});
+			drawList.Add(GLDrawList::MakeKey(LAYER_SCENE, headShader->Id(), 0, headmesh.VertexArray()), [&, headShader]() {
+				GLState::PolygonMode(scenePolygonMode);
+				BeginPass(PASS_HEAD);
+				headShader->Use();
+				uniformRing.Push(OBJECT_BLOCK_BINDING, ObjectBlock{ headmesh.transform.ModelMatrix() });
+				headmesh.Draw();
+				EndPass(PASS_HEAD);
+			});
 		}
 
 		if (renderHair)
 		{
-			hairShader.Use();
-			hair_color.UseForDrawing(0);
-			hair_alpha.UseForDrawing(1);
-			hair_id.UseForDrawing(2);
-			hairShader.SetUniformMat4("model", longHairMesh.transform.ModelMatrix());
-			hairShader.SetUniformInt("bRenderHairFlat", renderHairFlat);
-			hairShader.SetUniformInt("bDrawDebugNormals", drawDebugNormals);
-			hairShader.SetUniformVec3("unifiedNormalsCapsuleStart", unifiedNormalsCapsuleStart);
-			hairShader.SetUniformVec3("unifiedNormalsCapsuleEnd", unifiedNormalsCapsuleEnd);
-			hairShader.SetUniformVec3("darkColor", hairDarkColor);
-			hairShader.SetUniformVec3("lightColor", hairLightColor);
-			hairShader.SetUniformFloat("normalBlend", hairUnifiedNormalBlend);
-			hairShader.SetUniformFloat("maskCutoff", hairMaskCutoff);
-			hairShader.SetUniformInt("shapeOverride", shapeOverride);
-			hairShader.SetUniformInt("subdivisionsOverride", subdivisionsOverride);
-			longHairMesh.Draw();
+			auto SetHairShadingUniforms = [&](GLProgram& program) -> void {
+				const SceneUniformHandles& handles = GetSceneUniformHandles(program);
+				program.SetUniformVec3(handles.darkColor, hairDarkColor);
+				program.SetUniformVec3(handles.lightColor, hairLightColor);
+				program.SetUniformFloat(handles.maskCutoff, hairMaskCutoff);
+
+				// The density grid is in the local space of the displayed groom, the fragments in world space
+				const GLBezierStrips& shadowedMesh = (hairBenchmark > 0) ? benchmarkHairMesh : longHairMesh;
+				program.SetUniformMat4(handles.densityMatrix, hairDensity.LocalToVolume() * glm::inverse(shadowedMesh.transform.ModelMatrix()));
+				program.SetUniformFloat(handles.shadowDensity, hairShadowDensity);
+				program.SetUniformFloat(handles.specularStrength, hairSpecularStrength);
+			};
+
+			// Benchmark grooms are built from copies of the loaded groom laid out in a grid
+			if (hairBenchmark != builtHairBenchmark)
+			{
+				benchmarkHairMesh.Clear();
+				if (hairBenchmark > 0 && longHairMesh.SegmentCount() > 0)
+				{
+					int copies = (benchmarkSegmentCounts[hairBenchmark] + longHairMesh.SegmentCount() - 1) / longHairMesh.SegmentCount();
+					int columns = int(ceilf(sqrtf(float(copies))));
+					for (int i = 0; i < copies; ++i)
+					{
+						benchmarkHairMesh.AppendStrips(longHairMesh, glm::fvec3(i % columns, 0.0f, i / columns) * 40.0f);
+					}
+					benchmarkHairMesh.SendToGPU();
+				}
+				hairBVH.Refit((hairBenchmark > 0) ? benchmarkHairMesh : longHairMesh); // a new groom size rebuilds
+				hairDensity.Update((hairBenchmark > 0) ? benchmarkHairMesh : longHairMesh);
+				builtHairBenchmark = hairBenchmark;
+			}
+
+			// Only the slices that changed since the last upload
+			if (hairDensity.IsDirty())
+			{
+				hairDensityTexture.Upload(hairDensity.Density().data(), hairDensity.Resolution(), hairDensity.DirtyFirstSlice(), hairDensity.DirtySliceCount());
+				hairDensity.ClearDirty();
+			}
+
+			// Debug features are compiled in only when enabled
+			ShaderDefines hairDefines;
+			bool bCountOverdraw = showOverdraw && bOverdrawSupported;
+			if (renderHairFlat) hairDefines.push_back("FLAT_COLOR");
+			if (hairSelfShadow && !hairDensity.IsEmpty()) hairDefines.push_back("SELF_SHADOW");
+			if (hairSpecular) hairDefines.push_back("MARSCHNER");
+			if (bCountOverdraw) hairDefines.push_back("OVERDRAW");
+			if (drawDebugNormals) hairDefines.push_back("DEBUG_NORMALS");
+			if (bAlphaToCoverage) hairDefines.push_back("ALPHA_TO_COVERAGE");
+			ShaderDefines hairGeometryDefines = hairDefines;
+			if (shapeOverride >= 0 || subdivisionsOverride >= 0) hairGeometryDefines.push_back("OVERRIDES");
+
+			// Blending needs the segments in back to front order, they are drawn one by one from a sorted list
+			bool bBlendHair = hairRenderPath == 0 && sortedBlending && !bAlphaToCoverage;
+			if (bBlendHair) hairGeometryDefines.push_back("BLENDED");
+
+			// The cache is sized for the worst case output, too large for the benchmark grooms
+			bool bUseHairCache = cacheHairGeometry && hairBenchmark == 0 && !bBlendHair;
+
+			// Culling is view dependent, the cache captures the whole groom instead
+			bool bCullHairSegments = hairRenderPath == 0 && !bUseHairCache && !bBlendHair && gpuCulling && bGpuCullingSupported;
+			if (bCullHairSegments) hairGeometryDefines.push_back("CULLED");
+
+			GLProgram* hairShader = &shaderManager.GetProgram(hairShaders, hairGeometryDefines);
+			GLProgram* hairCachedShader = &shaderManager.GetProgram(hairCachedShaders, hairDefines);
+			bool bCullHairCards = hairRenderPath == 1 && gpuCulling && bGpuCullingSupported;
+			ShaderDefines hairCardDefines = hairDefines;
+			if (bCullHairCards) hairCardDefines.push_back("INDIRECT");
+			GLProgram* hairCardShader = &shaderManager.GetProgram(hairCardShaders, hairCardDefines);
+
+			// Hair is culled against the depth of the head, drawn before anything else
+			bool bOcclusionCulling = (bCullHairCards || bCullHairSegments) && occlusionCulling && renderHead;
+			if (bOcclusionCulling)
+			{
+				GLProgram* headDepthShader = &shaderManager.GetProgram(headShaders);
+				drawList.Add(GLDrawList::MakeKey(LAYER_OCCLUDERS, headDepthShader->Id(), 0, headmesh.VertexArray()), [&, headDepthShader]() {
+					hizBuffer.BeginDepthPass();
+					GLState::PolygonMode(scenePolygonMode);
+					headDepthShader->Use();
+					uniformRing.Push(OBJECT_BLOCK_BINDING, ObjectBlock{ headmesh.transform.ModelMatrix() });
+					headmesh.Draw();
+					hizBuffer.EndDepthPass(hizDownsampleShader);
+				});
+			}
+
+			GLBezierStrips* hairMesh = (hairBenchmark > 0) ? &benchmarkHairMesh : &longHairMesh;
+			hairMesh->transform = longHairMesh.transform;
+
+			if (bBlendHair)
+			{
+				// The sort runs in the local space of the hair
+				glm::mat4 inverseModel = glm::inverse(hairMesh->transform.ModelMatrix());
+				glm::fvec3 cameraPosition = glm::fvec3(inverseModel * glm::vec4(camera.GetPosition(), 1.0f));
+				glm::fvec3 viewDirection = glm::normalize(glm::mat3(inverseModel) * camera.ForwardVector());
+				hairMesh->SortSegmentsByDepth(cameraPosition, viewDirection, sortMoveThreshold);
+			}
+
+			auto SetHairGeometryUniforms = [&](GLProgram& program) -> void {
+				const SceneUniformHandles& handles = GetSceneUniformHandles(program);
+				program.SetUniformVec3(handles.capsuleStart, unifiedNormalsCapsuleStart);
+				program.SetUniformVec3(handles.capsuleEnd, unifiedNormalsCapsuleEnd);
+				program.SetUniformFloat(handles.normalBlend, hairUnifiedNormalBlend);
+				program.SetUniformFloat(handles.ribbonDistance, hairRibbonDistance);
+			};
+
+			HairGeometryKey hairKey{
+				shapeOverride, subdivisionsOverride,
+				unifiedNormalsCapsuleStart, unifiedNormalsCapsuleEnd, hairUnifiedNormalBlend,
+				longHairMesh.transform.ModelMatrix(), hairShader->Id(), hairShader->Revision(),
+				hairRibbonDistance,
+				(hairRibbonDistance > 0.0f || shapeOverride == 3) ? camera.GetPosition() : glm::fvec3{ 0.0f }
+			};
+
+			bool bDrawCachedHair = hairRenderPath == 0 && bUseHairCache && longHairCache.IsValid() && hairKey == cachedHairKey;
+
+			GLProgram* hairProgram = (hairRenderPath == 1) ? hairCardShader : (bDrawCachedHair ? hairCachedShader : hairShader);
+			GLuint hairVao = bDrawCachedHair ? longHairCache.VertexArray() : hairMesh->VertexArray();
+
+			// Alpha tested depth first, then the shading only runs for the nearest fragment of each pixel.
+			// Not while the tessellation cache captures, the capture has to see every fragment.
+			GLProgram* hairDepthProgram = nullptr;
+			bool bCaptureHair = hairRenderPath == 0 && bUseHairCache && !bDrawCachedHair;
+			if (hairDepthPrepass && !bCaptureHair && !bBlendHair && !bAlphaToCoverage)
+			{
+				ShaderPermutations& permutations = (hairRenderPath == 1) ? hairCardShaders : (bDrawCachedHair ? hairCachedShaders : hairShaders);
+				ShaderDefines defines = (hairRenderPath == 1) ? hairCardDefines : (bDrawCachedHair ? hairDefines : hairGeometryDefines);
+				// Overdraw counts the shading pass only, the pre-pass would count every fragment a second time
+				ShaderDefines depthDefines = defines;
+				depthDefines.erase(std::remove(depthDefines.begin(), depthDefines.end(), "OVERDRAW"), depthDefines.end());
+				depthDefines.push_back("DEPTH_ONLY");
+				defines.push_back("EQUAL_DEPTH");
+				hairDepthProgram = &shaderManager.GetProgram(permutations, depthDefines);
+				hairProgram = &shaderManager.GetProgram(permutations, defines);
+			}
+
+			// Blended hair is drawn over the finished opaque scene, the head has to be in the depth buffer first
+			drawList.Add(GLDrawList::MakeKey(bBlendHair ? LAYER_TRANSPARENT : LAYER_SCENE, hairProgram->Id(), hairTexture.Id(), hairVao),
+				[&, hairProgram, hairDepthProgram, hairMesh, hairKey, bUseHairCache, bDrawCachedHair, bCullHairCards, bCullHairSegments, bOcclusionCulling, bBlendHair, bAlphaToCoverage, bCountOverdraw, SetHairShadingUniforms, SetHairGeometryUniforms]() {
+				BeginPass(PASS_HAIR);
+				if (hairPipelineQuery) hairPipelineQuery->Begin();
+
+				// Before the hair program is bound, the dispatch uses its own
+				glm::mat4 cullMatrix = cameraBlock.view_projection * hairMesh->transform.ModelMatrix();
+				if (bCullHairCards)
+				{
+					hizBuffer.BindForCulling(hairCullShader, bOcclusionCulling);
+					hairMesh->CullCards(hairCardTemplates, hairCullShader, cullMatrix, shapeOverride, subdivisionsOverride);
+				}
+				else if (bCullHairSegments)
+				{
+					hizBuffer.BindForCulling(hairSegmentCullShader, bOcclusionCulling);
+					hairMesh->CullSegments(hairSegmentCullShader, cullMatrix);
+				}
+				GLState::PolygonMode(scenePolygonMode);
+				hairTexture.UseForDrawing(0);
+				hairDensityTexture.Bind(HAIR_DENSITY_TEXTURE_UNIT);
+				hairShadingTables.Bind();
+				uniformRing.Push(OBJECT_BLOCK_BINDING, ObjectBlock{ hairMesh->transform.ModelMatrix() });
+				if (bCountOverdraw)
+				{
+					overdrawCounter.BeginCounting();
+				}
+
+				// Called twice with the depth pre-pass, the culling results are reused
+				auto DrawHair = [&](GLProgram& program) -> void {
+					program.Use();
+					SetHairShadingUniforms(program);
+
+					if (bCullHairCards)
+					{
+						SetHairGeometryUniforms(program);
+						program.FlushUniforms();
+						hairMesh->DrawCardsIndirect(hairCardTemplates);
+					}
+					else if (hairRenderPath == 1)
+					{
+						SetHairGeometryUniforms(program);
+						hairMesh->DrawCards(hairCardTemplates, program, shapeOverride, subdivisionsOverride);
+					}
+					else if (bDrawCachedHair)
+					{
+						program.FlushUniforms();
+						longHairCache.Draw();
+					}
+					else
+					{
+						SetHairGeometryUniforms(program);
+						const SceneUniformHandles& handles = GetSceneUniformHandles(program);
+						program.SetUniformInt(handles.shapeOverride, shapeOverride);
+						program.SetUniformInt(handles.subdivisionsOverride, subdivisionsOverride);
+						program.FlushUniforms();
+
+						if (bUseHairCache)
+						{
+							longHairCache.BeginCapture(hairMesh->SegmentCount() * GLBezierStrips::MAX_SEGMENT_VERTICES);
+							hairMesh->DrawSegments();
+							longHairCache.EndCapture();
+							cachedHairKey = hairKey;
+						}
+						else if (bCullHairSegments)
+						{
+							hairMesh->DrawVisibleSegments();
+						}
+						else if (bBlendHair)
+						{
+							hairMesh->DrawSortedSegments();
+						}
+						else
+						{
+							hairMesh->DrawSegments();
+						}
+					}
+				};
+
+				// The coverage replaces blending, the alpha only selects samples
+				if (bAlphaToCoverage)
+				{
+					GLState::SetCapability(GL_SAMPLE_ALPHA_TO_COVERAGE, true);
+					GLState::SetCapability(GL_BLEND, false);
+				}
+
+				if (hairDepthProgram)
+				{
+					GLState::ColorMask(false);
+					DrawHair(*hairDepthProgram);
+					GLState::ColorMask(true);
+
+					GLState::DepthFunc(GL_EQUAL);
+					GLState::DepthMask(false);
+					DrawHair(*hairProgram);
+					GLState::DepthFunc(GL_LESS);
+					GLState::DepthMask(true);
+				}
+				else
+				{
+					DrawHair(*hairProgram);
+				}
+
+				if (bAlphaToCoverage)
+				{
+					GLState::SetCapability(GL_SAMPLE_ALPHA_TO_COVERAGE, false);
+					GLState::SetCapability(GL_BLEND, true);
+				}
+				if (bCountOverdraw)
+				{
+					overdrawCounter.EndCounting();
+				}
+				if (hairPipelineQuery) hairPipelineQuery->End();
+				EndPass(PASS_HAIR);
+			});
+
+			// Replaces the scene with the fragment counts, the lines of the overlay stay on top
+			if (bCountOverdraw)
+			{
+				drawList.Add(GLDrawList::MakeKey(LAYER_DEBUG_VIEW, overdrawShader.Id(), 0, backgroundQuad.VertexArray()), [&]() {
+					overdrawCounter.ReadStatistics();
+					GLState::PolygonMode(GL_FILL);
+					GLState::SetCapability(GL_DEPTH_TEST, false);
+					overdrawShader.Use();
+					overdrawShader.SetUniformInt(maxOverdrawHandle, overdrawRange);
+					overdrawShader.SetUniformInt(showDiscardedHandle, overdrawDiscards);
+					overdrawShader.FlushUniforms();
+					overdrawCounter.BindForDisplay();
+					backgroundQuad.Draw();
+					GLState::SetCapability(GL_DEPTH_TEST, true);
+				});
+			}
 		}
 
 		// Grid
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-		grid.Draw(projectionmatrix * viewmatrix);
-		
-		// Clear depth so that we can draw lines on top of everything
-		glClear(GL_DEPTH_BUFFER_BIT);
-		
+		drawList.Add(GLDrawList::MakeKey(LAYER_GRID, 0), [&]() {
+			GLState::PolygonMode(GL_FILL);
+			grid.Draw(cameraBlock.view_projection);
+		});
+
+		// Clear depth so that we can draw lines on top of everything, program 0 sorts it first in the layer
+		drawList.Add(GLDrawList::MakeKey(LAYER_OVERLAY, 0), [&]() {
+			glClear(GL_DEPTH_BUFFER_BIT);
+		});
+
 		// Coordinate axis'
-		lineShader.Use();
-		lineShader.SetUniformFloat("useUniformColor", false);
-		coordinateReferenceLines.Draw();
+		drawList.Add(GLDrawList::MakeKey(LAYER_OVERLAY, lineShader.Id(), 0, coordinateReferenceLines.VertexArray()), [&]() {
+			GLState::PolygonMode(GL_FILL);
+			lineShader.Use();
+			lineShader.SetUniformFloat(useUniformColorHandle, false);
+			lineShader.FlushUniforms();
+			uniformRing.Push(OBJECT_BLOCK_BINDING, ObjectBlock{ glm::mat4{ 1.0f } });
+			coordinateReferenceLines.Draw();
+		});
 
 		if (renderBezierLines)
 		{
-			bezierLinesShader.Use();
-			bezierLinesShader.SetUniformMat4("model", longHairMesh.transform.ModelMatrix());
-			bezierLinesShader.SetUniformInt("subdivisionsOverride", subdivisionsOverride);
-			longHairMesh.Draw();
+			GLProgram* bezierLinesShader = &shaderManager.GetProgram(bezierLinesShaders, (subdivisionsOverride >= 0) ? ShaderDefines{ "OVERRIDES" } : ShaderDefines{});
+			drawList.Add(GLDrawList::MakeKey(LAYER_OVERLAY, bezierLinesShader->Id(), 0, longHairMesh.VertexArray()), [&, bezierLinesShader]() {
+				GLState::PolygonMode(GL_FILL);
+				bezierLinesShader->Use();
+				uniformRing.Push(OBJECT_BLOCK_BINDING, ObjectBlock{ longHairMesh.transform.ModelMatrix() });
+				bezierLinesShader->SetUniformInt(GetSceneUniformHandles(*bezierLinesShader).subdivisionsOverride, subdivisionsOverride);
+				bezierLinesShader->FlushUniforms();
+				longHairMesh.Draw();
+			});
 		}
 
+		std::fill(std::begin(passDrawn), std::end(passDrawn), false);
+		drawList.Submit([&](uint8_t layer) {
+			if (layerPasses[layer] >= 0) BeginPass(layerPasses[layer]);
+		}, [&](uint8_t layer) {
+			if (layerPasses[layer] >= 0) EndPass(layerPasses[layer]);
+		});
+		renderStateStatistics = GLState::ResetStatistics();
+
 		// Done
+		uniformRing.EndFrame();
+		BeginPass(PASS_IMGUI);
 		window.OnImguiUpdate(DrawMainUI);
+		EndPass(PASS_IMGUI);
+		if (logGpuPasses && clock.time - lastGpuPassLog >= 1.0)
+		{
+			LogGpuPasses();
+			lastGpuPassLog = clock.time;
+		}
+		StepPathBenchmark();
 		window.SwapFramebuffer();
 	}
 
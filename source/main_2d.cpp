@@ -14,6 +14,7 @@
 #include "opengl/mesh.h"
 #include "opengl/texture.h"
 #include "opengl/program.h"
+#include "opengl/renderstate.h"
 #include "opengl/screenshot.h"
 #include "opengl/canvas.h"
 #include "core/application.h"
@@ -52,7 +53,7 @@ int main()
 
 	GLuint defaultVao = 0;
 	glGenVertexArrays(1, &defaultVao);
-	glBindVertexArray(defaultVao);
+	GLState::BindVertexArray(defaultVao);
 
 	Canvas2D canvas;
 	canvas.Fill(Color{255, 255, 255, 255});
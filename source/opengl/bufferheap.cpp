@@ -0,0 +1,177 @@
+#include "bufferheap.h"
+#include "glextensions.h"
+#include <algorithm>
+#include <cassert>
+
+static GLsizeiptr AlignSize(GLsizeiptr size)
+{
+	size = std::max<GLsizeiptr>(size, 1);
+	return (size + GLBufferHeap::ALIGNMENT - 1) / GLBufferHeap::ALIGNMENT * GLBufferHeap::ALIGNMENT;
+}
+
+GLBufferHeap::~GLBufferHeap()
+{
+	// Static, destroyed after the context. Pages that Release did not delete go with the process.
+}
+
+void GLBufferHeap::Release()
+{
+	for (Page& page : pages)
+	{
+		if (page.buffer) glDeleteBuffers(1, &page.buffer);
+	}
+	pages.clear();
+	statistics = Statistics{};
+}
+
+GLBufferAllocation GLBufferHeap::Allocate(GLsizeiptr size)
+{
+	GLsizeiptr alignedSize = AlignSize(size);
+	bool bDedicated = alignedSize > PAGE_SIZE / 2;
+
+	int pageIndex = -1;
+	OffsetAllocator::Allocation range;
+	if (!bDedicated)
+	{
+		for (int i = 0; i < int(pages.size()) && !range.IsValid(); ++i)
+		{
+			Page& page = pages[i];
+			if (!page.allocator || page.bDedicated) continue;
+
+			range = page.allocator->Allocate(uint32_t(alignedSize));
+			pageIndex = i;
+		}
+	}
+
+	if (!range.IsValid())
+	{
+		pageIndex = CreatePage(bDedicated ? alignedSize : PAGE_SIZE, bDedicated);
+		range = pages[pageIndex].allocator->Allocate(uint32_t(alignedSize));
+		assert(range.IsValid());
+	}
+
+	statistics.allocations++;
+	statistics.usedBytes += alignedSize;
+
+	GLBufferAllocation allocation;
+	allocation.buffer = pages[pageIndex].buffer;
+	allocation.offset = range.offset;
+	allocation.size = alignedSize;
+	allocation.page = pageIndex;
+	allocation.range = range;
+	return allocation;
+}
+
+void GLBufferHeap::Free(GLBufferAllocation& allocation)
+{
+	if (!allocation.IsValid() || allocation.page >= int(pages.size()))
+	{
+		allocation = GLBufferAllocation{};
+		return; // released with the heap
+	}
+
+	Page& page = pages[allocation.page];
+	page.allocator->Free(allocation.range);
+	statistics.allocations--;
+	statistics.usedBytes -= allocation.size;
+
+	if (page.bDedicated)
+	{
+		statistics.pages--;
+		statistics.reservedBytes -= page.allocator->Size();
+		glDeleteBuffers(1, &page.buffer);
+		page.buffer = 0;
+		page.allocator.reset();
+	}
+
+	allocation = GLBufferAllocation{};
+}
+
+bool GLBufferHeap::Upload(GLBufferAllocation& allocation, const void* data, GLsizeiptr numbytes)
+{
+	GLsizeiptr required = AlignSize(numbytes);
+
+	// Old ranges are reused by later allocations, the GL orders the uploads after the draws that read them
+	bool bMove = !allocation.IsValid() || allocation.size < required || allocation.size > required * 4;
+	if (bMove)
+	{
+		Free(allocation);
+		allocation = Allocate(required);
+	}
+
+	if (numbytes > 0 && data)
+	{
+		if (HasDirectStateAccess())
+		{
+			glNamedBufferSubData(allocation.buffer, allocation.offset, numbytes, data);
+		}
+		else
+		{
+			// The copy target is not vao state, binding it never changes a mesh
+			glBindBuffer(GL_COPY_WRITE_BUFFER, allocation.buffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.offset, numbytes, data);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+	}
+	return bMove;
+}
+
+GLBufferHeap::Statistics GLBufferHeap::GetStatistics() const
+{
+	return statistics;
+}
+
+int GLBufferHeap::CreatePage(GLsizeiptr size, bool bDedicated)
+{
+	GLuint buffer = 0;
+	if (HasDirectStateAccess())
+	{
+		glCreateBuffers(1, &buffer);
+		glNamedBufferStorage(buffer, size, NULL, GL_DYNAMIC_STORAGE_BIT);
+	}
+	else
+	{
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		if (HasBufferStorage())
+		{
+			glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, GL_DYNAMIC_STORAGE_BIT);
+		}
+		else
+		{
+			glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	statistics.pages++;
+	statistics.reservedBytes += size;
+
+	// Reuse the slot of a released dedicated page, allocations store the page index
+	int pageIndex = -1;
+	for (int i = 0; i < int(pages.size()); ++i)
+	{
+		if (!pages[i].allocator)
+		{
+			pageIndex = i;
+			break;
+		}
+	}
+	if (pageIndex < 0)
+	{
+		pages.emplace_back();
+		pageIndex = int(pages.size() - 1);
+	}
+
+	Page& page = pages[pageIndex];
+	page.buffer = buffer;
+	page.allocator = std::make_unique<OffsetAllocator>(uint32_t(size));
+	page.bDedicated = bDedicated;
+	return pageIndex;
+}
+
+GLBufferHeap& GetBufferHeap()
+{
+	static GLBufferHeap heap;
+	return heap;
+}
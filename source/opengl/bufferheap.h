@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "glad/glad.h"
+#include "../core/offsetallocator.h"
+
+/*
+	A range in one of the GLBufferHeap buffers. Meshes keep one per vertex attribute and
+	index array, their vao points at buffer + offset.
+*/
+struct GLBufferAllocation
+{
+	GLuint buffer = 0;
+	GLintptr offset = 0;
+	GLsizeiptr size = 0; // capacity, can be larger than the last upload
+	int page = -1;
+	OffsetAllocator::Allocation range;
+
+	bool IsValid() const { return page >= 0; }
+};
+
+/*
+	Vertex and index data of all meshes, sub-allocated from a few large immutable buffers
+	instead of one buffer object per array that is reallocated by every SendToGPU.
+
+	Pages are created with glBufferStorage (through DSA when available) and only written
+	with sub data uploads, so the driver never has to reallocate or rename them. Ranges
+	are handed out by an OffsetAllocator per page. Arrays larger than half a page, like
+	the benchmark grooms, get a dedicated page that is released with them.
+*/
+class GLBufferHeap
+{
+public:
+	static const GLsizeiptr PAGE_SIZE = 32 * 1024 * 1024;
+	static const GLsizeiptr ALIGNMENT = 16; // covers every vertex attribute and index type
+
+	struct Statistics
+	{
+		int pages = 0;
+		int allocations = 0;
+		GLsizeiptr reservedBytes = 0;
+		GLsizeiptr usedBytes = 0;
+	};
+
+	GLBufferHeap() {}
+	GLBufferHeap(const GLBufferHeap&) = delete;
+	~GLBufferHeap();
+
+	GLBufferAllocation Allocate(GLsizeiptr size);
+	void Free(GLBufferAllocation& allocation);
+
+	// Deletes every page while the context is still current, called by OpenGLWindow before it
+	// destroys the context. Allocations freed afterwards are ignored.
+	void Release();
+
+	// Writes numbytes to the start of the allocation. It is moved to a new range first when
+	// it is too small or much larger than needed, returns true in that case.
+	bool Upload(GLBufferAllocation& allocation, const void* data, GLsizeiptr numbytes);
+
+	Statistics GetStatistics() const;
+
+private:
+	struct Page
+	{
+		GLuint buffer = 0;
+		std::unique_ptr<OffsetAllocator> allocator; // null for released dedicated pages
+		bool bDedicated = false;
+	};
+
+	std::vector<Page> pages;
+	Statistics statistics;
+
+	int CreatePage(GLsizeiptr size, bool bDedicated);
+};
+
+// Shared by all meshes, created on first use (after the GL context) and released with the window
+GLBufferHeap& GetBufferHeap();
@@ -0,0 +1,47 @@
+#include "drawlist.h"
+#include <algorithm>
+
+/*
+	Key layout, most significant first:
+		 8 bits layer
+		16 bits program
+		20 bits texture
+		20 bits vao
+	GL names are small sequential integers, truncating them only affects grouping.
+*/
+uint64_t GLDrawList::MakeKey(uint8_t layer, GLuint programId, GLuint textureId, GLuint vao)
+{
+	return (uint64_t(layer) << 56)
+		| (uint64_t(programId & 0xFFFF) << 40)
+		| (uint64_t(textureId & 0xFFFFF) << 20)
+		| uint64_t(vao & 0xFFFFF);
+}
+
+void GLDrawList::Add(uint64_t key, DrawFunction draw)
+{
+	commands.push_back(Command{ key, std::move(draw) });
+}
+
+void GLDrawList::Submit(LayerFunction beginLayer, LayerFunction endLayer)
+{
+	std::stable_sort(commands.begin(), commands.end(), [](const Command& a, const Command& b) {
+		return a.key < b.key;
+	});
+
+	for (size_t i = 0; i < commands.size(); ++i)
+	{
+		uint8_t layer = uint8_t(commands[i].key >> 56);
+		if (beginLayer && (i == 0 || uint8_t(commands[i - 1].key >> 56) != layer))
+		{
+			beginLayer(layer);
+		}
+
+		commands[i].draw();
+
+		if (endLayer && (i + 1 == commands.size() || uint8_t(commands[i + 1].key >> 56) != layer))
+		{
+			endLayer(layer);
+		}
+	}
+	commands.clear();
+}
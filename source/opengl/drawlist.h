@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include "glad/glad.h"
+
+/*
+	Draws recorded during the frame and submitted together, sorted by a key made of
+	layer | program | texture | vao. Sorting groups draws that share state so the calls
+	issued through GLState are mostly skipped. The layer keeps passes that depend on each
+	other in order (background, scene, overlays), draws with equal keys keep their
+	recording order.
+*/
+class GLDrawList
+{
+public:
+	typedef std::function<void()> DrawFunction;
+	typedef std::function<void(uint8_t layer)> LayerFunction;
+
+	struct Command
+	{
+		uint64_t key = 0;
+		DrawFunction draw;
+	};
+
+	static uint64_t MakeKey(uint8_t layer, GLuint programId, GLuint textureId = 0, GLuint vao = 0);
+
+	void Add(uint64_t key, DrawFunction draw);
+
+	// beginLayer and endLayer are called around the commands of every layer that has any,
+	// for work that spans a whole layer like a timer query
+	void Submit(LayerFunction beginLayer = nullptr, LayerFunction endLayer = nullptr);
+
+	size_t Size() const { return commands.size(); }
+
+private:
+	std::vector<Command> commands;
+};
@@ -0,0 +1,79 @@
+#include "framebuffer.h"
+#include <algorithm>
+#include <iostream>
+
+GLMultisampleFramebuffer::GLMultisampleFramebuffer(int width, int height)
+	: width{ width }, height{ height }
+{
+}
+
+GLMultisampleFramebuffer::~GLMultisampleFramebuffer()
+{
+	Release();
+}
+
+void GLMultisampleFramebuffer::Release()
+{
+	if (framebuffer)
+	{
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteRenderbuffers(1, &colorBuffer);
+		glDeleteRenderbuffers(1, &depthBuffer);
+	}
+	framebuffer = colorBuffer = depthBuffer = 0;
+	samples = 0;
+}
+
+void GLMultisampleFramebuffer::SetSamples(int count)
+{
+	GLint maxSamples = 0;
+	glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+	count = std::min(count, int(maxSamples));
+	if (count == samples || (count <= 1 && samples == 0))
+	{
+		return;
+	}
+
+	Release();
+	if (count <= 1)
+	{
+		return;
+	}
+
+	glGenRenderbuffers(1, &colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, count, GL_RGBA8, width, height);
+
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, count, GL_DEPTH24_STENCIL8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "Multisample framebuffer with " << count << " samples is incomplete (0x" << std::hex << status << std::dec << ")" << std::endl;
+		Release();
+		return;
+	}
+	samples = count;
+}
+
+void GLMultisampleFramebuffer::Bind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void GLMultisampleFramebuffer::Resolve()
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
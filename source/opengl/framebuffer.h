@@ -0,0 +1,38 @@
+#pragma once
+#include "glad/glad.h"
+
+/*
+	Multisampled color and depth target for the scene. Draws between Bind and Resolve
+	go to the samples, Resolve blits the averaged color into the default framebuffer.
+
+	Used with alpha to coverage for the hair, where the alpha of a fragment selects how
+	many samples it covers instead of a hard alpha test.
+*/
+class GLMultisampleFramebuffer
+{
+protected:
+	GLuint framebuffer = 0;
+	GLuint colorBuffer = 0;
+	GLuint depthBuffer = 0;
+	int width = 0;
+	int height = 0;
+	int samples = 0;
+
+	void Release();
+
+public:
+	GLMultisampleFramebuffer(int width, int height);
+	~GLMultisampleFramebuffer();
+
+	GLMultisampleFramebuffer(const GLMultisampleFramebuffer& other) = delete;
+
+	// Recreates the buffers when the count changes, clamped to GL_MAX_SAMPLES. 0 or 1 releases them.
+	void SetSamples(int count);
+	int Samples() const { return samples; }
+	bool IsValid() const { return framebuffer != 0; }
+
+	void Bind();
+
+	// Averages the samples into the default framebuffer and binds it
+	void Resolve();
+};
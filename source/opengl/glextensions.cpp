@@ -0,0 +1,155 @@
+#include "glextensions.h"
+#include <cstring>
+
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage = NULL;
+PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary = NULL;
+PFNGLPROGRAMBINARYPROC glad_glProgramBinary = NULL;
+PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri = NULL;
+PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR = NULL;
+PFNGLCREATEBUFFERSPROC glad_glCreateBuffers = NULL;
+PFNGLNAMEDBUFFERSTORAGEPROC glad_glNamedBufferStorage = NULL;
+PFNGLNAMEDBUFFERSUBDATAPROC glad_glNamedBufferSubData = NULL;
+PFNGLDISPATCHCOMPUTEPROC glad_glDispatchCompute = NULL;
+PFNGLMEMORYBARRIERPROC glad_glMemoryBarrier = NULL;
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect = NULL;
+PFNGLDRAWARRAYSINDIRECTPROC glad_glDrawArraysIndirect = NULL;
+PFNGLBINDIMAGETEXTUREPROC glad_glBindImageTexture = NULL;
+PFNGLGENTRANSFORMFEEDBACKSPROC glad_glGenTransformFeedbacks = NULL;
+PFNGLDELETETRANSFORMFEEDBACKSPROC glad_glDeleteTransformFeedbacks = NULL;
+PFNGLBINDTRANSFORMFEEDBACKPROC glad_glBindTransformFeedback = NULL;
+PFNGLDRAWTRANSFORMFEEDBACKPROC glad_glDrawTransformFeedback = NULL;
+
+// Resolved once in LoadGLExtensions, the Has* functions are called every frame
+static bool bHasBufferStorage = false;
+static bool bHasProgramBinary = false;
+static bool bHasParallelShaderCompile = false;
+static bool bHasDirectStateAccess = false;
+static bool bHasComputeShader = false;
+static bool bHasMultiDrawIndirect = false;
+static bool bHasPipelineStatistics = false;
+static bool bHasTransformFeedbackObjects = false;
+
+void LoadGLExtensions(GLADloadproc load)
+{
+	glad_glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+	glad_glGetProgramBinary = (PFNGLGETPROGRAMBINARYPROC)load("glGetProgramBinary");
+	glad_glProgramBinary = (PFNGLPROGRAMBINARYPROC)load("glProgramBinary");
+	glad_glProgramParameteri = (PFNGLPROGRAMPARAMETERIPROC)load("glProgramParameteri");
+
+	// KHR and ARB variants share the enum and signature
+	glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsKHR");
+	if (!glad_glMaxShaderCompilerThreadsKHR)
+	{
+		glad_glMaxShaderCompilerThreadsKHR = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)load("glMaxShaderCompilerThreadsARB");
+	}
+
+	glad_glCreateBuffers = (PFNGLCREATEBUFFERSPROC)load("glCreateBuffers");
+	glad_glNamedBufferStorage = (PFNGLNAMEDBUFFERSTORAGEPROC)load("glNamedBufferStorage");
+	glad_glNamedBufferSubData = (PFNGLNAMEDBUFFERSUBDATAPROC)load("glNamedBufferSubData");
+	glad_glDispatchCompute = (PFNGLDISPATCHCOMPUTEPROC)load("glDispatchCompute");
+	glad_glMemoryBarrier = (PFNGLMEMORYBARRIERPROC)load("glMemoryBarrier");
+	glad_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)load("glMultiDrawElementsIndirect");
+	glad_glDrawArraysIndirect = (PFNGLDRAWARRAYSINDIRECTPROC)load("glDrawArraysIndirect");
+	glad_glBindImageTexture = (PFNGLBINDIMAGETEXTUREPROC)load("glBindImageTexture");
+	glad_glGenTransformFeedbacks = (PFNGLGENTRANSFORMFEEDBACKSPROC)load("glGenTransformFeedbacks");
+	glad_glDeleteTransformFeedbacks = (PFNGLDELETETRANSFORMFEEDBACKSPROC)load("glDeleteTransformFeedbacks");
+	glad_glBindTransformFeedback = (PFNGLBINDTRANSFORMFEEDBACKPROC)load("glBindTransformFeedback");
+	glad_glDrawTransformFeedback = (PFNGLDRAWTRANSFORMFEEDBACKPROC)load("glDrawTransformFeedback");
+
+	bHasBufferStorage = glBufferStorage && (HasGLVersion(4, 4) || HasGLExtension("GL_ARB_buffer_storage"));
+
+	bHasProgramBinary = glGetProgramBinary && glProgramBinary && glProgramParameteri &&
+		(HasGLVersion(4, 1) || HasGLExtension("GL_ARB_get_program_binary"));
+	if (bHasProgramBinary)
+	{
+		// Drivers may support the extension without offering any binary format
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		bHasProgramBinary = formats > 0;
+	}
+
+	// Named buffer storage also needs buffer storage itself
+	bHasDirectStateAccess = glCreateBuffers && glNamedBufferStorage && glNamedBufferSubData && bHasBufferStorage &&
+		(HasGLVersion(4, 5) || HasGLExtension("GL_ARB_direct_state_access"));
+
+	bHasComputeShader = glDispatchCompute && glMemoryBarrier && glBindImageTexture && (HasGLVersion(4, 3) ||
+		(HasGLExtension("GL_ARB_compute_shader") && HasGLExtension("GL_ARB_shader_storage_buffer_object") &&
+		HasGLExtension("GL_ARB_shader_image_load_store")));
+
+	// Indirect commands carry a base instance, which needs ARB_base_instance on older drivers
+	bHasMultiDrawIndirect = glMultiDrawElementsIndirect && glDrawArraysIndirect && (HasGLVersion(4, 3) ||
+		(HasGLExtension("GL_ARB_multi_draw_indirect") && HasGLExtension("GL_ARB_base_instance")));
+
+	// Only new query targets, the query functions are core
+	bHasPipelineStatistics = HasGLVersion(4, 6) || HasGLExtension("GL_ARB_pipeline_statistics_query");
+
+	bHasTransformFeedbackObjects = glGenTransformFeedbacks && glDeleteTransformFeedbacks && glBindTransformFeedback &&
+		glDrawTransformFeedback && (HasGLVersion(4, 0) || HasGLExtension("GL_ARB_transform_feedback2"));
+
+	bHasParallelShaderCompile = glMaxShaderCompilerThreadsKHR &&
+		(HasGLExtension("GL_KHR_parallel_shader_compile") || HasGLExtension("GL_ARB_parallel_shader_compile"));
+	if (bHasParallelShaderCompile)
+	{
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF); // let the driver pick the thread count
+	}
+}
+
+bool HasGLVersion(int major, int minor)
+{
+	return GLVersion.major > major || (GLVersion.major == major && GLVersion.minor >= minor);
+}
+
+bool HasGLExtension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i)
+	{
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool HasBufferStorage()
+{
+	return bHasBufferStorage;
+}
+
+bool HasProgramBinary()
+{
+	return bHasProgramBinary;
+}
+
+bool HasParallelShaderCompile()
+{
+	return bHasParallelShaderCompile;
+}
+
+bool HasDirectStateAccess()
+{
+	return bHasDirectStateAccess;
+}
+
+bool HasComputeShader()
+{
+	return bHasComputeShader;
+}
+
+bool HasMultiDrawIndirect()
+{
+	return bHasMultiDrawIndirect;
+}
+
+bool HasPipelineStatistics()
+{
+	return bHasPipelineStatistics;
+}
+
+bool HasTransformFeedbackObjects()
+{
+	return bHasTransformFeedbackObjects;
+}
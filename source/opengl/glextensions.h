@@ -0,0 +1,128 @@
+#pragma once
+#include "glad/glad.h"
+
+/*
+	OpenGL 4.x entry points that are not part of the bundled glad loader (generated for 3.3 core).
+
+	They follow the glad naming so that call sites look like any other gl call. The pointers
+	are NULL when the driver does not expose them, check the matching Has* function before use.
+*/
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+extern PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
+#define glBufferStorage glad_glBufferStorage
+
+// GL 4.1 / ARB_get_program_binary
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS 0x87FF
+#endif
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+extern PFNGLGETPROGRAMBINARYPROC glad_glGetProgramBinary;
+extern PFNGLPROGRAMBINARYPROC glad_glProgramBinary;
+extern PFNGLPROGRAMPARAMETERIPROC glad_glProgramParameteri;
+#define glGetProgramBinary glad_glGetProgramBinary
+#define glProgramBinary glad_glProgramBinary
+#define glProgramParameteri glad_glProgramParameteri
+
+// KHR_parallel_shader_compile / ARB_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+extern PFNGLMAXSHADERCOMPILERTHREADSKHRPROC glad_glMaxShaderCompilerThreadsKHR;
+#define glMaxShaderCompilerThreadsKHR glad_glMaxShaderCompilerThreadsKHR
+
+// GL 4.5 / ARB_direct_state_access, only the buffer functions
+typedef void (APIENTRYP PFNGLCREATEBUFFERSPROC)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRYP PFNGLNAMEDBUFFERSTORAGEPROC)(GLuint buffer, GLsizeiptr size, const void* data, GLbitfield flags);
+typedef void (APIENTRYP PFNGLNAMEDBUFFERSUBDATAPROC)(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data);
+extern PFNGLCREATEBUFFERSPROC glad_glCreateBuffers;
+extern PFNGLNAMEDBUFFERSTORAGEPROC glad_glNamedBufferStorage;
+extern PFNGLNAMEDBUFFERSUBDATAPROC glad_glNamedBufferSubData;
+#define glCreateBuffers glad_glCreateBuffers
+#define glNamedBufferStorage glad_glNamedBufferStorage
+#define glNamedBufferSubData glad_glNamedBufferSubData
+
+// GL 4.3 / ARB_compute_shader, ARB_shader_storage_buffer_object, ARB_multi_draw_indirect
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#define GL_TEXTURE_FETCH_BARRIER_BIT 0x00000008
+#define GL_SHADER_IMAGE_ACCESS_BARRIER_BIT 0x00000020
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#define GL_TEXTURE_UPDATE_BARRIER_BIT 0x00000100
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+typedef void (APIENTRYP PFNGLDISPATCHCOMPUTEPROC)(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
+typedef void (APIENTRYP PFNGLMEMORYBARRIERPROC)(GLbitfield barriers);
+typedef void (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC)(GLenum mode, GLenum type, const void* indirect, GLsizei drawcount, GLsizei stride);
+extern PFNGLDISPATCHCOMPUTEPROC glad_glDispatchCompute;
+extern PFNGLMEMORYBARRIERPROC glad_glMemoryBarrier;
+extern PFNGLMULTIDRAWELEMENTSINDIRECTPROC glad_glMultiDrawElementsIndirect;
+#define glDispatchCompute glad_glDispatchCompute
+#define glMemoryBarrier glad_glMemoryBarrier
+#define glMultiDrawElementsIndirect glad_glMultiDrawElementsIndirect
+
+// GL 4.0 / ARB_draw_indirect and GL 4.2 / ARB_shader_image_load_store, both part of GL 4.3
+typedef void (APIENTRYP PFNGLDRAWARRAYSINDIRECTPROC)(GLenum mode, const void* indirect);
+typedef void (APIENTRYP PFNGLBINDIMAGETEXTUREPROC)(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+extern PFNGLDRAWARRAYSINDIRECTPROC glad_glDrawArraysIndirect;
+extern PFNGLBINDIMAGETEXTUREPROC glad_glBindImageTexture;
+#define glDrawArraysIndirect glad_glDrawArraysIndirect
+#define glBindImageTexture glad_glBindImageTexture
+
+// GL 4.0 / ARB_transform_feedback2
+#ifndef GL_TRANSFORM_FEEDBACK
+#define GL_TRANSFORM_FEEDBACK 0x8E22
+#endif
+typedef void (APIENTRYP PFNGLGENTRANSFORMFEEDBACKSPROC)(GLsizei n, GLuint* ids);
+typedef void (APIENTRYP PFNGLDELETETRANSFORMFEEDBACKSPROC)(GLsizei n, const GLuint* ids);
+typedef void (APIENTRYP PFNGLBINDTRANSFORMFEEDBACKPROC)(GLenum target, GLuint id);
+typedef void (APIENTRYP PFNGLDRAWTRANSFORMFEEDBACKPROC)(GLenum mode, GLuint id);
+extern PFNGLGENTRANSFORMFEEDBACKSPROC glad_glGenTransformFeedbacks;
+extern PFNGLDELETETRANSFORMFEEDBACKSPROC glad_glDeleteTransformFeedbacks;
+extern PFNGLBINDTRANSFORMFEEDBACKPROC glad_glBindTransformFeedback;
+extern PFNGLDRAWTRANSFORMFEEDBACKPROC glad_glDrawTransformFeedback;
+#define glGenTransformFeedbacks glad_glGenTransformFeedbacks
+#define glDeleteTransformFeedbacks glad_glDeleteTransformFeedbacks
+#define glBindTransformFeedback glad_glBindTransformFeedback
+#define glDrawTransformFeedback glad_glDrawTransformFeedback
+
+// GL 4.6 / ARB_pipeline_statistics_query, GL_GEOMETRY_SHADER_INVOCATIONS is from GL 4.0
+#ifndef GL_GEOMETRY_SHADER_INVOCATIONS
+#define GL_GEOMETRY_SHADER_INVOCATIONS 0x887F
+#endif
+#ifndef GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED
+#define GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED 0x82F3
+#define GL_FRAGMENT_SHADER_INVOCATIONS 0x82F4
+#endif
+
+// Call once after gladLoadGLLoader with the same loader function
+void LoadGLExtensions(GLADloadproc load);
+
+bool HasGLVersion(int major, int minor);
+bool HasGLExtension(const char* name);
+
+bool HasBufferStorage();
+bool HasProgramBinary();
+bool HasParallelShaderCompile();
+bool HasDirectStateAccess();
+bool HasComputeShader(); // includes shader storage buffers, image load/store and glMemoryBarrier
+bool HasMultiDrawIndirect(); // includes glDrawArraysIndirect
+bool HasPipelineStatistics();
+bool HasTransformFeedbackObjects(); // includes glDrawTransformFeedback
@@ -0,0 +1,129 @@
+#include "hairshading.h"
+#include "renderstate.h"
+#include "../core/utilities.h"
+#include <chrono>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+// Bumped whenever the baking or the file layout changes
+static const uint32_t CACHE_VERSION = 2;
+static const uint32_t CACHE_MAGIC = 0x5455484D; // "MHUT"
+
+static void CreateTable(GLuint textureId, const std::vector<float>& texels, int size)
+{
+	GLState::BindTexture(0, GL_TEXTURE_2D, textureId);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, size, size, 0, GL_RGBA, GL_FLOAT, texels.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+GLHairShadingTables::GLHairShadingTables(fs::path cacheFolder)
+	: cacheFolder{ cacheFolder }
+{
+	glGenTextures(1, &longitudinalTexture);
+	glGenTextures(1, &azimuthalTexture);
+}
+
+GLHairShadingTables::~GLHairShadingTables()
+{
+	GLState::ForgetTexture(longitudinalTexture);
+	GLState::ForgetTexture(azimuthalTexture);
+	glDeleteTextures(1, &longitudinalTexture);
+	glDeleteTextures(1, &azimuthalTexture);
+}
+
+void GLHairShadingTables::Build(const Marschner::Parameters& parameters)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// One file, new parameters overwrite it instead of adding a file per slider value
+	const int tableSize = TABLE_SIZE;
+	uint64_t key = HashBytes(&CACHE_VERSION, sizeof(CACHE_VERSION));
+	key = HashBytes(&tableSize, sizeof(tableSize), key);
+	fs::path cacheFile = cacheFolder.empty() ? fs::path{} : cacheFolder / (HashToHex(key) + ".lut");
+
+	std::vector<float> longitudinal, azimuthal;
+	bLoadedFromCache = !cacheFile.empty() && LoadCache(cacheFile, parameters, longitudinal, azimuthal);
+	if (!bLoadedFromCache)
+	{
+		longitudinal = Marschner::BakeLongitudinal(parameters, TABLE_SIZE);
+		azimuthal = Marschner::BakeAzimuthal(parameters, TABLE_SIZE);
+		if (!cacheFile.empty())
+		{
+			SaveCache(cacheFile, parameters, longitudinal, azimuthal);
+		}
+	}
+
+	CreateTable(longitudinalTexture, longitudinal, TABLE_SIZE);
+	CreateTable(azimuthalTexture, azimuthal, TABLE_SIZE);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	buildMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void GLHairShadingTables::Bind()
+{
+	GLState::BindTexture(LONGITUDINAL_TEXTURE_UNIT, GL_TEXTURE_2D, longitudinalTexture);
+	GLState::BindTexture(AZIMUTHAL_TEXTURE_UNIT, GL_TEXTURE_2D, azimuthalTexture);
+}
+
+bool GLHairShadingTables::LoadCache(fs::path cacheFile, const Marschner::Parameters& parameters, std::vector<float>& longitudinal, std::vector<float>& azimuthal)
+{
+	std::vector<char> data;
+	if (!LoadBinary(cacheFile, data))
+	{
+		return false;
+	}
+
+	// File layout: magic, table size, the parameters, then the longitudinal and azimuthal texels
+	const size_t headerBytes = 8 + sizeof(Marschner::Parameters);
+	uint32_t magic = 0, size = 0;
+	if (data.size() < headerBytes)
+	{
+		return false;
+	}
+	memcpy(&magic, data.data(), 4);
+	memcpy(&size, data.data() + 4, 4);
+
+	size_t tableBytes = size_t(TABLE_SIZE) * TABLE_SIZE * 4 * sizeof(float);
+	if (magic != CACHE_MAGIC || size != uint32_t(TABLE_SIZE) || data.size() != headerBytes + 2 * tableBytes)
+	{
+		return false;
+	}
+
+	// The tables were baked for other parameters, the caller bakes and overwrites the file
+	if (memcmp(data.data() + 8, &parameters, sizeof(parameters)) != 0) // only floats, no padding
+	{
+		return false;
+	}
+
+	longitudinal.resize(tableBytes / sizeof(float));
+	azimuthal.resize(tableBytes / sizeof(float));
+	memcpy(longitudinal.data(), data.data() + headerBytes, tableBytes);
+	memcpy(azimuthal.data(), data.data() + headerBytes + tableBytes, tableBytes);
+	return true;
+}
+
+void GLHairShadingTables::SaveCache(fs::path cacheFile, const Marschner::Parameters& parameters, const std::vector<float>& longitudinal, const std::vector<float>& azimuthal)
+{
+	std::vector<char> data;
+	auto Write = [&](const void* source, size_t size) -> void {
+		const char* bytes = (const char*)source;
+		data.insert(data.end(), bytes, bytes + size);
+	};
+
+	uint32_t size = uint32_t(TABLE_SIZE);
+	Write(&CACHE_MAGIC, 4);
+	Write(&size, 4);
+	Write(&parameters, sizeof(parameters));
+	Write(longitudinal.data(), longitudinal.size() * sizeof(float));
+	Write(azimuthal.data(), azimuthal.size() * sizeof(float));
+	if (!SaveBinary(cacheFile, data.data(), data.size()))
+	{
+		wprintf(L"\r\nFailed to write shading table cache: %Ls\r\n", cacheFile.c_str());
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include "glad/glad.h"
+#include "../core/marschner.h"
+
+/*
+	The two Marschner lookup tables of hair_fragment.glsl (MARSCHNER) as RGBA16F textures.
+	Baking the azimuthal table integrates every path through the fiber cross section for
+	each texel, so both tables are cached on disk. There is one cache file, the parameters
+	are stored in it and a change of them rebakes and overwrites it.
+*/
+class GLHairShadingTables
+{
+protected:
+	GLuint longitudinalTexture = 0;
+	GLuint azimuthalTexture = 0;
+	std::filesystem::path cacheFolder;
+
+	bool LoadCache(std::filesystem::path cacheFile, const Marschner::Parameters& parameters, std::vector<float>& longitudinal, std::vector<float>& azimuthal);
+	void SaveCache(std::filesystem::path cacheFile, const Marschner::Parameters& parameters, const std::vector<float>& longitudinal, const std::vector<float>& azimuthal);
+
+public:
+	static const int TABLE_SIZE = 64;
+	static const GLuint LONGITUDINAL_TEXTURE_UNIT = 10;
+	static const GLuint AZIMUTHAL_TEXTURE_UNIT = 11;
+
+	double buildMilliseconds = 0.0;
+	bool bLoadedFromCache = false;
+
+	// An empty cacheFolder disables the disk cache
+	GLHairShadingTables(std::filesystem::path cacheFolder);
+	~GLHairShadingTables();
+
+	GLHairShadingTables(const GLHairShadingTables& other) = delete;
+
+	// Loads or bakes the tables for the parameters and uploads them
+	void Build(const Marschner::Parameters& parameters);
+
+	void Bind();
+};
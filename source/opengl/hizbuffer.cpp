@@ -0,0 +1,95 @@
+#include "hizbuffer.h"
+#include "program.h"
+#include "renderstate.h"
+#include "glextensions.h"
+#include <algorithm>
+
+GLHiZBuffer::GLHiZBuffer(int width, int height)
+	: width{ width }, height{ height }
+{
+	glGenTextures(1, &depthTexture);
+	GLState::BindTexture(0, GL_TEXTURE_2D, depthTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+	// Sizes are rounded up, the downsample clamps its reads at odd edges
+	glGenTextures(1, &hizTexture);
+	GLState::BindTexture(0, GL_TEXTURE_2D, hizTexture);
+	int levelWidth = std::max((width + 1) / 2, 1);
+	int levelHeight = std::max((height + 1) / 2, 1);
+	for (levels = 0; ; ++levels)
+	{
+		glTexImage2D(GL_TEXTURE_2D, levels, GL_R32F, levelWidth, levelHeight, 0, GL_RED, GL_FLOAT, NULL);
+		if (levelWidth == 1 && levelHeight == 1)
+		{
+			break;
+		}
+		levelWidth = std::max((levelWidth + 1) / 2, 1);
+		levelHeight = std::max((levelHeight + 1) / 2, 1);
+	}
+	levels++;
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+GLHiZBuffer::~GLHiZBuffer()
+{
+	GLState::ForgetTexture(depthTexture);
+	GLState::ForgetTexture(hizTexture);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteTextures(1, &depthTexture);
+	glDeleteTextures(1, &hizTexture);
+}
+
+void GLHiZBuffer::BeginDepthPass()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glViewport(0, 0, width, height);
+	glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void GLHiZBuffer::EndDepthPass(GLProgram& downsampleProgram)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+
+	downsampleProgram.Use();
+	UniformHandle sourceLevelHandle = downsampleProgram.GetUniformHandle("sourceLevel");
+
+	int levelWidth = width;
+	int levelHeight = height;
+	for (int level = 0; level < levels; ++level)
+	{
+		// Level 0 reads the depth buffer, the others the level before them in the same texture
+		GLState::BindTexture(0, GL_TEXTURE_2D, (level == 0) ? depthTexture : hizTexture);
+		downsampleProgram.SetUniformInt(sourceLevelHandle, (level == 0) ? 0 : level - 1);
+		downsampleProgram.FlushUniforms();
+		glBindImageTexture(0, hizTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+		levelWidth = std::max((levelWidth + 1) / 2, 1);
+		levelHeight = std::max((levelHeight + 1) / 2, 1);
+		glDispatchCompute(GLuint((levelWidth + 7) / 8), GLuint((levelHeight + 7) / 8), 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+}
+
+void GLHiZBuffer::BindForCulling(GLProgram& cullProgram, bool bEnabled)
+{
+	GLState::BindTexture(HIZ_TEXTURE_UNIT, GL_TEXTURE_2D, hizTexture);
+	cullProgram.SetUniformInt("occlusionCulling", bEnabled ? 1 : 0);
+	cullProgram.SetUniformInt("hizLevels", levels);
+	cullProgram.SetUniformInt("depthWidth", width);
+	cullProgram.SetUniformInt("depthHeight", height);
+}
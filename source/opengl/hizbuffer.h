@@ -0,0 +1,44 @@
+#pragma once
+#include "glad/glad.h"
+
+/*
+	Hierarchical depth (Hi-Z) buffer for occlusion culling.
+
+	Occluders are drawn into a depth-only framebuffer between BeginDepthPass and EndDepthPass,
+	then a compute shader (hiz_downsample_compute.glsl) reduces the depth into a R32F mip
+	chain where every texel keeps the farthest depth below it. Level 0 is half the depth
+	resolution, so texel x of level L covers the pixels [x, x + 1) * 2^(L + 1).
+
+	A cull shader projects the bounds of an object, picks the level where they cover at most
+	2x2 texels and treats the object as hidden when its nearest depth is behind all of them.
+*/
+class GLHiZBuffer
+{
+protected:
+	GLuint framebuffer = 0;
+	GLuint depthTexture = 0;
+	GLuint hizTexture = 0;
+	int width = 0;
+	int height = 0;
+	int levels = 0;
+
+public:
+	static const GLuint HIZ_TEXTURE_UNIT = 6;
+
+	GLHiZBuffer(int width, int height);
+	~GLHiZBuffer();
+
+	GLHiZBuffer(const GLHiZBuffer& other) = delete;
+
+	// Binds and clears the depth framebuffer, draw the occluders with their usual programs
+	void BeginDepthPass();
+
+	// Builds the mip chain with downsampleProgram and returns to the default framebuffer.
+	// Requires HasComputeShader.
+	void EndDepthPass(class GLProgram& downsampleProgram);
+
+	// Binds the mip chain and sets the occlusion uniforms of hair_cull_compute.glsl
+	void BindForCulling(class GLProgram& cullProgram, bool bEnabled);
+
+	int Levels() const { return levels; }
+};
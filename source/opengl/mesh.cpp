@@ -1,4 +1,7 @@
 #include "mesh.h"
+#include "program.h"
+#include "renderstate.h"
+#include "glextensions.h"
 #include "../core/application.h"
 
 #pragma warning(push,0)
@@ -8,8 +11,12 @@
 #define GLM_ENABLE_EXPERIMENTAL
 #include "glm/gtx/euler_angles.hpp"
 
+#include "../core/alphaextents.h"
+#include "../core/threads.h"
+
 #include <string>
 #include <iostream>
+#include <chrono>
 
 const GLuint positionAttribId = 0;
 const GLuint normalAttribId = 1;
@@ -32,64 +39,54 @@ glm::mat4 MeshTransform::ModelMatrix() const
 GLMeshInterface::GLMeshInterface()
 {
 	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	GLState::BindVertexArray(vao);
 }
 
 GLMeshInterface::~GLMeshInterface()
 {
-	glBindVertexArray(0);
+	GLState::ForgetVertexArray(vao);
 	glDeleteVertexArrays(1, &vao);
 }
 
-
-
-
-GLTriangleMesh::GLTriangleMesh(bool allocate)
+void GLMeshInterface::SetAttribute(GLuint attribId, GLint components, const GLBufferAllocation& allocation, GLenum type)
 {
-	allocated = allocate;
-	if (!allocated) return;
-
-	glBindVertexArray(vao);
-
-	glGenBuffers(1, &positionBuffer);
-	glGenBuffers(1, &normalBuffer);
-	glGenBuffers(1, &colorBuffer);
-	glGenBuffers(1, &texCoordBuffer);
-	glGenBuffers(1, &indexBuffer);
+	GLState::BindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, allocation.buffer);
+	glEnableVertexAttribArray(attribId);
+	if (type == GL_INT || type == GL_UNSIGNED_INT)
+	{
+		glVertexAttribIPointer(attribId, components, type, 0, (GLvoid*)allocation.offset);
+	}
+	else
+	{
+		glVertexAttribPointer(attribId, components, type, false, 0, (GLvoid*)allocation.offset);
+	}
+}
 
-	// Position buffer
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glEnableVertexAttribArray(positionAttribId);
-	glVertexAttribPointer(positionAttribId, 3, GL_FLOAT, false, 0, 0);
+void GLMeshInterface::SetIndexBuffer(const GLBufferAllocation& allocation)
+{
+	// Draws pass allocation.offset as the index pointer
+	GLState::BindVertexArray(vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, allocation.buffer);
+}
 
-	// Normal buffer
-	glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-	glEnableVertexAttribArray(normalAttribId);
-	glVertexAttribPointer(normalAttribId, 3, GL_FLOAT, false, 0, 0);
 
-	// Color buffer
-	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-	glEnableVertexAttribArray(colorAttribId);
-	glVertexAttribPointer(colorAttribId, 4, GL_FLOAT, false, 0, 0);
 
-	// TexCoord buffer
-	glBindBuffer(GL_ARRAY_BUFFER, texCoordBuffer);
-	glEnableVertexAttribArray(texCoordAttribId);
-	glVertexAttribPointer(texCoordAttribId, 4, GL_FLOAT, false, 0, 0);
 
-	// Index buffer
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+GLTriangleMesh::GLTriangleMesh(bool allocate)
+{
+	// Buffers are allocated from the heap by SendToGPU
+	allocated = allocate;
 }
 
 GLTriangleMesh::~GLTriangleMesh()
 {
-	if (!allocated) return;
-
-	glDeleteBuffers(1, &positionBuffer);
-	glDeleteBuffers(1, &normalBuffer);
-	glDeleteBuffers(1, &colorBuffer);
-	glDeleteBuffers(1, &texCoordBuffer);
-	glDeleteBuffers(1, &indexBuffer);
+	GLBufferHeap& heap = GetBufferHeap();
+	heap.Free(positionBuffer);
+	heap.Free(normalBuffer);
+	heap.Free(colorBuffer);
+	heap.Free(texCoordBuffer);
+	heap.Free(indexBuffer);
 }
 
 void GLTriangleMesh::Clear()
@@ -113,30 +110,25 @@ void GLTriangleMesh::SendToGPU()
 {
 	if (!allocated) return;
 
-	glBindVertexArray(vao);
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, positions, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, normals, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, colors, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ARRAY_BUFFER, texCoordBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, texCoords, GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-	glBufferVector(GL_ELEMENT_ARRAY_BUFFER, indices, GL_STATIC_DRAW);
+	UploadVector(positionBuffer, positions);
+	UploadVector(normalBuffer, normals);
+	UploadVector(colorBuffer, colors);
+	UploadVector(texCoordBuffer, texCoords);
+	UploadVector(indexBuffer, indices);
+
+	SetAttribute(positionAttribId, 3, positionBuffer);
+	SetAttribute(normalAttribId, 3, normalBuffer);
+	SetAttribute(colorAttribId, 4, colorBuffer);
+	SetAttribute(texCoordAttribId, 4, texCoordBuffer);
+	SetIndexBuffer(indexBuffer);
 }
 
 void GLTriangleMesh::Draw()
 {
-	if (allocated && positions.size() > 0 && indices.size() > 0)
+	if (allocated && indexBuffer.IsValid() && positions.size() > 0 && indices.size() > 0)
 	{
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-		glDrawElements(GL_TRIANGLES, GLsizei(indices.size()), GL_UNSIGNED_INT, (void*)0);
+		GLState::BindVertexArray(vao);
+		glDrawElements(GL_TRIANGLES, GLsizei(indices.size()), GL_UNSIGNED_INT, (GLvoid*)indexBuffer.offset);
 	}
 }
 
@@ -218,29 +210,13 @@ void GLTriangleMesh::ApplyMatrix(glm::mat4 transform)
 
 GLLine::GLLine()
 {
-	// Generate buffers
-	glGenBuffers(1, &positionBuffer);
-	glGenBuffers(1, &colorBuffer);
-
-	// Load positions
-	int valuesPerPosition = 3; // glm::fvec3 has 3 floats
-	glEnableVertexAttribArray(positionAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glVertexAttribPointer(positionAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Load colors
-	valuesPerPosition = 4; // glm::fvec4 has 4 floats
-	glEnableVertexAttribArray(colorAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-	glVertexAttribPointer(colorAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
 	SendToGPU();
 }
 
 GLLine::~GLLine()
 {
-	glDeleteBuffers(1, &positionBuffer);
-	glDeleteBuffers(1, &colorBuffer);
+	GetBufferHeap().Free(positionBuffer);
+	GetBufferHeap().Free(colorBuffer);
 }
 
 void GLLine::AddLine(glm::fvec3 start, glm::fvec3 end, glm::fvec4 color)
@@ -261,51 +237,33 @@ void GLLine::Clear()
 
 void GLLine::SendToGPU()
 {
-	glBindVertexArray(vao);
+	UploadVector(positionBuffer, lineSegments);
+	UploadVector(colorBuffer, colors);
 
-	// Positions
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, lineSegments, GL_STATIC_DRAW);
-
-	// Colors
-	glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, colors, GL_STATIC_DRAW);
+	SetAttribute(positionAttribId, 3, positionBuffer); // glm::fvec3 has 3 floats
+	SetAttribute(colorAttribId, 4, colorBuffer);       // glm::fvec4 has 4 floats
 }
 
 void GLLine::Draw()
 {
 	if (lineSegments.size() > 0)
 	{
-		glBindVertexArray(vao);
-		glDrawArrays(GL_LINES, 0, GLsizei(lineSegments.size()) * 2 * 3);
+		// Two vertices per segment, the arrays share the heap with other meshes so nothing may be read past them
+		GLState::BindVertexArray(vao);
+		glDrawArrays(GL_LINES, 0, GLsizei(lineSegments.size()) * 2);
 	}
 }
 
 
 GLLineStrips::GLLineStrips()
 {
-	glBindVertexArray(vao);
-
-	// Generate buffers
-	glGenBuffers(1, &positionBuffer);
-	glGenBuffers(1, &indexBuffer);
-	
-	// Load positions
-	int valuesPerPosition = 3; // glm::fvec3 has 3 floats
-	glEnableVertexAttribArray(positionAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glVertexAttribPointer(positionAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Index buffer
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-
 	SendToGPU();
 }
 
 GLLineStrips::~GLLineStrips()
 {
-	glDeleteBuffers(1, &positionBuffer);
-	glDeleteBuffers(1, &indexBuffer);
+	GetBufferHeap().Free(positionBuffer);
+	GetBufferHeap().Free(indexBuffer);
 }
 
 void GLLineStrips::AddLineStrip(const std::vector<glm::fvec3>& points)
@@ -343,15 +301,11 @@ void GLLineStrips::Clear()
 
 void GLLineStrips::SendToGPU()
 {
-	glBindVertexArray(vao);
-
-	// Positions
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, lineStrips, GL_STATIC_DRAW);
+	UploadVector(positionBuffer, lineStrips);
+	UploadVector(indexBuffer, indices);
 
-	// Indices
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-	glBufferVector(GL_ELEMENT_ARRAY_BUFFER, indices, GL_STATIC_DRAW);
+	SetAttribute(positionAttribId, 3, positionBuffer); // glm::fvec3 has 3 floats
+	SetIndexBuffer(indexBuffer);
 }
 
 void GLLineStrips::Draw()
@@ -365,110 +319,90 @@ void GLLineStrips::Draw()
 		See these references for primitive restart
 			https://www.khronos.org/opengl/wiki/Vertex_Rendering#Common
 			https://gist.github.com/roxlu/51fc685b0303ee55c05b3ad96992f3ec
+		Restart stays enabled for every draw, all meshes use the same index, see mesh.h.
 	*/
-	glEnable(GL_PRIMITIVE_RESTART);
-	glPrimitiveRestartIndex(RESTART_INDEX);
+	GLState::SetCapability(GL_PRIMITIVE_RESTART, true);
+	GLState::PrimitiveRestartIndex(RESTART_INDEX);
 
-	{
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-		glDrawElements(GL_LINE_STRIP, GLsizei(indices.size()), GL_UNSIGNED_INT, (GLvoid*)0);
-	}
-
-	glDisable(GL_PRIMITIVE_RESTART);
+	// The index buffer is part of the vao
+	GLState::BindVertexArray(vao);
+	glDrawElements(GL_LINE_STRIP, GLsizei(indices.size()), GL_UNSIGNED_INT, (GLvoid*)indexBuffer.offset);
 }
 
 GLBezierStrips::GLBezierStrips()
 {
-	const GLuint bezierPositionAttribId = 0;
-	const GLuint bezierNormalAttribId = 1;
-	const GLuint bezierTangentAttribId = 2;
-	const GLuint bezierTexcoordAttribId = 3;
-	const GLuint bezierWidthAttribId = 4;
-	const GLuint bezierThicknessAttribId = 5;
-	const GLuint bezierShapeAttribId = 6;
-	const GLuint bezierSubdivAttribId = 7;
+	// Control point arrays are allocated from the heap by SendToGPU
+
+	// Segment data is not part of the vao, it is sampled through texture buffers
+	glGenBuffers(1, &segmentBuffer);
+	glGenBuffers(1, &segmentFlagsBuffer);
+	glGenTextures(1, &segmentTexture);
+	glGenTextures(1, &segmentFlagsTexture);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, segmentBuffer);
+	GLState::BindTexture(0, GL_TEXTURE_BUFFER, segmentTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, segmentBuffer);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, segmentFlagsBuffer);
+	GLState::BindTexture(0, GL_TEXTURE_BUFFER, segmentFlagsTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8I, segmentFlagsBuffer);
+
+	glGenBuffers(1, &cardSegmentsBuffer);
+	glGenTextures(1, &cardSegmentsTexture);
+	glBindBuffer(GL_TEXTURE_BUFFER, cardSegmentsBuffer);
+	GLState::BindTexture(0, GL_TEXTURE_BUFFER, cardSegmentsTexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, cardSegmentsBuffer);
 
-	glBindVertexArray(vao);
-
-	// Generate buffers
-	glGenBuffers(1, &positionBuffer);
-	glGenBuffers(1, &normalBuffer);
-	glGenBuffers(1, &tangentBuffer);
-	glGenBuffers(1, &texcoordBuffer);
-	glGenBuffers(1, &widthBuffer);
-	glGenBuffers(1, &thicknessBuffer);
-	glGenBuffers(1, &shapeBuffer);
-	glGenBuffers(1, &subdivisionsBuffer);
-
-	glGenBuffers(1, &indexBuffer);
-
-	// Define positions
-	int valuesPerPosition = 3; // glm::fvec3 has 3 floats
-	glEnableVertexAttribArray(bezierPositionAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glVertexAttribPointer(bezierPositionAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Define normals
-	valuesPerPosition = 3;
-	glEnableVertexAttribArray(bezierNormalAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-	glVertexAttribPointer(bezierNormalAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Define tangents
-	valuesPerPosition = 3;
-	glEnableVertexAttribArray(bezierTangentAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-	glVertexAttribPointer(bezierTangentAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Define texcoords
-	valuesPerPosition = 3; // glm::fvec3
-	glEnableVertexAttribArray(bezierTexcoordAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, texcoordBuffer);
-	glVertexAttribPointer(bezierTexcoordAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Define widths
-	valuesPerPosition = 1; // float
-	glEnableVertexAttribArray(bezierWidthAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, widthBuffer);
-	glVertexAttribPointer(bezierWidthAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Define thickness
-	valuesPerPosition = 1; // float
-	glEnableVertexAttribArray(bezierThicknessAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, thicknessBuffer);
-	glVertexAttribPointer(bezierThicknessAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-
-	// Define shapes
-	valuesPerPosition = 1; // int
-	glEnableVertexAttribArray(bezierShapeAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, shapeBuffer);
-	glVertexAttribIPointer(bezierShapeAttribId, valuesPerPosition, GL_INT, 0, 0);
-
-	// Define segment subdivisions
-	valuesPerPosition = 1; // int
-	glEnableVertexAttribArray(bezierSubdivAttribId);
-	glBindBuffer(GL_ARRAY_BUFFER, subdivisionsBuffer);
-	glVertexAttribIPointer(bezierSubdivAttribId, valuesPerPosition, GL_INT, 0, 0);
-
-	// Index buffer
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
 
 	SendToGPU();
 }
 
 GLBezierStrips::~GLBezierStrips()
 {
-	glDeleteBuffers(1, &positionBuffer);
-	glDeleteBuffers(1, &normalBuffer);
-	glDeleteBuffers(1, &tangentBuffer);
-	glDeleteBuffers(1, &texcoordBuffer);
-	glDeleteBuffers(1, &widthBuffer);
-	glDeleteBuffers(1, &thicknessBuffer);
-	glDeleteBuffers(1, &shapeBuffer);
-	glDeleteBuffers(1, &subdivisionsBuffer);
+	GLBufferHeap& heap = GetBufferHeap();
+	heap.Free(positionBuffer);
+	heap.Free(normalBuffer);
+	heap.Free(tangentBuffer);
+	heap.Free(texcoordBuffer);
+	heap.Free(widthBuffer);
+	heap.Free(thicknessBuffer);
+	heap.Free(shapeBuffer);
+	heap.Free(subdivisionsBuffer);
+
+	heap.Free(indexBuffer);
+
+	GLState::ForgetTexture(segmentTexture);
+	GLState::ForgetTexture(segmentFlagsTexture);
+	GLState::ForgetTexture(cardSegmentsTexture);
+	glDeleteTextures(1, &segmentTexture);
+	glDeleteTextures(1, &segmentFlagsTexture);
+	glDeleteBuffers(1, &segmentBuffer);
+	glDeleteBuffers(1, &segmentFlagsBuffer);
+	glDeleteTextures(1, &cardSegmentsTexture);
+	glDeleteBuffers(1, &cardSegmentsBuffer);
+
+	// Only created by CullCards
+	if (cullGroupsBuffer) glDeleteBuffers(1, &cullGroupsBuffer);
+	if (drawCommandsBuffer) glDeleteBuffers(1, &drawCommandsBuffer);
+	if (visibleCardsBuffer) glDeleteBuffers(1, &visibleCardsBuffer);
+
+	// Only created by SortSegmentsByDepth
+	heap.Free(sortedSegmentsBuffer);
+	if (sortedVao)
+	{
+		GLState::ForgetVertexArray(sortedVao);
+		glDeleteVertexArrays(1, &sortedVao);
+	}
 
-	glDeleteBuffers(1, &indexBuffer);
+	// Only created by CullSegments
+	if (visibleSegmentsTexture)
+	{
+		GLState::ForgetTexture(visibleSegmentsTexture);
+		glDeleteTextures(1, &visibleSegmentsTexture);
+		glDeleteBuffers(1, &visibleSegmentsBuffer);
+		glDeleteBuffers(1, &segmentCommandBuffer);
+	}
 }
 
 bool GLBezierStrips::AddBezierStrip(
@@ -544,6 +478,10 @@ void GLBezierStrips::Clear()
 	controlSubdivisions.clear();
 
 	indices.clear();
+	segmentData.clear();
+	segmentFlags.clear();
+	cardSegments.clear();
+	cardGroups.clear();
 
 	controlPoints.shrink_to_fit();
 	controlNormals.shrink_to_fit();
@@ -555,49 +493,242 @@ void GLBezierStrips::Clear()
 	controlSubdivisions.shrink_to_fit();
 
 	indices.shrink_to_fit();
+	segmentData.shrink_to_fit();
+	segmentFlags.shrink_to_fit();
+	cardSegments.shrink_to_fit();
+	cardGroups.shrink_to_fit();
 
 	SendToGPU();
 }
 
 void GLBezierStrips::SendToGPU()
 {
-	glBindVertexArray(vao);
+	const GLuint bezierPositionAttribId = 0;
+	const GLuint bezierNormalAttribId = 1;
+	const GLuint bezierTangentAttribId = 2;
+	const GLuint bezierTexcoordAttribId = 3;
+	const GLuint bezierWidthAttribId = 4;
+	const GLuint bezierThicknessAttribId = 5;
+	const GLuint bezierShapeAttribId = 6;
+	const GLuint bezierSubdivAttribId = 7;
+
+	UploadVector(positionBuffer, controlPoints);
+	UploadVector(normalBuffer, controlNormals);
+	UploadVector(tangentBuffer, controlTangents);
+	UploadVector(texcoordBuffer, controlTexcoords);
+	UploadVector(widthBuffer, controlWidths);
+	UploadVector(thicknessBuffer, controlThickness);
+	UploadVector(shapeBuffer, controlShapes);
+	UploadVector(subdivisionsBuffer, controlSubdivisions);
+	UploadVector(indexBuffer, indices);
+
+	SetAttribute(bezierPositionAttribId, 3, positionBuffer);
+	SetAttribute(bezierNormalAttribId, 3, normalBuffer);
+	SetAttribute(bezierTangentAttribId, 3, tangentBuffer);
+	SetAttribute(bezierTexcoordAttribId, 3, texcoordBuffer); // {ustart, v, uend}
+	SetAttribute(bezierWidthAttribId, 1, widthBuffer);
+	SetAttribute(bezierThicknessAttribId, 1, thicknessBuffer);
+	SetAttribute(bezierShapeAttribId, 1, shapeBuffer, GL_INT);
+	SetAttribute(bezierSubdivAttribId, 1, subdivisionsBuffer, GL_INT);
+	SetIndexBuffer(indexBuffer);
+
+	// Precomputed segments
+	BuildSegmentData();
+
+	glBindBuffer(GL_TEXTURE_BUFFER, segmentBuffer);
+	glBufferVector(GL_TEXTURE_BUFFER, segmentData, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, segmentFlagsBuffer);
+	glBufferVector(GL_TEXTURE_BUFFER, segmentFlags, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	bCardGroupsDirty = true;
+	bSortDirty = true;
+}
+
+void GLBezierStrips::BuildSegmentData()
+{
+	/*
+		Every pair of consecutive control points in a strip is one segment. The bezier curve
+		of a segment is stored in power basis, B(t) = ((a*t + b)*t + c)*t + d, so that the
+		geometry shader can evaluate it with three multiply-adds instead of six mixes.
+
+		Texel layout per segment (SEGMENT_TEXELS):
+			0: a,                  start thickness
+			1: b,                  end thickness
+			2: c,                  start texcoord u1
+			3: d (start),          end texcoord u1
+			4: start width vector, start texcoord v
+			5: end width vector,   end texcoord v
+			6: start normal,       start texcoord u2
+			7: end normal,         end texcoord u2
+	*/
+	segmentData.clear();
+	segmentFlags.clear();
+
+	size_t numSegments = 0;
+	for (size_t i = 0; i + 1 < indices.size(); ++i)
+	{
+		if (indices[i] != RESTART_INDEX && indices[i + 1] != RESTART_INDEX) numSegments++;
+	}
+	segmentData.reserve(numSegments * SEGMENT_TEXELS);
+	segmentFlags.reserve(numSegments);
+
+	for (size_t i = 0; i + 1 < indices.size(); ++i)
+	{
+		if (indices[i] == RESTART_INDEX || indices[i + 1] == RESTART_INDEX) continue;
+
+		unsigned int s = indices[i];
+		unsigned int e = indices[i + 1];
+
+		glm::fvec3 p1 = controlPoints[s];
+		glm::fvec3 p2 = controlPoints[s] + controlTangents[s];
+		glm::fvec3 p3 = controlPoints[e] - controlTangents[e];
+		glm::fvec3 p4 = controlPoints[e];
+
+		glm::fvec3 a = -p1 + 3.0f*p2 - 3.0f*p3 + p4;
+		glm::fvec3 b = 3.0f*p1 - 6.0f*p2 + 3.0f*p3;
+		glm::fvec3 c = 3.0f*(p2 - p1);
+		glm::fvec3 d = p1;
+
+		glm::fvec3 startWidthVector = glm::normalize(glm::cross(controlNormals[s], controlTangents[s])) * controlWidths[s];
+		glm::fvec3 endWidthVector = glm::normalize(glm::cross(controlNormals[e], controlTangents[e])) * controlWidths[e];
+		const glm::fvec3& startTexcoord = controlTexcoords[s];
+		const glm::fvec3& endTexcoord = controlTexcoords[e];
+
+		segmentData.push_back(glm::fvec4(a, controlThickness[s]));
+		segmentData.push_back(glm::fvec4(b, controlThickness[e]));
+		segmentData.push_back(glm::fvec4(c, startTexcoord.x));
+		segmentData.push_back(glm::fvec4(d, endTexcoord.x));
+		segmentData.push_back(glm::fvec4(startWidthVector, startTexcoord.y));
+		segmentData.push_back(glm::fvec4(endWidthVector, endTexcoord.y));
+		segmentData.push_back(glm::fvec4(controlNormals[s], startTexcoord.z));
+		segmentData.push_back(glm::fvec4(controlNormals[e], endTexcoord.z));
+
+		// all divisions except the last have the same shape as the first control point
+		segmentFlags.push_back(glm::i8vec4(controlShapes[s], controlShapes[e], controlSubdivisions[s], 0));
+	}
+
+	trimmedCardWidth = 0.0f;
+	if (cardTrimming && cardTrimming->IsValid())
+	{
+		TrimCards();
+	}
+}
+
+void GLBezierStrips::TrimCards()
+{
+	size_t numSegments = segmentData.size() / SEGMENT_TEXELS;
+	std::vector<glm::fvec2> removedWidth(numSegments); // {removed, total}
 
-	// Positions
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlPoints, GL_STATIC_DRAW);
+	Threads::ParallelFor(numSegments, [&](size_t begin, size_t end) {
+		for (size_t segment = begin; segment < end; ++segment)
+		{
+			glm::fvec4* texels = segmentData.data() + segment * SEGMENT_TEXELS;
+			glm::fvec3 startTexcoord{ texels[2].w, texels[4].w, texels[6].w };
+			glm::fvec3 endTexcoord{ texels[3].w, texels[5].w, texels[7].w };
+
+			float startTrim = 0.0f, endTrim = 0.0f;
+			cardTrimming->SymmetricTrim(startTexcoord, endTexcoord, startTrim, endTrim);
+
+			float startWidth = glm::length(glm::fvec3(texels[4]));
+			float endWidth = glm::length(glm::fvec3(texels[5]));
+			removedWidth[segment] = glm::fvec2(2.0f * (startTrim * startWidth + endTrim * endWidth), startWidth + endWidth);
+
+			// The width vector spans u = 0 to 1 from +width to -width, both sides move to the center
+			auto Trim = [](glm::fvec4& widthTexel, float& uStart, float& uEnd, float trim) -> void {
+				float uLength = uEnd - uStart;
+				widthTexel = glm::fvec4(glm::fvec3(widthTexel) * (1.0f - 2.0f * trim), widthTexel.w);
+				uStart += uLength * trim;
+				uEnd -= uLength * trim;
+			};
+			Trim(texels[4], texels[2].w, texels[6].w, startTrim);
+			Trim(texels[5], texels[3].w, texels[7].w, endTrim);
+		}
+	}, 256);
 
-	// Normals
-	glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlNormals, GL_STATIC_DRAW);
+	glm::fvec2 total{ 0.0f };
+	for (const glm::fvec2& width : removedWidth)
+	{
+		total += width;
+	}
+	trimmedCardWidth = (total.y > 0.0f) ? total.x / total.y : 0.0f;
+}
 
-	// Tangents
-	glBindBuffer(GL_ARRAY_BUFFER, tangentBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlTangents, GL_STATIC_DRAW);
+void GLBezierStrips::AppendStrips(const GLBezierStrips& other, glm::fvec3 offset)
+{
+	unsigned int indexOffset = static_cast<unsigned int>(controlPoints.size());
+
+	for (const glm::fvec3& point : other.controlPoints)
+	{
+		controlPoints.push_back(point + offset);
+	}
+	controlNormals.insert(controlNormals.end(), other.controlNormals.begin(), other.controlNormals.end());
+	controlTangents.insert(controlTangents.end(), other.controlTangents.begin(), other.controlTangents.end());
+	controlTexcoords.insert(controlTexcoords.end(), other.controlTexcoords.begin(), other.controlTexcoords.end());
+	controlWidths.insert(controlWidths.end(), other.controlWidths.begin(), other.controlWidths.end());
+	controlThickness.insert(controlThickness.end(), other.controlThickness.begin(), other.controlThickness.end());
+	controlShapes.insert(controlShapes.end(), other.controlShapes.begin(), other.controlShapes.end());
+	controlSubdivisions.insert(controlSubdivisions.end(), other.controlSubdivisions.begin(), other.controlSubdivisions.end());
+
+	for (unsigned int index : other.indices)
+	{
+		indices.push_back((index == RESTART_INDEX) ? RESTART_INDEX : index + indexOffset);
+	}
+	numStrips += other.numStrips;
+}
 
-	// Texcoords
-	glBindBuffer(GL_ARRAY_BUFFER, texcoordBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlTexcoords, GL_STATIC_DRAW);
+void GLBezierStrips::BuildCardGroups(int shapeOverride, int subdivisionsOverride)
+{
+	// Counting sort of the segment ids by (start shape, end shape, subdivisions)
+	const int numShapes = GLCardTemplates::NUM_SHAPES;
+	const int maxSubdivisions = GLCardTemplates::MAX_SUBDIVISIONS;
+	const int numTemplates = numShapes * numShapes * maxSubdivisions;
+
+	// The override replaces both shapes, see hair_segment_vertex.glsl
+	auto TemplateOf = [&](const glm::i8vec4& flags) -> int {
+		int shape = glm::clamp((shapeOverride >= 0) ? shapeOverride : int(flags.x), 0, numShapes - 1);
+		int endShape = glm::clamp((shapeOverride >= 0) ? shapeOverride : int(flags.y), 0, numShapes - 1);
+		int subdivisions = glm::clamp((subdivisionsOverride >= 0) ? subdivisionsOverride : int(flags.z), 1, maxSubdivisions);
+		return (shape * numShapes + endShape) * maxSubdivisions + subdivisions - 1;
+	};
 
-	// Widths
-	glBindBuffer(GL_ARRAY_BUFFER, widthBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlWidths, GL_STATIC_DRAW);
+	GLsizei counts[numTemplates] = {};
+	for (const glm::i8vec4& flags : segmentFlags)
+	{
+		counts[TemplateOf(flags)]++;
+	}
 
-	// Thickness
-	glBindBuffer(GL_ARRAY_BUFFER, thicknessBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlThickness, GL_STATIC_DRAW);
+	cardGroups.clear();
+	GLsizei offsets[numTemplates] = {};
+	GLsizei first = 0;
+	for (int t = 0; t < numTemplates; ++t)
+	{
+		offsets[t] = first;
+		if (counts[t] > 0)
+		{
+			int shape = t / (numShapes * maxSubdivisions);
+			int endShape = (t / maxSubdivisions) % numShapes;
+			int subdivisions = t % maxSubdivisions + 1;
+			cardGroups.push_back(CardGroup{ shape, endShape, subdivisions, first, counts[t] });
+		}
+		first += counts[t];
+	}
 
-	// Shapes
-	glBindBuffer(GL_ARRAY_BUFFER, shapeBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlShapes, GL_STATIC_DRAW);
+	cardSegments.resize(segmentFlags.size());
+	for (size_t i = 0; i < segmentFlags.size(); ++i)
+	{
+		cardSegments[offsets[TemplateOf(segmentFlags[i])]++] = GLint(i);
+	}
 
-	// Subdivisions
-	glBindBuffer(GL_ARRAY_BUFFER, subdivisionsBuffer);
-	glBufferVector(GL_ARRAY_BUFFER, controlSubdivisions, GL_STATIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, cardSegmentsBuffer);
+	glBufferVector(GL_TEXTURE_BUFFER, cardSegments, GL_STATIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
 
-	// Indices
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-	glBufferVector(GL_ELEMENT_ARRAY_BUFFER, indices, GL_STATIC_DRAW);
+	cardShapeOverride = shapeOverride;
+	cardSubdivisionsOverride = subdivisionsOverride;
+	bCardGroupsDirty = false;
+	bCullGroupsDirty = true;
 }
 
 void GLBezierStrips::Draw()
@@ -607,16 +738,480 @@ void GLBezierStrips::Draw()
 		return; // because there is no data to render
 	}
 
-	glEnable(GL_PRIMITIVE_RESTART);
-	glPrimitiveRestartIndex(RESTART_INDEX);
+	GLState::SetCapability(GL_PRIMITIVE_RESTART, true);
+	GLState::PrimitiveRestartIndex(RESTART_INDEX);
+
+	GLState::BindVertexArray(vao);
+	glDrawElements(GL_LINE_STRIP, GLsizei(indices.size()), GL_UNSIGNED_INT, (GLvoid*)indexBuffer.offset);
+}
+
+void GLBezierStrips::DrawSegments()
+{
+	if (segmentFlags.size() == 0)
+	{
+		return; // because there is no data to render
+	}
+
+	GLState::BindTexture(SEGMENT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentTexture);
+	GLState::BindTexture(SEGMENT_FLAGS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentFlagsTexture);
+
+	// No vertex attributes are read, the vao only has to be bound
+	GLState::BindVertexArray(vao);
+	glDrawArrays(GL_POINTS, 0, SegmentCount());
+}
+
+void GLBezierStrips::DrawCards(GLCardTemplates& templates, GLProgram& program, int shapeOverride, int subdivisionsOverride)
+{
+	if (segmentFlags.size() == 0)
+	{
+		return; // because there is no data to render
+	}
+
+	if (bCardGroupsDirty || shapeOverride != cardShapeOverride || subdivisionsOverride != cardSubdivisionsOverride)
+	{
+		BuildCardGroups(shapeOverride, subdivisionsOverride);
+	}
+
+	GLState::BindTexture(SEGMENT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentTexture);
+	GLState::BindTexture(CARD_SEGMENTS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, cardSegmentsTexture);
+
+	UniformHandle firstInstanceHandle = program.GetUniformHandle("firstInstance");
+	for (const CardGroup& group : cardGroups)
+	{
+		program.SetUniformInt(firstInstanceHandle, group.first);
+		program.FlushUniforms();
+		templates.DrawInstanced(group.shape, group.endShape, group.subdivisions, group.count);
+	}
+}
+
+void GLBezierStrips::CullCards(GLCardTemplates& templates, GLProgram& cullProgram, const glm::mat4& cullMatrix, int shapeOverride, int subdivisionsOverride)
+{
+	if (segmentFlags.size() == 0)
+	{
+		return; // because there is no data to cull
+	}
+
+	if (bCardGroupsDirty || shapeOverride != cardShapeOverride || subdivisionsOverride != cardSubdivisionsOverride)
+	{
+		BuildCardGroups(shapeOverride, subdivisionsOverride);
+	}
+
+	if (!cullGroupsBuffer)
+	{
+		glGenBuffers(1, &cullGroupsBuffer);
+		glGenBuffers(1, &drawCommandsBuffer);
+		glGenBuffers(1, &visibleCardsBuffer);
+	}
+
+	if (bCullGroupsDirty)
+	{
+		std::vector<GPUCardGroup> groups;
+		drawCommands.clear();
+		for (const CardGroup& group : cardGroups)
+		{
+			groups.push_back(GPUCardGroup{ group.first, group.count });
+
+			DrawElementsIndirectCommand command;
+			command.count = GLuint(templates.IndexCount(group.shape, group.endShape, group.subdivisions));
+			command.firstIndex = templates.FirstIndex(group.shape, group.endShape, group.subdivisions);
+			command.baseInstance = GLuint(group.first); // visible cards of the group start here
+			drawCommands.push_back(command);
+		}
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, cullGroupsBuffer);
+		glBufferVector(GL_SHADER_STORAGE_BUFFER, groups, GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		bCullGroupsDirty = false;
+	}
+
+	// The instance counts are reset every frame, the compute pass counts them up again
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCommandsBuffer);
+	glBufferVector(GL_SHADER_STORAGE_BUFFER, drawCommands, GL_STREAM_DRAW);
+
+	GLsizeiptr visibleBytes = GLsizeiptr(SegmentCount()) * sizeof(GLint);
+	if (visibleCardsCapacity < visibleBytes)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleCardsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, visibleBytes, NULL, GL_DYNAMIC_COPY);
+		visibleCardsCapacity = visibleBytes;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, cullGroupsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, drawCommandsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleCardsBuffer);
+
+	GLState::BindTexture(SEGMENT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentTexture);
+	GLState::BindTexture(CARD_SEGMENTS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, cardSegmentsTexture);
+
+	cullProgram.Use();
+	cullProgram.SetUniformInt("numCards", SegmentCount());
+	cullProgram.SetUniformInt("numGroups", GLint(cardGroups.size()));
+	cullProgram.SetUniformMat4("cullMatrix", cullMatrix);
+	cullProgram.FlushUniforms();
+
+	glDispatchCompute(GLuint((SegmentCount() + 63) / 64), 1, 1);
+
+	// The draw reads the commands and the visible cards as instanced vertex attributes
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void GLBezierStrips::DrawCardsIndirect(GLCardTemplates& templates)
+{
+	if (segmentFlags.size() == 0 || drawCommands.size() == 0)
+	{
+		return; // because there is no data to render
+	}
+
+	GLState::BindTexture(SEGMENT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentTexture);
+
+	templates.SetInstanceBuffer(visibleCardsBuffer);
+	templates.DrawIndirect(drawCommandsBuffer, GLsizei(drawCommands.size()));
+}
+
+void GLBezierStrips::CullSegments(GLProgram& cullProgram, const glm::mat4& cullMatrix)
+{
+	if (segmentFlags.size() == 0)
+	{
+		return; // because there is no data to cull
+	}
+
+	if (!visibleSegmentsTexture)
+	{
+		glGenBuffers(1, &segmentCommandBuffer);
+		glGenBuffers(1, &visibleSegmentsBuffer);
+		glGenTextures(1, &visibleSegmentsTexture);
+		glBindBuffer(GL_TEXTURE_BUFFER, visibleSegmentsBuffer);
+		GLState::BindTexture(0, GL_TEXTURE_BUFFER, visibleSegmentsTexture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32I, visibleSegmentsBuffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// {count, instanceCount, first, baseInstance}, the count is reset every frame
+	const GLuint command[4] = { 0, 1, 0, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, segmentCommandBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(command), command, GL_STREAM_DRAW);
+
+	GLsizeiptr visibleBytes = GLsizeiptr(SegmentCount()) * sizeof(GLint);
+	if (visibleSegmentsCapacity < visibleBytes)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleSegmentsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, visibleBytes, NULL, GL_DYNAMIC_COPY);
+		visibleSegmentsCapacity = visibleBytes;
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, segmentCommandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visibleSegmentsBuffer);
+
+	GLState::BindTexture(SEGMENT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentTexture);
+
+	cullProgram.Use();
+	cullProgram.SetUniformInt("numCards", SegmentCount());
+	cullProgram.SetUniformMat4("cullMatrix", cullMatrix);
+	cullProgram.FlushUniforms();
+
+	glDispatchCompute(GLuint((SegmentCount() + 63) / 64), 1, 1);
+
+	// The draw reads the command and fetches the segment ids through a texture buffer
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void GLBezierStrips::DrawVisibleSegments()
+{
+	if (segmentFlags.size() == 0 || !visibleSegmentsTexture)
+	{
+		return; // because there is no data to render
+	}
+
+	GLState::BindTexture(SEGMENT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentTexture);
+	GLState::BindTexture(SEGMENT_FLAGS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentFlagsTexture);
+	GLState::BindTexture(VISIBLE_SEGMENTS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, visibleSegmentsTexture);
+
+	GLState::BindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, segmentCommandBuffer);
+	glDrawArraysIndirect(GL_POINTS, (GLvoid*)0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+bool GLBezierStrips::SortSegmentsByDepth(const glm::fvec3& cameraPosition, const glm::fvec3& viewDirection, float moveThreshold)
+{
+	const float turnThreshold = glm::cos(glm::radians(2.0f));
+	bool bMoved = glm::distance(cameraPosition, sortedCameraPosition) > moveThreshold ||
+		glm::dot(viewDirection, sortedViewDirection) < turnThreshold;
+	if (!bSortDirty && !bMoved)
+	{
+		return false;
+	}
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	size_t numSegments = segmentFlags.size();
+	sortKeys.resize(numSegments);
+	sortedSegments.resize(numSegments);
+	Threads::ParallelFor(numSegments, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			// Mean of the bezier control points, see BuildSegmentData for the power basis
+			const glm::fvec4* segment = &segmentData[i * SEGMENT_TEXELS];
+			glm::fvec3 center = (glm::fvec3{ segment[0] } + glm::fvec3{ segment[1] } * (4.0f / 3.0f) +
+				glm::fvec3{ segment[2] } * 2.0f + glm::fvec3{ segment[3] } * 4.0f) * 0.25f;
+
+			// Inverted so that the far segments come first
+			float depth = glm::dot(center - cameraPosition, viewDirection);
+			sortKeys[i] = ~RadixSort::FloatToKey(depth);
+			sortedSegments[i] = uint32_t(i);
+		}
+	});
+	RadixSort::SortPairs(sortKeys, sortedSegments, sortScratch);
+
+	bool bMovedBuffer = GetBufferHeap().Upload(sortedSegmentsBuffer, sortedSegments.data(), GLsizeiptr(numSegments * sizeof(uint32_t)));
+	if (!sortedVao || bMovedBuffer)
+	{
+		if (!sortedVao) glGenVertexArrays(1, &sortedVao);
+		GLState::BindVertexArray(sortedVao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sortedSegmentsBuffer.buffer);
+	}
+
+	sortedCameraPosition = cameraPosition;
+	sortedViewDirection = viewDirection;
+	bSortDirty = false;
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	sortMilliseconds = std::chrono::duration<double, std::milli>(endTime - startTime).count();
+	return true;
+}
+
+void GLBezierStrips::DrawSortedSegments()
+{
+	if (segmentFlags.size() == 0 || !sortedVao)
+	{
+		return; // because there is no data to render
+	}
+
+	GLState::BindTexture(SEGMENT_DATA_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentTexture);
+	GLState::BindTexture(SEGMENT_FLAGS_TEXTURE_UNIT, GL_TEXTURE_BUFFER, segmentFlagsTexture);
+
+	// With glDrawElements gl_VertexID is the index, the shader reads the sorted segment ids
+	GLState::BindVertexArray(sortedVao);
+	glDrawElements(GL_POINTS, SegmentCount(), GL_UNSIGNED_INT, (GLvoid*)sortedSegmentsBuffer.offset);
+}
+
+GLCardTemplates::GLCardTemplates()
+{
+	/*
+		Columns across a card as {u, thickness side}, where u = 0 is the left edge
+		(start + width vector) and u = 1 the right edge. Matches the quads in
+		hair_planes_geometry.glsl.
+	*/
+	const std::vector<glm::fvec2> columns[NUM_SHAPES] = {
+		{ {0.0f, 0.0f}, {1.0f, 0.0f} },                                   // single quad
+		{ {0.0f, -1.0f}, {0.5f, 1.0f}, {1.0f, -1.0f} },                   // double quad
+		{ {0.0f, -1.0f}, {0.25f, 1.0f}, {0.75f, 1.0f}, {1.0f, -1.0f} },   // triple quad
+		{ {0.0f, 0.0f}, {1.0f, 0.0f} }                                    // ribbon, aligned to the camera in the shader
+	};
+
+	std::vector<glm::fvec4> vertices;
+	std::vector<unsigned int> indices;
+	auto AddRow = [&](float t, int shape) -> unsigned int {
+		unsigned int firstVertex = static_cast<unsigned int>(vertices.size());
+		for (const glm::fvec2& column : columns[shape])
+		{
+			vertices.push_back(glm::fvec4(t, column.x, column.y, float(shape)));
+		}
+		return firstVertex;
+	};
+
+	for (int shape = 0; shape < NUM_SHAPES; ++shape)
+	{
+		for (int endShape = 0; endShape < NUM_SHAPES; ++endShape)
+		{
+			for (int subdivisions = 1; subdivisions <= MAX_SUBDIVISIONS; ++subdivisions)
+			{
+				TemplateRange& range = ranges[shape][endShape][subdivisions - 1];
+				range.firstIndex = GLsizei(indices.size());
+
+				// Divisions of the same shape share their rows, a change of shape starts new ones
+				unsigned int startRow = 0;
+				int rowShape = -1;
+				for (int division = 0; division < subdivisions; ++division)
+				{
+					int divisionShape = (division == subdivisions - 1) ? endShape : shape;
+					if (divisionShape != rowShape)
+					{
+						startRow = AddRow(division / float(subdivisions), divisionShape);
+						rowShape = divisionShape;
+					}
+					unsigned int endRow = AddRow((division + 1) / float(subdivisions), divisionShape);
+
+					unsigned int numColumns = static_cast<unsigned int>(columns[divisionShape].size());
+					for (unsigned int column = 0; column + 1 < numColumns; ++column)
+					{
+						unsigned int p1 = startRow + column;
+						unsigned int p2 = p1 + 1;
+						unsigned int p3 = endRow + column + 1;
+						unsigned int p4 = endRow + column;
+						indices.insert(indices.end(), { p1, p2, p3, p3, p4, p1 });
+					}
+					startRow = endRow;
+				}
+				range.count = GLsizei(indices.size()) - range.firstIndex;
+			}
+		}
+	}
+
+	UploadVector(vertexBuffer, vertices);
+	UploadVector(indexBuffer, indices);
+	SetAttribute(positionAttribId, 4, vertexBuffer);
+	SetIndexBuffer(indexBuffer);
+}
+
+GLCardTemplates::~GLCardTemplates()
+{
+	GetBufferHeap().Free(vertexBuffer);
+	GetBufferHeap().Free(indexBuffer);
+}
+
+void GLCardTemplates::DrawInstanced(int shape, int endShape, int subdivisions, GLsizei instanceCount)
+{
+	const TemplateRange& range = ranges[shape][endShape][subdivisions - 1];
+
+	GLState::BindVertexArray(vao);
+	glDrawElementsInstanced(GL_TRIANGLES, range.count, GL_UNSIGNED_INT, (GLvoid*)(indexBuffer.offset + range.firstIndex * sizeof(unsigned int)), instanceCount);
+}
+
+GLuint GLCardTemplates::FirstIndex(int shape, int endShape, int subdivisions) const
+{
+	// Indirect commands count from the start of the buffer, not from the heap allocation
+	return GLuint(indexBuffer.offset / sizeof(unsigned int)) + GLuint(ranges[shape][endShape][subdivisions - 1].firstIndex);
+}
+
+void GLCardTemplates::SetInstanceBuffer(GLuint buffer)
+{
+	if (buffer == instanceBuffer)
+	{
+		return;
+	}
+
+	GLState::BindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glEnableVertexAttribArray(instanceAttribId);
+	glVertexAttribIPointer(instanceAttribId, 1, GL_INT, 0, (GLvoid*)0);
+	glVertexAttribDivisor(instanceAttribId, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	instanceBuffer = buffer;
+}
+
+void GLCardTemplates::DrawIndirect(GLuint commandBuffer, GLsizei drawCount)
+{
+	GLState::BindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid*)0, drawCount, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+GLFeedbackMesh::GLFeedbackMesh()
+{
+	GLState::BindVertexArray(vao);
+
+	glGenBuffers(1, &vertexBuffer);
+	if (HasTransformFeedbackObjects())
+	{
+		glGenTransformFeedbacks(1, &feedbackObject);
+	}
+	else
+	{
+		glGenQueries(1, &primitivesQuery);
+	}
+
+	// Interleaved position, normal and texcoord
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glEnableVertexAttribArray(positionAttribId);
+	glVertexAttribPointer(positionAttribId, 3, GL_FLOAT, false, VERTEX_STRIDE, (GLvoid*)0);
+	glEnableVertexAttribArray(normalAttribId);
+	glVertexAttribPointer(normalAttribId, 3, GL_FLOAT, false, VERTEX_STRIDE, (GLvoid*)sizeof(glm::fvec3));
+	glEnableVertexAttribArray(texCoordAttribId);
+	glVertexAttribPointer(texCoordAttribId, 4, GL_FLOAT, false, VERTEX_STRIDE, (GLvoid*)(2*sizeof(glm::fvec3)));
+}
+
+GLFeedbackMesh::~GLFeedbackMesh()
+{
+	glDeleteBuffers(1, &vertexBuffer);
+	if (feedbackObject)
+	{
+		glDeleteTransformFeedbacks(1, &feedbackObject);
+	}
+	if (primitivesQuery)
+	{
+		glDeleteQueries(1, &primitivesQuery);
+	}
+}
+
+void GLFeedbackMesh::BeginCapture(GLsizei maxVertices)
+{
+	GLsizeiptr requiredSize = GLsizeiptr(maxVertices) * VERTEX_STRIDE;
+	if (requiredSize > capacity)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, requiredSize, NULL, GL_STATIC_COPY);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		capacity = requiredSize;
+	}
+
+	if (feedbackObject)
+	{
+		// The buffer binding is part of the object, the vertex count it records is drawn by Draw
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedbackObject);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vertexBuffer);
+	}
+	else
+	{
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vertexBuffer);
+		glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, primitivesQuery);
+	}
+	glBeginTransformFeedback(GL_TRIANGLES);
+}
+
+void GLFeedbackMesh::EndCapture()
+{
+	glEndTransformFeedback();
+	if (feedbackObject)
+	{
+		glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+	}
+	else
+	{
+		glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+		glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+
+		// The primitive count is read on the first redraw, by then the capture has usually finished
+		bQueryPending = true;
+	}
+	bValid = true;
+}
 
+void GLFeedbackMesh::Draw()
+{
+	if (feedbackObject)
 	{
-		glBindVertexArray(vao);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
-		glDrawElements(GL_LINE_STRIP, GLsizei(indices.size()), GL_UNSIGNED_INT, (GLvoid*)0);
+		GLState::BindVertexArray(vao);
+		glDrawTransformFeedback(GL_TRIANGLES, feedbackObject);
+		return;
 	}
 
-	glDisable(GL_PRIMITIVE_RESTART);
+	if (bQueryPending)
+	{
+		GLuint numPrimitives = 0;
+		glGetQueryObjectuiv(primitivesQuery, GL_QUERY_RESULT, &numPrimitives);
+		numVertices = GLsizei(numPrimitives * 3);
+		bQueryPending = false;
+	}
+
+	if (numVertices > 0)
+	{
+		GLState::BindVertexArray(vao);
+		glDrawArrays(GL_TRIANGLES, 0, numVertices);
+	}
 }
 
 void GLQuadProperties::MatchWindowDimensions()
@@ -662,13 +1257,13 @@ GLQuad::GLQuad(GLQuadProperties properties)
 
 GLQuad::~GLQuad()
 {
-	glDeleteBuffers(1, &positionBuffer);
-	glDeleteBuffers(1, &texCoordBuffer);
+	GetBufferHeap().Free(positionBuffer);
+	GetBufferHeap().Free(texCoordBuffer);
 }
 
 void GLQuad::Draw()
 {
-	glBindVertexArray(vao);
+	GLState::BindVertexArray(vao);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
@@ -704,23 +1299,11 @@ void GLQuad::CreateMeshBuffer(MeshBufferProperties properties)
 		0.0f, 0.0f, 1.0f, 1.0f
 	};
 
-	glBindVertexArray(vao);
+	UploadVector(positionBuffer, positions);
+	UploadVector(texCoordBuffer, tcoords);
 
-	// Generate buffers
-	glGenBuffers(1, &positionBuffer);
-	glGenBuffers(1, &texCoordBuffer);
-
-	// Load positions
-	glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
-	glEnableVertexAttribArray(positionAttribId);
-	glVertexAttribPointer(positionAttribId, valuesPerPosition, GL_FLOAT, false, 0, 0);
-	glBufferVector(GL_ARRAY_BUFFER, positions, GL_STATIC_DRAW);
-
-	// Load UVs
-	glBindBuffer(GL_ARRAY_BUFFER, texCoordBuffer);
-	glEnableVertexAttribArray(texCoordAttribId);
-	glVertexAttribPointer(texCoordAttribId, valuesPerCoord, GL_FLOAT, false, 0, 0);
-	glBufferVector(GL_ARRAY_BUFFER, tcoords, GL_STATIC_DRAW);
+	SetAttribute(positionAttribId, valuesPerPosition, positionBuffer);
+	SetAttribute(texCoordAttribId, valuesPerCoord, texCoordBuffer);
 }
 
 namespace GLMesh
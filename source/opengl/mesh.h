@@ -1,7 +1,10 @@
 #pragma once
 #include <vector>
 #include "glad/glad.h"
+#include "bufferheap.h"
 #include "../core/math.h"
+#include "../core/radixsort.h"
+#include "glm/gtc/type_precision.hpp"
 #include <filesystem>
 
 struct GLQuadProperties
@@ -34,6 +37,8 @@ public:
 	GLMeshInterface();
 	~GLMeshInterface();
 
+	GLuint VertexArray() const { return vao; }
+
 	// Behaves like glBufferData, but for std::vector<T>.
 	template <class T>
 	void glBufferVector(GLenum glBufferType, const std::vector<T>& vector, GLenum usage = GL_STATIC_DRAW)
@@ -42,17 +47,32 @@ public:
 		float* frontPtr = (float*)((count > 0) ? &vector.front() : NULL);
 		glBufferData(glBufferType, count*sizeof(T), frontPtr, usage);
 	}
+
+protected:
+	/*
+		Vertex and index arrays live in the shared GLBufferHeap. Uploading can move an array
+		to another buffer or offset, so SendToGPU sets the attributes again after uploading.
+	*/
+	template <class T>
+	void UploadVector(GLBufferAllocation& allocation, const std::vector<T>& vector)
+	{
+		GetBufferHeap().Upload(allocation, vector.data(), GLsizeiptr(vector.size() * sizeof(T)));
+	}
+
+	// GL_INT and GL_UNSIGNED_INT attributes are read as integers in the shader
+	void SetAttribute(GLuint attribId, GLint components, const GLBufferAllocation& allocation, GLenum type = GL_FLOAT);
+	void SetIndexBuffer(const GLBufferAllocation& allocation);
 };
 
 class GLTriangleMesh : public GLMeshInterface
 {
 protected:
 	bool allocated = false;
-	GLuint positionBuffer = 0;
-	GLuint normalBuffer = 0;
-	GLuint colorBuffer = 0;
-	GLuint texCoordBuffer = 0;
-	GLuint indexBuffer = 0;
+	GLBufferAllocation positionBuffer;
+	GLBufferAllocation normalBuffer;
+	GLBufferAllocation colorBuffer;
+	GLBufferAllocation texCoordBuffer;
+	GLBufferAllocation indexBuffer;
 
 public:
 	std::vector<glm::fvec3> positions;
@@ -85,8 +105,8 @@ struct GLLineSegment
 class GLLine : public GLMeshInterface
 {
 protected:
-	GLuint positionBuffer = 0;
-	GLuint colorBuffer = 0;
+	GLBufferAllocation positionBuffer;
+	GLBufferAllocation colorBuffer;
 
 	std::vector<GLLineSegment> lineSegments;
 	std::vector<glm::fvec4> colors;
@@ -108,10 +128,10 @@ public:
 class GLLineStrips : public GLMeshInterface
 {
 protected:
-	const GLuint RESTART_INDEX = 0xFFFF;
+	const GLuint RESTART_INDEX = 0xFFFFFFFF; // same as GLBezierStrips, primitive restart is left enabled between draws
 
-	GLuint positionBuffer = 0;
-	GLuint indexBuffer = 0;
+	GLBufferAllocation positionBuffer;
+	GLBufferAllocation indexBuffer;
 
 	unsigned int numStrips = 0;
 	std::vector<glm::fvec3> lineStrips; // each line strip is separated by the RESTART_INDEX in indices
@@ -133,18 +153,18 @@ public:
 class GLBezierStrips : public GLMeshInterface
 {
 protected:
-	const GLuint RESTART_INDEX = 0xFFFF;
+	const GLuint RESTART_INDEX = 0xFFFFFFFF; // indices are GL_UNSIGNED_INT, large grooms exceed 0xFFFF control points
 
-	GLuint positionBuffer = 0;
-	GLuint normalBuffer = 0;
-	GLuint tangentBuffer = 0;
-	GLuint texcoordBuffer = 0;
-	GLuint widthBuffer = 0;
-	GLuint thicknessBuffer = 0;
-	GLuint shapeBuffer = 0;
-	GLuint subdivisionsBuffer = 0;
+	GLBufferAllocation positionBuffer;
+	GLBufferAllocation normalBuffer;
+	GLBufferAllocation tangentBuffer;
+	GLBufferAllocation texcoordBuffer;
+	GLBufferAllocation widthBuffer;
+	GLBufferAllocation thicknessBuffer;
+	GLBufferAllocation shapeBuffer;
+	GLBufferAllocation subdivisionsBuffer;
 
-	GLuint indexBuffer = 0;
+	GLBufferAllocation indexBuffer;
 
 	unsigned int numStrips = 0;
 	std::vector<glm::fvec3> controlPoints; // each curve is separated on the GPU by the RESTART_INDEX in indices
@@ -158,7 +178,92 @@ protected:
 
 	std::vector<unsigned int> indices;
 
+	/*
+		Per-segment data precomputed at load time and fetched by segment index in the hair shader.
+		See BuildSegmentData for the texel layout.
+	*/
+	GLuint segmentBuffer = 0;
+	GLuint segmentTexture = 0;
+	GLuint segmentFlagsBuffer = 0;
+	GLuint segmentFlagsTexture = 0;
+
+	std::vector<glm::fvec4> segmentData;  // SEGMENT_TEXELS per segment
+	std::vector<glm::i8vec4> segmentFlags; // {start shape, end shape, subdivisions, unused}
+
+	/*
+		Segment ids sorted by card template, used by DrawCards. The order depends on the
+		shape and subdivision overrides, so it is rebuilt when they change.
+	*/
+	struct CardGroup
+	{
+		int shape = 0;
+		int endShape = 0; // of the last division, like the geometry shader
+		int subdivisions = 1;
+		GLsizei first = 0;
+		GLsizei count = 0;
+	};
+	GLuint cardSegmentsBuffer = 0;
+	GLuint cardSegmentsTexture = 0;
+	std::vector<GLint> cardSegments;
+	std::vector<CardGroup> cardGroups;
+	bool bCardGroupsDirty = true;
+	int cardShapeOverride = -1;
+	int cardSubdivisionsOverride = -1;
+
+	/*
+		GPU culling of the cards, see CullCards. The group table mirrors cardGroups, the
+		draw commands are reset from the CPU every frame and counted up by the compute pass.
+	*/
+	struct GPUCardGroup
+	{
+		GLint first = 0;
+		GLint count = 0;
+	};
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count = 0;
+		GLuint instanceCount = 0;
+		GLuint firstIndex = 0;
+		GLint baseVertex = 0;
+		GLuint baseInstance = 0;
+	};
+	GLuint cullGroupsBuffer = 0;
+	GLuint drawCommandsBuffer = 0;
+	GLuint visibleCardsBuffer = 0;
+	GLsizeiptr visibleCardsCapacity = 0;
+	bool bCullGroupsDirty = true;
+	std::vector<DrawElementsIndirectCommand> drawCommands;
+
+	// Compacted segment ids for the geometry shader path, see CullSegments
+	GLuint segmentCommandBuffer = 0;
+	GLuint visibleSegmentsBuffer = 0;
+	GLuint visibleSegmentsTexture = 0;
+	GLsizeiptr visibleSegmentsCapacity = 0;
+
+	/*
+		Segment ids sorted back to front, see SortSegmentsByDepth. They are drawn as the
+		element array of a vao without attributes, so gl_VertexID is the segment id.
+	*/
+	GLBufferAllocation sortedSegmentsBuffer;
+	GLuint sortedVao = 0;
+	std::vector<uint32_t> sortKeys;
+	std::vector<uint32_t> sortedSegments;
+	RadixSort::Scratch sortScratch;
+	bool bSortDirty = true;
+	glm::fvec3 sortedCameraPosition{ 0.0f };
+	glm::fvec3 sortedViewDirection{ 0.0f };
+
+	// Opaque extents of the hair alpha mask, see SetCardTrimming
+	const class AlphaExtents* cardTrimming = nullptr;
+
 public:
+	static const int SEGMENT_TEXELS = 8;
+	static const int MAX_SEGMENT_VERTICES = 72; // max_vertices in hair_planes_geometry.glsl
+	static const GLuint SEGMENT_DATA_TEXTURE_UNIT = 3;
+	static const GLuint SEGMENT_FLAGS_TEXTURE_UNIT = 4;
+	static const GLuint CARD_SEGMENTS_TEXTURE_UNIT = 5;
+	static const GLuint VISIBLE_SEGMENTS_TEXTURE_UNIT = 7;
+
 	GLBezierStrips();
 	~GLBezierStrips();
 
@@ -177,14 +282,151 @@ public:
 
 	void SendToGPU();
 
+	// Draws the control points as line strips (one vertex per control point)
+	void Draw();
+
+	// Draws one point per segment, the segment data is fetched from texture buffers by gl_VertexID
+	void DrawSegments();
+
+	// Draws one card template instance per segment, grouped by start shape, end shape and subdivisions.
+	// The program must be in use, its firstInstance uniform is set per group.
+	void DrawCards(class GLCardTemplates& templates, class GLProgram& program, int shapeOverride = -1, int subdivisionsOverride = -1);
+
+	/*
+		GPU driven DrawCards. CullCards dispatches cullProgram (hair_cull_compute.glsl), which
+		tests every card against the frustum of cullMatrix (view_projection * model) and appends
+		the visible ones to their group. DrawCardsIndirect then draws all groups with a single
+		glMultiDrawElementsIndirect, using a card program compiled with INDIRECT. The CPU cost
+		does not depend on the number of segments.
+		Requires HasComputeShader and HasMultiDrawIndirect.
+	*/
+	void CullCards(class GLCardTemplates& templates, class GLProgram& cullProgram, const glm::mat4& cullMatrix, int shapeOverride = -1, int subdivisionsOverride = -1);
+	void DrawCardsIndirect(class GLCardTemplates& templates);
+
+	/*
+		Culling before tessellation for DrawSegments. CullSegments runs the SEGMENT_LIST variant
+		of the cull program and writes the ids of the visible segments, DrawVisibleSegments draws
+		them with glDrawArraysIndirect through a segment program compiled with CULLED.
+		Occlusion is tested when the cull program has a Hi-Z buffer bound, see GLHiZBuffer.
+	*/
+	void CullSegments(class GLProgram& cullProgram, const glm::mat4& cullMatrix);
+	void DrawVisibleSegments();
+
+	/*
+		Back to front order for blended hair. The segments are sorted by the view depth of their
+		center with a parallel radix sort, but only when the camera (in the local space of the
+		mesh) has moved more than moveThreshold or turned by more than a few degrees since the
+		last sort. Returns true when it sorted. DrawSortedSegments draws like DrawSegments.
+	*/
+	bool SortSegmentsByDepth(const glm::fvec3& cameraPosition, const glm::fvec3& viewDirection, float moveThreshold);
+	void DrawSortedSegments();
+	double sortMilliseconds = 0.0;
+
+	/*
+		Shrinks the card of every segment to the part of its texture strip that is opaque in
+		extents, see AlphaExtents::SymmetricTrim. The width vectors and u texcoords at both
+		ends are scaled towards the center, so every render path draws the trimmed cards.
+		Applied by SendToGPU, null disables it. extents must outlive the mesh.
+	*/
+	void SetCardTrimming(const class AlphaExtents* extents) { cardTrimming = extents; }
+	float trimmedCardWidth = 0.0f; // fraction of the total card width removed by the last SendToGPU
+
+	GLsizei SegmentCount() const { return GLsizei(segmentFlags.size()); }
+	const std::vector<glm::fvec4>& SegmentData() const { return segmentData; }
+
+	// Appends all strips of another mesh, offset in local space. Call SendToGPU afterwards.
+	void AppendStrips(const GLBezierStrips& other, glm::fvec3 offset);
+
+protected:
+	void BuildSegmentData();
+	void TrimCards();
+	void BuildCardGroups(int shapeOverride, int subdivisionsOverride);
+};
+
+/*
+	Unit card meshes, one for each start shape, end shape and subdivision count. The last
+	division has the end shape and all others the start shape, as in hair_planes_geometry.glsl.
+	Each vertex stores {t along the segment, u across the card, thickness side, shape}, the
+	vertex shader places it on the segment curve (see hair_card_vertex.glsl).
+*/
+class GLCardTemplates : public GLMeshInterface
+{
+public:
+	static const int NUM_SHAPES = 4;
+	static const int MAX_SUBDIVISIONS = 4;
+
+protected:
+	GLBufferAllocation vertexBuffer;
+	GLBufferAllocation indexBuffer;
+
+	struct TemplateRange
+	{
+		GLsizei firstIndex = 0;
+		GLsizei count = 0;
+	};
+	TemplateRange ranges[NUM_SHAPES][NUM_SHAPES][MAX_SUBDIVISIONS];
+
+	static const GLuint instanceAttribId = 1;
+	GLuint instanceBuffer = 0; // owned by the mesh that draws indirect
+
+public:
+	GLCardTemplates();
+	~GLCardTemplates();
+
+	void DrawInstanced(int shape, int endShape, int subdivisions, GLsizei instanceCount);
+
+	// Index range of a template in the shared index buffer, for indirect draw commands
+	GLuint FirstIndex(int shape, int endShape, int subdivisions) const;
+	GLsizei IndexCount(int shape, int endShape, int subdivisions) const { return ranges[shape][endShape][subdivisions - 1].count; }
+
+	// Per instance segment id at attribute location 1, read by the INDIRECT card shader
+	void SetInstanceBuffer(GLuint buffer);
+	void DrawIndirect(GLuint commandBuffer, GLsizei drawCount);
+};
+
+/*
+	Triangles captured with transform feedback from a geometry shader. Every vertex stores
+	the world space position, normal and texcoord (interleaved, in that order), so the
+	capturing program must list the matching outputs with GLProgram::SetFeedbackVaryings.
+	The mesh can then be redrawn without running the geometry shader until it is invalidated.
+
+	The capture goes into a transform feedback object and is redrawn with glDrawTransformFeedback,
+	so the vertex count never has to come back to the CPU. Without GL 4.0 the count is read from
+	a primitives query on the first redraw instead, which waits for the capture to finish.
+*/
+class GLFeedbackMesh : public GLMeshInterface
+{
+protected:
+	GLuint vertexBuffer = 0;
+	GLuint feedbackObject = 0; // 0 without HasTransformFeedbackObjects
+	GLuint primitivesQuery = 0;
+	GLsizeiptr capacity = 0;
+
+	GLsizei numVertices = 0;
+	bool bValid = false;
+	bool bQueryPending = false;
+
+public:
+	static const GLsizei VERTEX_STRIDE = sizeof(glm::fvec3) + sizeof(glm::fvec3) + sizeof(glm::fvec4);
+
+	GLFeedbackMesh();
+	~GLFeedbackMesh();
+
+	bool IsValid() { return bValid; }
+	void Invalidate() { bValid = false; }
+
+	// Everything drawn between these calls is captured, with at most maxVertices vertices
+	void BeginCapture(GLsizei maxVertices);
+	void EndCapture();
+
 	void Draw();
 };
 
 class GLQuad : public GLMeshInterface
 {
 protected:
-	GLuint positionBuffer = 0;
-	GLuint texCoordBuffer = 0;
+	GLBufferAllocation positionBuffer;
+	GLBufferAllocation texCoordBuffer;
 
 public:
 	GLQuad();
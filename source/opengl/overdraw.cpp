@@ -0,0 +1,146 @@
+#include "overdraw.h"
+#include "renderstate.h"
+#include "glextensions.h"
+#include <algorithm>
+#include <fstream>
+
+GLOverdrawCounter::GLOverdrawCounter(int width, int height)
+	: width{ width }, height{ height }
+{
+	glGenTextures(1, &counterTexture);
+	GLState::BindTexture(0, GL_TEXTURE_2D, counterTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	glGenBuffers(1, &readbackBuffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(width) * height * sizeof(uint32_t), NULL, GL_STREAM_READ);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+GLOverdrawCounter::~GLOverdrawCounter()
+{
+	GLState::ForgetTexture(counterTexture);
+	glDeleteTextures(1, &counterTexture);
+	if (readbackFence) glDeleteSync(readbackFence);
+	glDeleteBuffers(1, &readbackBuffer);
+}
+
+void GLOverdrawCounter::BeginCounting()
+{
+	// Texture uploads are ordered before later image accesses, no barrier needed
+	zeroCounts.resize(size_t(width) * height, 0);
+	GLState::BindTexture(0, GL_TEXTURE_2D, counterTexture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, zeroCounts.data());
+	glBindImageTexture(COUNTER_IMAGE_UNIT, counterTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+}
+
+void GLOverdrawCounter::EndCounting()
+{
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+void GLOverdrawCounter::BindForDisplay()
+{
+	GLState::BindTexture(COUNTER_TEXTURE_UNIT, GL_TEXTURE_2D, counterTexture);
+}
+
+const GLOverdrawCounter::Statistics& GLOverdrawCounter::ReadStatistics()
+{
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffer);
+	if (readbackFence)
+	{
+		// Only poll, an unfinished copy keeps the old statistics and is checked again next frame
+		GLenum status = glClientWaitSync(readbackFence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+			return statistics;
+		}
+		glDeleteSync(readbackFence);
+		readbackFence = 0;
+
+		GLsizeiptr size = GLsizeiptr(width) * height * sizeof(uint32_t);
+		const uint32_t* counts = (const uint32_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (counts)
+		{
+			BuildStatistics(counts);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+	}
+
+	// The copy is queued behind the hair pass, the CPU carries on
+	GLState::BindTexture(0, GL_TEXTURE_2D, counterTexture);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	readbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	return statistics;
+}
+
+void GLOverdrawCounter::BuildStatistics(const uint32_t* counts)
+{
+	// Fragments per pixel, the last bin collects everything above it
+	const int MAX_BIN = 1023;
+	std::vector<int> histogram(MAX_BIN + 1, 0);
+	uint64_t shaded = 0;
+	uint64_t passed = 0;
+	statistics = Statistics{};
+	size_t numPixels = size_t(width) * height;
+	for (size_t pixel = 0; pixel < numPixels; ++pixel)
+	{
+		uint32_t count = counts[pixel];
+		int pixelShaded = int(count & 0xFFFF);
+		if (pixelShaded == 0) continue;
+
+		statistics.coveredPixels++;
+		statistics.maxFragments = std::max(statistics.maxFragments, pixelShaded);
+		histogram[std::min(pixelShaded, MAX_BIN)]++;
+		shaded += pixelShaded;
+		passed += count >> 16;
+	}
+
+	if (statistics.coveredPixels > 0)
+	{
+		statistics.meanFragments = double(shaded) / statistics.coveredPixels;
+		statistics.meanPassed = double(passed) / statistics.coveredPixels;
+		statistics.discardRatio = double(shaded - passed) / double(shaded);
+
+		int p95Count = (statistics.coveredPixels * 95 + 99) / 100;
+		int accumulated = 0;
+		for (int bin = 1; bin <= MAX_BIN; ++bin)
+		{
+			accumulated += histogram[bin];
+			if (accumulated >= p95Count)
+			{
+				statistics.p95Fragments = bin;
+				break;
+			}
+		}
+	}
+}
+
+bool GLOverdrawCounter::SaveStatistics(std::filesystem::path filePath, const std::string& label) const
+{
+	bool bNewFile = !std::filesystem::exists(filePath);
+	std::ofstream file(filePath, std::ios::app);
+	if (!file)
+	{
+		return false;
+	}
+
+	if (bNewFile)
+	{
+		file << "label,covered pixels,mean overdraw,p95 overdraw,max overdraw,mean passed,discard ratio\n";
+	}
+	file << label << ","
+		<< statistics.coveredPixels << ","
+		<< statistics.meanFragments << ","
+		<< statistics.p95Fragments << ","
+		<< statistics.maxFragments << ","
+		<< statistics.meanPassed << ","
+		<< statistics.discardRatio << "\n";
+	return bool(file);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <filesystem>
+#include "glad/glad.h"
+
+/*
+	Counts hair fragments per pixel for the overdraw heatmap.
+
+	The hair fragment shader compiled with OVERDRAW does one imageAtomicAdd per invocation
+	into an R32UI image of the window size. The low 16 bits count the shaded fragments and
+	the high 16 bits the ones that pass the alpha test, so the discards are the difference.
+	ReadStatistics copies the image into a pixel pack buffer and builds a histogram over the
+	pixels that were touched once a later frame finds the copy done, so the statistics lag a
+	frame or two behind instead of stalling the pipeline.
+	Requires HasComputeShader (image load/store).
+*/
+class GLOverdrawCounter
+{
+public:
+	static const GLuint COUNTER_IMAGE_UNIT = 1;
+	static const GLuint COUNTER_TEXTURE_UNIT = 8;
+
+	struct Statistics
+	{
+		int coveredPixels = 0;      // pixels with at least one fragment
+		double meanFragments = 0.0; // per covered pixel
+		int p95Fragments = 0;
+		int maxFragments = 0;
+		double meanPassed = 0.0;    // fragments that survive the alpha test, per covered pixel
+		double discardRatio = 0.0;  // discarded / shaded
+	};
+
+protected:
+	GLuint counterTexture = 0;
+	GLuint readbackBuffer = 0;
+	GLsync readbackFence = 0; // set while a copy into readbackBuffer is in flight
+	int width = 0;
+	int height = 0;
+	std::vector<uint32_t> zeroCounts; // uploaded to clear the counters
+	Statistics statistics;
+
+	void BuildStatistics(const uint32_t* counts);
+
+public:
+	GLOverdrawCounter(int width, int height);
+	~GLOverdrawCounter();
+
+	GLOverdrawCounter(const GLOverdrawCounter& other) = delete;
+
+	// Zeroes the counters and binds them for the OVERDRAW variant of the hair program
+	void BeginCounting();
+
+	// Makes the atomic writes visible to texture fetches and the read back
+	void EndCounting();
+
+	// Binds the counters as a usampler2D for the heatmap (overdraw_fragment.glsl)
+	void BindForDisplay();
+
+	// Updates the statistics from the previous copy if the GPU has finished it and starts a new one.
+	// Call after EndCounting.
+	const Statistics& ReadStatistics();
+	const Statistics& GetStatistics() const { return statistics; }
+
+	// Appends the last statistics as one csv line, with a header when the file is new
+	bool SaveStatistics(std::filesystem::path filePath, const std::string& label) const;
+};
@@ -0,0 +1,208 @@
+#include "packedtexture.h"
+#include "renderstate.h"
+#include "../core/mipmaps.h"
+#include "../core/blockcompression.h"
+#include "../core/utilities.h"
+#include "../thirdparty/lodepng.h"
+#include <chrono>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+// Bumped whenever the encoder or the file layout changes
+static const uint32_t CACHE_VERSION = 2;
+static const uint32_t CACHE_MAGIC = 0x35434248; // "HBC5"
+
+// Decodes a png and copies its red channel into channel of the packed image
+static bool PackChannel(fs::path imagePath, std::vector<uint8_t>& packed, int& width, int& height, int channel, uint64_t& hash)
+{
+	std::vector<char> file;
+	if (!LoadBinary(imagePath, file))
+	{
+		wprintf(L"\r\nFailed to load texture: %Ls\r\n", imagePath.c_str());
+		return false;
+	}
+	hash = HashBytes(file.data(), file.size(), hash);
+
+	std::vector<unsigned char> image;
+	unsigned imageWidth = 0, imageHeight = 0;
+	unsigned error = lodepng::decode(image, imageWidth, imageHeight, (const unsigned char*)file.data(), file.size());
+	if (error)
+	{
+		printf("\r\ndecoder error %u: %s\r\n", error, lodepng_error_text(error));
+		return false;
+	}
+
+	if (packed.empty())
+	{
+		width = int(imageWidth);
+		height = int(imageHeight);
+		packed.assign(size_t(width) * height * 4, 0);
+		for (size_t i = 3; i < packed.size(); i += 4)
+		{
+			packed[i] = 255;
+		}
+	}
+	else if (int(imageWidth) != width || int(imageHeight) != height)
+	{
+		wprintf(L"\r\nPacked texture sizes differ: %Ls\r\n", imagePath.c_str());
+		return false;
+	}
+
+	for (size_t i = 0; i < packed.size(); i += 4)
+	{
+		packed[i + channel] = image[i];
+	}
+	return true;
+}
+
+GLPackedTexture::GLPackedTexture(fs::path redImage, fs::path greenImage, fs::path cacheFolder)
+	: cacheFolder{ cacheFolder }
+{
+	glGenTextures(1, &textureId);
+
+	sourceHash = HASH_SEED;
+	if (!PackChannel(redImage, packed, width, height, 0, sourceHash) ||
+		!PackChannel(greenImage, packed, width, height, 1, sourceHash))
+	{
+		packed.clear();
+		width = height = 0;
+	}
+}
+
+GLPackedTexture::~GLPackedTexture()
+{
+	GLState::ForgetTexture(textureId);
+	glDeleteTextures(1, &textureId);
+}
+
+void GLPackedTexture::Build(float coverageCutoff)
+{
+	if (packed.empty())
+	{
+		return;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// One file per pair of images, a new cutoff overwrites it instead of adding a file per slider value
+	uint64_t key = HashBytes(&CACHE_VERSION, sizeof(CACHE_VERSION), sourceHash);
+	fs::path cacheFile = cacheFolder.empty() ? fs::path{} : cacheFolder / (HashToHex(key) + ".bc5");
+
+	std::vector<Level> levels;
+	bLoadedFromCache = !cacheFile.empty() && LoadCache(cacheFile, coverageCutoff, levels);
+	if (!bLoadedFromCache)
+	{
+		std::vector<Mipmaps::Level> mips = Mipmaps::Generate(packed.data(), width, height, 1, coverageCutoff);
+
+		levels.resize(mips.size() + 1);
+		for (size_t i = 0; i < levels.size(); ++i)
+		{
+			Level& level = levels[i];
+			level.width = (i == 0) ? width : mips[i - 1].width;
+			level.height = (i == 0) ? height : mips[i - 1].height;
+			const uint8_t* pixels = (i == 0) ? packed.data() : mips[i - 1].pixels.data();
+			level.blocks = BlockCompression::EncodeBC5(pixels, level.width, level.height, 0, 1);
+		}
+
+		if (!cacheFile.empty())
+		{
+			SaveCache(cacheFile, coverageCutoff, levels);
+		}
+	}
+
+	GLState::BindTexture(0, GL_TEXTURE_2D, textureId);
+	compressedBytes = 0;
+	uncompressedBytes = 0;
+	for (size_t i = 0; i < levels.size(); ++i)
+	{
+		const Level& level = levels[i];
+		glCompressedTexImage2D(GL_TEXTURE_2D, GLint(i), GL_COMPRESSED_RG_RGTC2, level.width, level.height, 0, GLsizei(level.blocks.size()), level.blocks.data());
+		compressedBytes += level.blocks.size();
+		uncompressedBytes += size_t(level.width) * level.height * 4 * 2;
+	}
+
+	mipLevels = int(levels.size());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, mipLevels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+	auto end = std::chrono::high_resolution_clock::now();
+	buildMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void GLPackedTexture::UseForDrawing(unsigned int textureUnit)
+{
+	GLState::BindTexture(textureUnit, GL_TEXTURE_2D, textureId);
+}
+
+bool GLPackedTexture::LoadCache(fs::path cacheFile, float coverageCutoff, std::vector<Level>& levels)
+{
+	std::vector<char> data;
+	if (!LoadBinary(cacheFile, data))
+	{
+		return false;
+	}
+
+	// File layout: magic, cutoff, level count, then width, height and block bytes of each level
+	size_t offset = 0;
+	auto Read = [&](void* target, size_t size) -> bool {
+		if (offset + size > data.size()) return false;
+		memcpy(target, data.data() + offset, size);
+		offset += size;
+		return true;
+	};
+
+	uint32_t magic = 0, numLevels = 0;
+	float cachedCutoff = 0.0f;
+	if (!Read(&magic, 4) || magic != CACHE_MAGIC || !Read(&cachedCutoff, 4) || cachedCutoff != coverageCutoff || !Read(&numLevels, 4))
+	{
+		return false;
+	}
+
+	levels.resize(numLevels);
+	for (Level& level : levels)
+	{
+		uint32_t levelWidth = 0, levelHeight = 0;
+		if (!Read(&levelWidth, 4) || !Read(&levelHeight, 4))
+		{
+			return false;
+		}
+		level.width = int(levelWidth);
+		level.height = int(levelHeight);
+		level.blocks.resize(BlockCompression::BC5Size(level.width, level.height));
+		if (!Read(level.blocks.data(), level.blocks.size()))
+		{
+			return false;
+		}
+	}
+	return !levels.empty() && levels[0].width == width && levels[0].height == height;
+}
+
+void GLPackedTexture::SaveCache(fs::path cacheFile, float coverageCutoff, const std::vector<Level>& levels)
+{
+	std::vector<char> data;
+	auto Write = [&](const void* source, size_t size) -> void {
+		const char* bytes = (const char*)source;
+		data.insert(data.end(), bytes, bytes + size);
+	};
+
+	uint32_t numLevels = uint32_t(levels.size());
+	Write(&CACHE_MAGIC, 4);
+	Write(&coverageCutoff, 4);
+	Write(&numLevels, 4);
+	for (const Level& level : levels)
+	{
+		uint32_t levelWidth = uint32_t(level.width), levelHeight = uint32_t(level.height);
+		Write(&levelWidth, 4);
+		Write(&levelHeight, 4);
+		Write(level.blocks.data(), level.blocks.size());
+	}
+
+	if (!SaveBinary(cacheFile, data.data(), data.size()))
+	{
+		wprintf(L"\r\nFailed to write texture cache: %Ls\r\n", cacheFile.c_str());
+	}
+}
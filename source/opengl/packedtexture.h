@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include "glad/glad.h"
+
+/*
+	Two single channel masks in one BC5 (GL_COMPRESSED_RG_RGTC2) texture, so a shader reads
+	both with a single fetch. Red comes from the first image and green from the second, both
+	from their red channel.
+
+	Green is treated as an alpha mask: the mip chain is built with Mipmaps::Generate, which
+	keeps its coverage at the cutoff, and every level is encoded with BlockCompression. BC5
+	takes 1 byte per texel against 4 for each of the two RGBA8 textures it replaces. The
+	encoded chain is cached on disk under a hash of both images, the file keeps the chain of
+	the last cutoff only.
+*/
+class GLPackedTexture
+{
+protected:
+	struct Level
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<uint8_t> blocks;
+	};
+
+	GLuint textureId = 0;
+	std::vector<uint8_t> packed; // RGBA8 level 0 with the masks in red and green
+	uint64_t sourceHash = 0;
+	std::filesystem::path cacheFolder;
+
+	bool LoadCache(std::filesystem::path cacheFile, float coverageCutoff, std::vector<Level>& levels);
+	void SaveCache(std::filesystem::path cacheFile, float coverageCutoff, const std::vector<Level>& levels);
+
+public:
+	int width = 0;
+	int height = 0;
+	int mipLevels = 0;
+	size_t compressedBytes = 0;
+	size_t uncompressedBytes = 0; // two RGBA8 textures with the same mips
+	double buildMilliseconds = 0.0;
+	bool bLoadedFromCache = false;
+
+	// An empty cacheFolder disables the disk cache
+	GLPackedTexture(std::filesystem::path redImage, std::filesystem::path greenImage, std::filesystem::path cacheFolder);
+	~GLPackedTexture();
+
+	GLPackedTexture(const GLPackedTexture& other) = delete;
+
+	// Loads or encodes the mip chain for the alpha cutoff of the green channel and uploads it
+	void Build(float coverageCutoff);
+
+	void UseForDrawing(unsigned int textureUnit = 0);
+	GLuint Id() const { return textureId; }
+
+	// Level 0 on the CPU, RGBA8
+	const std::vector<uint8_t>& Pixels() const { return packed; }
+};
@@ -1,31 +1,11 @@
 #include "program.h"
+#include "glextensions.h"
+#include "renderstate.h"
 
 #include <string>
 #include <iostream>
-
-GLUBO::GLUBO()
-{
-	glGenBuffers(1, &uboId);
-}
-
-GLUBO::~GLUBO()
-{
-	glDeleteBuffers(1, &uboId);
-}
-
-void GLUBO::Bind(GLuint point)
-{
-	glBindBufferBase(GL_UNIFORM_BUFFER, point, uboId);
-}
-
-void GLUBO::Allocate(GLuint numbytes)
-{
-	glBindBuffer(GL_UNIFORM_BUFFER, uboId);
-	glBufferData(GL_UNIFORM_BUFFER, numbytes, NULL, GL_STATIC_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	allocated_size = numbytes;
-}
+#include <algorithm>
+#include <cstring>
 
 GLProgram::GLProgram()
 {
@@ -37,6 +17,7 @@ GLProgram::GLProgram()
 
 GLProgram::~GLProgram()
 {
+	GLState::ForgetProgram(programId);
 	glDeleteProgram(programId);
 	glDeleteShader(vertex_shader_id);
 	glDeleteShader(fragment_shader_id);
@@ -45,6 +26,11 @@ GLProgram::~GLProgram()
 	{
 		glDeleteShader(geometry_shader_id);
 	}
+
+	if (IsComputeProgram())
+	{
+		glDeleteShader(compute_shader_id);
+	}
 }
 
 void GLProgram::LoadFragmentShader(std::string shaderText)
@@ -73,10 +59,36 @@ void GLProgram::LoadGeometryShader(std::string shaderText)
 	glShaderSource(geometry_shader_id, 1, &geometrySourcePtr, &sourceLength);
 }
 
-GLint CompileAndPrintStatus(GLuint glShaderId)
+void GLProgram::LoadComputeShader(std::string shaderText)
+{
+	if (!IsComputeProgram())
+	{
+		compute_shader_id = glCreateShader(GL_COMPUTE_SHADER);
+	}
+
+	GLint sourceLength = (GLint)shaderText.size();
+	const char* computeSourcePtr = shaderText.c_str();
+	glShaderSource(compute_shader_id, 1, &computeSourcePtr, &sourceLength);
+}
+
+std::vector<GLuint> GLProgram::Stages()
+{
+	if (IsComputeProgram())
+	{
+		return { GLuint(compute_shader_id) };
+	}
+
+	std::vector<GLuint> stages = { GLuint(vertex_shader_id), GLuint(fragment_shader_id) };
+	if (HasGeometryShader())
+	{
+		stages.push_back(GLuint(geometry_shader_id));
+	}
+	return stages;
+}
+
+GLint PrintCompileStatus(GLuint glShaderId)
 {
 	GLint compileStatus = 0;
-	glCompileShader(glShaderId);
 	glGetShaderiv(glShaderId, GL_COMPILE_STATUS, &compileStatus);
 
 	if (compileStatus == GL_FALSE)
@@ -97,22 +109,49 @@ GLint CompileAndPrintStatus(GLuint glShaderId)
 			message = std::string(infoLog.get());
 		}
 
-		std::cout << L"GL_INFO_LOG: " << message;
+		std::cout << "GL_INFO_LOG: " << message;
 	}
 
 	return compileStatus;
 }
 
+GLint CompileAndPrintStatus(GLuint glShaderId)
+{
+	glCompileShader(glShaderId);
+	return PrintCompileStatus(glShaderId);
+}
+
 GLint GLProgram::LinkAndPrintStatus()
 {
-	glAttachShader(programId, vertex_shader_id);
-	glAttachShader(programId, fragment_shader_id);
-	if (HasGeometryShader())
+	AttachAndLink();
+	return CheckLinkStatus();
+}
+
+void GLProgram::AttachAndLink()
+{
+	for (GLuint stage : Stages())
 	{
-		glAttachShader(programId, geometry_shader_id);
+		glAttachShader(programId, stage);
+	}
+
+	if (feedbackVaryings.size() > 0)
+	{
+		std::vector<const GLchar*> names;
+		for (auto& name : feedbackVaryings)
+		{
+			names.push_back(name.c_str());
+		}
+		glTransformFeedbackVaryings(programId, GLsizei(names.size()), names.data(), GL_INTERLEAVED_ATTRIBS);
+	}
+	if (bBinaryRetrievable)
+	{
+		glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 	}
 	glLinkProgram(programId);
+}
 
+GLint GLProgram::CheckLinkStatus()
+{
 	GLint linkStatus = 0;
 	glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
 	if (linkStatus == GL_FALSE)
@@ -134,33 +173,30 @@ GLint GLProgram::LinkAndPrintStatus()
 			message = std::string(infoLog.get());
 		}
 
-		std::cout << L"GL_INFO_LOG: " << message;
+		std::cout << "GL_INFO_LOG: " << message;
 		return 0;
 	} 
 
-	glDetachShader(programId, vertex_shader_id);
-	glDetachShader(programId, fragment_shader_id);
-	if (HasGeometryShader())
+	for (GLuint stage : Stages())
 	{
-		glDetachShader(programId, geometry_shader_id);
+		glDetachShader(programId, stage);
 	}
 
+	revision++;
 	return linkStatus;
 }
 
 void GLProgram::CompileAndLink()
 {
-	bool VertexShaderCompiled   = CompileAndPrintStatus(vertex_shader_id)   == GL_TRUE;
-	bool FragmentShaderCompiled = CompileAndPrintStatus(fragment_shader_id) == GL_TRUE;
-	bool GeometryShaderCompiled = true; // optional
-	if (HasGeometryShader())
+	bool bCompiled = true;
+	for (GLuint stage : Stages())
 	{
-		GeometryShaderCompiled = CompileAndPrintStatus(geometry_shader_id) == GL_TRUE;
+		bCompiled = (CompileAndPrintStatus(stage) == GL_TRUE) && bCompiled; // print every failing stage
 	}
 
-	if (!VertexShaderCompiled || !FragmentShaderCompiled || !GeometryShaderCompiled)
+	if (!bCompiled)
 	{
-		std::cout << L"Failed to compile shaders\n";
+		std::cout << "Failed to compile shaders\n";
 	}
 	else if (LinkAndPrintStatus() == GL_TRUE)
 	{
@@ -172,137 +208,260 @@ void GLProgram::CompileAndLink()
 	}
 }
 
-void GLProgram::Use()
+void GLProgram::CompileAndLinkAsync()
 {
-	glUseProgram(programId);
+	// No status queries here, they would wait for the driver to finish
+	for (GLuint stage : Stages())
+	{
+		glCompileShader(stage);
+	}
+	AttachAndLink();
+	bLinkPending = true;
 }
 
-GLuint GLProgram::Id()
+bool GLProgram::IsLinkPending()
 {
-	return programId;
+	if (!bLinkPending || !HasParallelShaderCompile())
+	{
+		return false; // without the extension FinishLink simply blocks
+	}
+
+	GLint complete = GL_FALSE;
+	glGetProgramiv(programId, GL_COMPLETION_STATUS_KHR, &complete);
+	return complete == GL_FALSE;
 }
 
-void GLProgram::SetUniformInt(std::string name, int value)
+bool GLProgram::FinishLink()
 {
-	if (intUniforms.count(name) == 0)
-	{
-		intUniforms[name] = {
-			glGetUniformLocation(programId, name.c_str()),
-			value
-		};
-		intUniforms[name].Upload();
-	}
-	else
+	bLinkPending = false;
+
+	bool bCompiled = true;
+	for (GLuint stage : Stages())
 	{
-		auto& u = intUniforms[name];
-		u.value = value;
-		u.Upload();
+		bCompiled = (PrintCompileStatus(stage) == GL_TRUE) && bCompiled;
 	}
-}
 
-void GLProgram::SetUniformFloat(std::string name, float value)
-{
-	if (floatUniforms.count(name) == 0)
+	if (!bCompiled)
 	{
-		floatUniforms[name] = {
-			glGetUniformLocation(programId, name.c_str()),
-			value
-		};
-		floatUniforms[name].Upload();
+		std::cout << "Failed to compile shaders\n";
+		return false;
 	}
-	else
+
+	if (CheckLinkStatus() != GL_TRUE)
 	{
-		auto& u = floatUniforms[name];
-		u.value = value;
-		u.Upload();
+		return false;
 	}
+
+	ReloadUniforms();
+	return true;
+}
+
+void GLProgram::AdoptProgram(GLProgram& other)
+{
+	// The other program now owns the old objects and deletes them when destroyed
+	std::swap(programId, other.programId);
+	std::swap(vertex_shader_id, other.vertex_shader_id);
+	std::swap(fragment_shader_id, other.fragment_shader_id);
+	std::swap(geometry_shader_id, other.geometry_shader_id);
+	std::swap(compute_shader_id, other.compute_shader_id);
+
+	revision++;
+	ReloadUniforms();
 }
 
-void GLProgram::SetUniformVec3(std::string name, glm::fvec3 value)
+bool GLProgram::GetProgramBinary(GLenum& format, std::vector<char>& binary)
 {
-	if (vec3Uniforms.count(name) == 0)
+	GLint length = 0;
+	glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
 	{
-		vec3Uniforms[name] = {
-			glGetUniformLocation(programId, name.c_str()),
-			value
-		};
-		vec3Uniforms[name].Upload();
+		return false;
 	}
-	else
+
+	binary.resize(length);
+	GLsizei written = 0;
+	glGetProgramBinary(programId, length, &written, &format, binary.data());
+	binary.resize(written);
+	return written > 0;
+}
+
+bool GLProgram::LoadProgramBinary(GLenum format, const void* binary, GLsizei length)
+{
+	// The driver rejects binaries from other versions or hardware by failing the link
+	glProgramBinary(programId, format, binary, length);
+
+	GLint linkStatus = 0;
+	glGetProgramiv(programId, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus == GL_FALSE)
 	{
-		auto& u = vec3Uniforms[name];
-		u.value = value;
-		u.Upload();
+		return false;
 	}
+
+	revision++;
+	ReloadUniforms();
+	return true;
 }
 
-void GLProgram::SetUniformVec4(std::string name, glm::fvec4 value)
+void GLProgram::Use()
 {
-	if (vec4Uniforms.count(name) == 0)
+	GLState::UseProgram(programId);
+}
+
+GLuint GLProgram::Id()
+{
+	return programId;
+}
+
+void GLProgram::SetFeedbackVaryings(std::vector<std::string> names)
+{
+	feedbackVaryings = names;
+}
+
+UniformHandle GLProgram::GetUniformHandle(const std::string& name)
+{
+	auto it = uniformHandles.find(name);
+	if (it != uniformHandles.end())
 	{
-		vec4Uniforms[name] = {
-			glGetUniformLocation(programId, name.c_str()),
-			value
-		};
-		vec4Uniforms[name].Upload();
+		return it->second;
 	}
-	else
+
+	UniformHandle handle = UniformHandle(uniforms.size());
+	uniforms.emplace_back();
+	uniforms.back().name = name;
+	uniforms.back().location = (revision > 0) ? glGetUniformLocation(programId, name.c_str()) : -1;
+	uniformHandles[name] = handle;
+	return handle;
+}
+
+void GLProgram::MarkDirty(UniformHandle handle)
+{
+	ProgramUniform& u = uniforms[handle];
+	u.bAssigned = true;
+	if (!u.bDirty && u.location != -1)
 	{
-		auto& u = vec4Uniforms[name];
-		u.value = value;
-		u.Upload();
+		u.bDirty = true;
+		dirtyUniforms.push_back(handle);
 	}
 }
 
-void GLProgram::SetUniformMat4(std::string name, glm::mat4 value)
+void GLProgram::SetUniformInt(UniformHandle handle, int value)
 {
-	if (mat4Uniforms.count(name) == 0)
+	ProgramUniform& u = uniforms[handle];
+	if (u.bAssigned && u.kind == UniformKind::Int && u.intValue == value)
 	{
-		mat4Uniforms[name] = {
-			glGetUniformLocation(programId, name.c_str()),
-			value
-		};
-		mat4Uniforms[name].Upload();
+		return;
 	}
-	else
+
+	u.kind = UniformKind::Int;
+	u.intValue = value;
+	MarkDirty(handle);
+}
+
+void GLProgram::SetUniformFloats(UniformHandle handle, UniformKind kind, const float* values, int count)
+{
+	ProgramUniform& u = uniforms[handle];
+	float* stored = glm::value_ptr(u.floatValue);
+	if (u.bAssigned && u.kind == kind && memcmp(stored, values, count * sizeof(float)) == 0)
 	{
-		auto& u = mat4Uniforms[name];
-		u.value = value;
-		u.Upload();
+		return;
 	}
+
+	u.kind = kind;
+	memcpy(stored, values, count * sizeof(float));
+	MarkDirty(handle);
 }
 
-void GLProgram::ReloadUniforms()
+void GLProgram::SetUniformFloat(UniformHandle handle, float value)
 {
-	Use();
+	SetUniformFloats(handle, UniformKind::Float, &value, 1);
+}
 
-	for (auto& u : intUniforms)
-	{
-		u.second.id = glGetUniformLocation(programId, u.first.c_str());
-		u.second.Upload();
-	}
+void GLProgram::SetUniformVec3(UniformHandle handle, glm::fvec3 value)
+{
+	SetUniformFloats(handle, UniformKind::Vec3, glm::value_ptr(value), 3);
+}
+
+void GLProgram::SetUniformVec4(UniformHandle handle, glm::fvec4 value)
+{
+	SetUniformFloats(handle, UniformKind::Vec4, glm::value_ptr(value), 4);
+}
 
-	for (auto& u : floatUniforms)
+void GLProgram::SetUniformMat4(UniformHandle handle, const glm::mat4& value)
+{
+	SetUniformFloats(handle, UniformKind::Mat4, glm::value_ptr(value), 16);
+}
+
+void GLProgram::FlushUniforms()
+{
+	for (UniformHandle handle : dirtyUniforms)
 	{
-		u.second.id = glGetUniformLocation(programId, u.first.c_str());
-		u.second.Upload();
+		ProgramUniform& u = uniforms[handle];
+		u.Upload();
+		u.bDirty = false;
 	}
+	dirtyUniforms.clear();
+}
 
-	for (auto& u : vec3Uniforms)
+void GLProgram::ReflectUniforms()
+{
+	// Locations change on relink, uniforms no longer in use keep their handle with location -1
+	for (ProgramUniform& u : uniforms)
 	{
-		u.second.id = glGetUniformLocation(programId, u.first.c_str());
-		u.second.Upload();
+		u.location = -1;
 	}
 
-	for (auto& u : vec4Uniforms)
+	GLint count = 0, maxLength = 0;
+	glGetProgramiv(programId, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(programId, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<GLchar> nameBuffer(std::max(maxLength, 1));
+
+	for (GLint i = 0; i < count; ++i)
 	{
-		u.second.id = glGetUniformLocation(programId, u.first.c_str());
-		u.second.Upload();
+		GLint size = 0;
+		GLenum type = 0;
+		GLsizei length = 0;
+		glGetActiveUniform(programId, GLuint(i), GLsizei(nameBuffer.size()), &length, &size, &type, nameBuffer.data());
+
+		// Block members have no location, they are set through uniform buffers
+		std::string name(nameBuffer.data(), length);
+		GLint location = glGetUniformLocation(programId, name.c_str());
+		if (location == -1)
+		{
+			continue;
+		}
+
+		ProgramUniform& u = uniforms[GetUniformHandle(name)];
+		u.location = location;
+		if (!u.bAssigned)
+		{
+			switch (type)
+			{
+			case GL_FLOAT:      u.kind = UniformKind::Float; break;
+			case GL_FLOAT_VEC3: u.kind = UniformKind::Vec3; break;
+			case GL_FLOAT_VEC4: u.kind = UniformKind::Vec4; break;
+			case GL_FLOAT_MAT4: u.kind = UniformKind::Mat4; break;
+			default:            u.kind = UniformKind::Int; break; // int, bool and samplers
+			}
+		}
 	}
+}
+
+void GLProgram::ReloadUniforms()
+{
+	ReflectUniforms();
 
-	for (auto& u : mat4Uniforms)
+	// A relinked program starts from the glsl initializers, restore the assigned values
+	dirtyUniforms.clear();
+	for (UniformHandle handle = 0; handle < UniformHandle(uniforms.size()); ++handle)
 	{
-		u.second.id = glGetUniformLocation(programId, u.first.c_str());
-		u.second.Upload();
+		ProgramUniform& u = uniforms[handle];
+		u.bDirty = false;
+		if (u.bAssigned)
+		{
+			MarkDirty(handle);
+		}
 	}
+
+	Use();
+	FlushUniforms();
 }
@@ -1,96 +1,47 @@
 #pragma once
 #include <string>
 #include <map>
+#include <vector>
 #include "glad/glad.h"
 #include "../core/math.h"
 
-struct UniformInt
-{
-	GLint id = 0;
-	GLint value = 0;
-
-	void Upload()
-	{
-		glUniform1i(id, value);
-	}
-};
+/*
+	Uniform values are cached on the CPU and only uploaded when they change.
 
-struct UniformFloat
-{
-	GLint id = 0;
-	float value = 0.0f;
-
-	void Upload()
-	{
-		glUniform1f(id, value);
-	}
-};
+	Set* marks a value dirty, FlushUniforms uploads the dirty values to the bound program.
+	Handles are indices into GLProgram::uniforms and stay valid across relinks, so they can
+	be looked up once and reused every frame instead of hashing the name on every call.
+*/
+typedef int UniformHandle;
 
-struct UniformVec3
+enum class UniformKind
 {
-	GLint id = 0;
-	glm::fvec3 value = glm::fvec3{0.0f};
-
-	void Upload()
-	{
-		glUniform3fv(id, 1, glm::value_ptr(value));
-	}
-};
-
-struct UniformVec4
-{
-	GLint id = 0;
-	glm::fvec4 value = glm::fvec4{ 0.0f };
-
-	void Upload()
-	{
-		glUniform4fv(id, 1, glm::value_ptr(value));
-	}
+	Int, Float, Vec3, Vec4, Mat4
 };
 
-struct UniformMat4
+struct ProgramUniform
 {
-	GLint id = 0;
-	glm::mat4 value = glm::mat4{ 1.0f };
+	std::string name;
+	GLint location = -1;   // -1 when the linked program does not use the uniform
+	UniformKind kind = UniformKind::Int;
+	bool bAssigned = false; // false while the glsl initializer is in effect
+	bool bDirty = false;
+	GLint intValue = 0;
+	glm::mat4 floatValue = glm::mat4{ 0.0f }; // float, vec3 and vec4 use the first column
 
 	void Upload()
 	{
-		glUniformMatrix4fv(id, 1, GL_FALSE, glm::value_ptr(value));
+		switch (kind)
+		{
+		case UniformKind::Int:   glUniform1i(location, intValue); break;
+		case UniformKind::Float: glUniform1f(location, floatValue[0][0]); break;
+		case UniformKind::Vec3:  glUniform3fv(location, 1, glm::value_ptr(floatValue[0])); break;
+		case UniformKind::Vec4:  glUniform4fv(location, 1, glm::value_ptr(floatValue[0])); break;
+		case UniformKind::Mat4:  glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(floatValue)); break;
+		}
 	}
 };
 
-class GLUBO
-{
-protected:
-	GLuint uboId = 0;
-	GLuint allocated_size = 0;
-
-public:
-	GLUBO();
-	~GLUBO();
-
-	// Set point to the same binding value as used in the glsl shader
-	void Bind(GLuint point);
-
-	void Allocate(GLuint numbytes);
-
-	template<typename T>
-	void SetData(T* data, GLuint offset, GLuint numbytes)
-	{
-		assert((offset+numbytes) <= allocated_size);
-
-		glBindBuffer(GL_UNIFORM_BUFFER, uboId);
-		glBufferSubData(GL_UNIFORM_BUFFER, offset, numbytes, data);
-		glBindBuffer(GL_UNIFORM_BUFFER, 0);
-	}
-
-	/*
-		See this article for a more efficient way of setting up
-		an UBO with a struct and memcpy.
-		https://www.geeks3d.com/20140704/gpu-buffers-introduction-to-opengl-3-1-uniform-buffers-objects/
-	*/
-};
-
 class GLProgram
 {
 protected:
@@ -98,12 +49,25 @@ protected:
 	GLint vertex_shader_id = 0;
 	GLint fragment_shader_id = 0;
 	GLint geometry_shader_id = -1; // optional
+	GLint compute_shader_id = -1;  // optional, a compute program has no other stages
+	GLuint revision = 0; // incremented on every successful link
+	bool bBinaryRetrievable = false;
+	bool bLinkPending = false;
+
+	// Outputs captured with transform feedback, must be known before linking
+	std::vector<std::string> feedbackVaryings;
+
+	std::vector<ProgramUniform> uniforms;
+	std::map<std::string, UniformHandle> uniformHandles;
+	std::vector<UniformHandle> dirtyUniforms;
 
-	std::map<std::string, UniformInt> intUniforms;
-	std::map<std::string, UniformFloat> floatUniforms;
-	std::map<std::string, UniformVec3> vec3Uniforms;
-	std::map<std::string, UniformVec4> vec4Uniforms;
-	std::map<std::string, UniformMat4> mat4Uniforms;
+	std::vector<GLuint> Stages();
+	void AttachAndLink();
+	GLint CheckLinkStatus();
+
+	void ReflectUniforms();
+	void MarkDirty(UniformHandle handle);
+	void SetUniformFloats(UniformHandle handle, UniformKind kind, const float* values, int count);
 
 public:
 	GLProgram();
@@ -113,14 +77,49 @@ public:
 	void LoadFragmentShader(std::string shaderText);
 	void LoadVertexShader(std::string shaderText);
 	void LoadGeometryShader(std::string shaderText);
+
+	// Requires GL 4.3 or ARB_compute_shader, see HasComputeShader
+	bool IsComputeProgram() { return compute_shader_id != -1; }
+	void LoadComputeShader(std::string shaderText);
 	GLint LinkAndPrintStatus();
 	void CompileAndLink();
+
+	/*
+		Background compilation for live editing, used together with KHR_parallel_shader_compile.
+		Poll IsLinkPending once per frame and call FinishLink when it returns false. On success
+		the program can be moved into the one used for drawing with AdoptProgram.
+	*/
+	void CompileAndLinkAsync();
+	bool IsLinkPending();
+	bool FinishLink();
+	void AdoptProgram(GLProgram& other);
 	void Use();
 	GLuint Id();
-	void SetUniformInt(std::string name, int value);
-	void SetUniformFloat(std::string name, float value);
-	void SetUniformVec3(std::string name, glm::fvec3 value);
-	void SetUniformVec4(std::string name, glm::fvec4 value);
-	void SetUniformMat4(std::string name, glm::mat4 value);
+	GLuint Revision() { return revision; }
+	void SetFeedbackVaryings(std::vector<std::string> names);
+	const std::vector<std::string>& FeedbackVaryings() { return feedbackVaryings; }
+
+	// Requires GL 4.1 or ARB_get_program_binary, see HasProgramBinary
+	void SetBinaryRetrievable(bool bRetrievable) { bBinaryRetrievable = bRetrievable; }
+	bool GetProgramBinary(GLenum& format, std::vector<char>& binary);
+	bool LoadProgramBinary(GLenum format, const void* binary, GLsizei length);
+
+	// Creates the handle if the name is not known yet (e.g. before the first link)
+	UniformHandle GetUniformHandle(const std::string& name);
+
+	void SetUniformInt(UniformHandle handle, int value);
+	void SetUniformFloat(UniformHandle handle, float value);
+	void SetUniformVec3(UniformHandle handle, glm::fvec3 value);
+	void SetUniformVec4(UniformHandle handle, glm::fvec4 value);
+	void SetUniformMat4(UniformHandle handle, const glm::mat4& value);
+
+	void SetUniformInt(const std::string& name, int value) { SetUniformInt(GetUniformHandle(name), value); }
+	void SetUniformFloat(const std::string& name, float value) { SetUniformFloat(GetUniformHandle(name), value); }
+	void SetUniformVec3(const std::string& name, glm::fvec3 value) { SetUniformVec3(GetUniformHandle(name), value); }
+	void SetUniformVec4(const std::string& name, glm::fvec4 value) { SetUniformVec4(GetUniformHandle(name), value); }
+	void SetUniformMat4(const std::string& name, const glm::mat4& value) { SetUniformMat4(GetUniformHandle(name), value); }
+
+	// Uploads the values changed since the last flush, the program must be in use
+	void FlushUniforms();
 	void ReloadUniforms();
 };
@@ -0,0 +1,174 @@
+#include "renderstate.h"
+#include <unordered_map>
+
+// Value that never matches a real binding, used for state that has not been set yet
+static const GLuint UNKNOWN_STATE = 0xFFFFFFFF;
+
+// Texture targets with a cached binding per unit, other targets are always bound
+static const GLenum CACHED_TEXTURE_TARGETS[] = {
+	GL_TEXTURE_2D, GL_TEXTURE_BUFFER, GL_TEXTURE_3D, GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_2D_ARRAY
+};
+static const int NUM_CACHED_TEXTURE_TARGETS = sizeof(CACHED_TEXTURE_TARGETS) / sizeof(GLenum);
+
+struct StateCache
+{
+	GLuint program = UNKNOWN_STATE;
+	GLuint vao = UNKNOWN_STATE;
+	GLuint activeUnit = UNKNOWN_STATE;
+	GLuint textures[GLState::MAX_TEXTURE_UNITS][NUM_CACHED_TEXTURE_TARGETS];
+	GLenum polygonMode = UNKNOWN_STATE;
+	GLenum depthFunc = UNKNOWN_STATE;
+	GLuint depthMask = UNKNOWN_STATE;
+	GLuint colorMask = UNKNOWN_STATE;
+	GLuint restartIndex = 0;
+	bool bRestartIndexKnown = false; // 0xFFFFFFFF is a valid restart index, it cannot mark unknown
+	std::unordered_map<GLenum, bool> capabilities;
+
+	StateCache() { Reset(); }
+
+	void Reset()
+	{
+		program = vao = activeUnit = polygonMode = UNKNOWN_STATE;
+		depthFunc = depthMask = colorMask = UNKNOWN_STATE;
+		bRestartIndexKnown = false;
+		for (auto& unit : textures)
+		{
+			for (GLuint& binding : unit) binding = UNKNOWN_STATE;
+		}
+		capabilities.clear();
+	}
+};
+
+static StateCache cache;
+static GLState::Statistics statistics;
+
+static int CachedTargetIndex(GLenum target)
+{
+	for (int i = 0; i < NUM_CACHED_TEXTURE_TARGETS; ++i)
+	{
+		if (CACHED_TEXTURE_TARGETS[i] == target) return i;
+	}
+	return -1;
+}
+
+// Returns true when the cached value has to be updated and the call issued
+static bool Changes(GLuint& cached, GLuint value)
+{
+	if (cached == value)
+	{
+		statistics.skipped++;
+		return false;
+	}
+
+	cached = value;
+	statistics.issued++;
+	return true;
+}
+
+void GLState::UseProgram(GLuint programId)
+{
+	if (Changes(cache.program, programId)) glUseProgram(programId);
+}
+
+void GLState::BindVertexArray(GLuint vao)
+{
+	if (Changes(cache.vao, vao)) glBindVertexArray(vao);
+}
+
+void GLState::BindTexture(unsigned int unit, GLenum target, GLuint textureId)
+{
+	int targetIndex = CachedTargetIndex(target);
+	if (targetIndex >= 0 && unit < MAX_TEXTURE_UNITS && cache.textures[unit][targetIndex] == textureId)
+	{
+		statistics.skipped++;
+		return;
+	}
+
+	if (Changes(cache.activeUnit, unit)) glActiveTexture(GL_TEXTURE0 + unit);
+	if (targetIndex >= 0 && unit < MAX_TEXTURE_UNITS) cache.textures[unit][targetIndex] = textureId;
+	glBindTexture(target, textureId);
+	statistics.issued++;
+}
+
+void GLState::PolygonMode(GLenum mode)
+{
+	if (Changes(cache.polygonMode, mode)) glPolygonMode(GL_FRONT_AND_BACK, mode);
+}
+
+void GLState::SetCapability(GLenum capability, bool bEnabled)
+{
+	auto it = cache.capabilities.find(capability);
+	if (it != cache.capabilities.end() && it->second == bEnabled)
+	{
+		statistics.skipped++;
+		return;
+	}
+
+	cache.capabilities[capability] = bEnabled;
+	statistics.issued++;
+	if (bEnabled) glEnable(capability);
+	else glDisable(capability);
+}
+
+void GLState::PrimitiveRestartIndex(GLuint index)
+{
+	if (cache.bRestartIndexKnown && cache.restartIndex == index)
+	{
+		statistics.skipped++;
+		return;
+	}
+
+	cache.restartIndex = index;
+	cache.bRestartIndexKnown = true;
+	statistics.issued++;
+	glPrimitiveRestartIndex(index);
+}
+
+void GLState::DepthFunc(GLenum func)
+{
+	if (Changes(cache.depthFunc, func)) glDepthFunc(func);
+}
+
+void GLState::DepthMask(bool bWrite)
+{
+	if (Changes(cache.depthMask, bWrite ? GL_TRUE : GL_FALSE)) glDepthMask(bWrite ? GL_TRUE : GL_FALSE);
+}
+
+void GLState::ColorMask(bool bWrite)
+{
+	GLboolean value = bWrite ? GL_TRUE : GL_FALSE;
+	if (Changes(cache.colorMask, value)) glColorMask(value, value, value, value);
+}
+
+void GLState::ForgetProgram(GLuint programId)
+{
+	if (cache.program == programId) cache.program = UNKNOWN_STATE;
+}
+
+void GLState::ForgetVertexArray(GLuint vao)
+{
+	if (cache.vao == vao) cache.vao = UNKNOWN_STATE;
+}
+
+void GLState::ForgetTexture(GLuint textureId)
+{
+	for (auto& unit : cache.textures)
+	{
+		for (GLuint& binding : unit)
+		{
+			if (binding == textureId) binding = UNKNOWN_STATE;
+		}
+	}
+}
+
+void GLState::Invalidate()
+{
+	cache.Reset();
+}
+
+GLState::Statistics GLState::ResetStatistics()
+{
+	Statistics result = statistics;
+	statistics = Statistics{};
+	return result;
+}
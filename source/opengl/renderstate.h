@@ -0,0 +1,40 @@
+#pragma once
+#include "glad/glad.h"
+
+/*
+	Shadow copy of the GL state that changes between draws. Binds go through here so that
+	redundant glUseProgram, glBindTexture, glBindVertexArray, glPolygonMode, glEnable and
+	depth/color write calls are skipped. Code that changes this state directly must restore it afterwards (the imgui
+	backend does) or call Invalidate.
+*/
+namespace GLState
+{
+	static const unsigned int MAX_TEXTURE_UNITS = 16;
+
+	struct Statistics
+	{
+		unsigned int issued = 0;
+		unsigned int skipped = 0;
+	};
+
+	void UseProgram(GLuint programId);
+	void BindVertexArray(GLuint vao);
+	void BindTexture(unsigned int unit, GLenum target, GLuint textureId);
+	void PolygonMode(GLenum mode);
+	void SetCapability(GLenum capability, bool bEnabled);
+	void PrimitiveRestartIndex(GLuint index);
+	void DepthFunc(GLenum func);
+	void DepthMask(bool bWrite);
+	void ColorMask(bool bWrite); // all channels
+
+	// GL reuses the names of deleted objects, the cached binding has to be dropped with them
+	void ForgetProgram(GLuint programId);
+	void ForgetVertexArray(GLuint vao);
+	void ForgetTexture(GLuint textureId);
+
+	// Forces the next call of every setter to reach GL
+	void Invalidate();
+
+	// Counts since the last call
+	Statistics ResetStatistics();
+}
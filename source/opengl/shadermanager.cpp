@@ -1,122 +1,466 @@
 #include "shadermanager.h"
+#include "glextensions.h"
 #include "../core/utilities.h"
+#include <algorithm>
+#include <chrono>
 
 namespace fs = std::filesystem;
 
+static void InsertDefines(std::string& text, const ShaderDefines& defines)
+{
+	if (defines.empty())
+	{
+		return;
+	}
+
+	// #version must stay the first statement, the defines go right after it
+	size_t versionLine = text.find("#version");
+	size_t insertAt = (versionLine == std::string::npos) ? 0 : text.find('\n', versionLine);
+	insertAt = (insertAt == std::string::npos) ? text.size() : insertAt + 1;
+
+	std::string block;
+	for (auto& define : defines)
+	{
+		block += "#define " + define + "\n";
+	}
+	block += "#line 2\n"; // keep compiler messages pointing at the lines in the file
+	text.insert(insertAt, block);
+}
+
 void ShaderManager::InitializeFolder(std::filesystem::path shaderFolder)
 {
 	rootFolder = shaderFolder;
+
+	// Every file is watched, OnFileChanged decides which programs depend on it
+	for (auto& entry : fs::directory_iterator(shaderFolder))
+	{
+		if (entry.is_regular_file())
+		{
+			fileListener.Bind(
+				entry.path().filename().wstring(),
+				[this](fs::path filePath) -> void
+				{
+					this->OnFileChanged(filePath);
+				}
+			);
+		}
+	}
 	fileListener.StartThread(shaderFolder);
 }
 
+void ShaderManager::EnableBinaryCache(std::filesystem::path cacheFolder)
+{
+	if (!HasProgramBinary())
+	{
+		printf("\r\nProgram binaries are not supported, shaders are compiled from source\r\n");
+		return;
+	}
+
+	binaryCacheFolder = cacheFolder;
+	bUseBinaryCache = true;
+
+	driverHash = HASH_SEED;
+	for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+	{
+		const char* text = (const char*)glGetString(name);
+		driverHash = HashString(text ? text : "", driverHash);
+	}
+}
+
+void ShaderManager::PrintLoadStatistics()
+{
+	printf(
+		"\r\nShaders: %d compiled, %d from binary cache, %.1f ms\r\n",
+		compiledPrograms, cachedPrograms, loadMilliseconds
+	);
+}
+
+bool ShaderManager::LoadCachedBinary(GLProgram& targetProgram, fs::path cacheFile)
+{
+	std::vector<char> data;
+	if (!LoadBinary(cacheFile, data) || data.size() <= sizeof(GLenum))
+	{
+		return false;
+	}
+
+	GLenum format = 0;
+	memcpy(&format, data.data(), sizeof(GLenum));
+	return targetProgram.LoadProgramBinary(format, data.data() + sizeof(GLenum), GLsizei(data.size() - sizeof(GLenum)));
+}
+
+void ShaderManager::SaveCachedBinary(GLProgram& targetProgram, fs::path cacheFile)
+{
+	GLenum format = 0;
+	std::vector<char> binary;
+	if (!targetProgram.GetProgramBinary(format, binary))
+	{
+		return;
+	}
+
+	// File layout: GLenum format followed by the driver blob
+	std::vector<char> data(sizeof(GLenum) + binary.size());
+	memcpy(data.data(), &format, sizeof(GLenum));
+	memcpy(data.data() + sizeof(GLenum), binary.data(), binary.size());
+	if (!SaveBinary(cacheFile, data.data(), data.size()))
+	{
+		wprintf(L"\r\nFailed to write program binary: %Ls\r\n", cacheFile.c_str());
+	}
+}
+
 void ShaderManager::LoadLiveShader(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename)
 {
-	LoadShader(targetProgram, vertexFilename, fragmentFilename, geometryFilename);
+	LoadLiveProgram(targetProgram, vertexFilename, fragmentFilename, geometryFilename, {});
+}
 
-	fileListener.Bind(
-		vertexFilename,
-		[this, &targetProgram](fs::path filePath) -> void
+void ShaderManager::LoadLiveComputeShader(GLProgram& targetProgram, std::wstring computeFilename, const ShaderDefines& defines)
+{
+	LiveProgram live;
+	live.target = &targetProgram;
+	live.computeFilename = computeFilename;
+	live.defines = defines;
+	LoadLiveProgram(live);
+}
+
+void ShaderManager::LoadLiveProgram(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename, const ShaderDefines& defines)
+{
+	LiveProgram live;
+	live.target = &targetProgram;
+	live.vertexFilename = vertexFilename;
+	live.fragmentFilename = fragmentFilename;
+	live.geometryFilename = geometryFilename;
+	live.defines = defines;
+	LoadLiveProgram(live);
+}
+
+void ShaderManager::LoadLiveProgram(LiveProgram live)
+{
+	ShaderSources sources;
+	if (ReadLiveSources(sources, live))
+	{
+		LinkSources(*live.target, sources);
+	}
+	livePrograms.push_back(live);
+}
+
+static bool ParseInclude(const std::string& line, std::string& filename)
+{
+	size_t begin = line.find_first_not_of(" \t");
+	if (begin == std::string::npos || line.compare(begin, 8, "#include") != 0)
+	{
+		return false;
+	}
+
+	size_t firstQuote = line.find('"', begin + 8);
+	size_t lastQuote = (firstQuote == std::string::npos) ? std::string::npos : line.find('"', firstQuote + 1);
+	if (lastQuote == std::string::npos)
+	{
+		return false;
+	}
+
+	filename = line.substr(firstQuote + 1, lastQuote - firstQuote - 1);
+	return true;
+}
+
+bool ShaderManager::ExpandIncludes(std::wstring filename, std::string& output, std::vector<std::wstring>& included, std::set<std::wstring>& dependencies)
+{
+	// Recorded before reading so that a missing file is still watched
+	dependencies.insert(filename);
+
+	std::string text;
+	if (!LoadText(rootFolder/filename, text))
+	{
+		wprintf(L"\r\nFailed to read shader: %Ls\r\n", filename.c_str());
+		return false;
+	}
+
+	int sourceNumber = int(included.size());
+	included.push_back(filename);
+
+	size_t lineStart = 0;
+	int lineNumber = 0;
+	while (lineStart < text.size())
+	{
+		size_t lineEnd = text.find('\n', lineStart);
+		lineEnd = (lineEnd == std::string::npos) ? text.size() : lineEnd + 1;
+		std::string line = text.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd;
+		lineNumber++;
+
+		std::string includeName;
+		if (!ParseInclude(line, includeName))
 		{
-			this->UpdateShader(targetProgram, filePath, ShaderType::VERTEX);
+			output += line;
+			if (line.back() != '\n') output += '\n';
+			continue;
 		}
-	);
 
-	fileListener.Bind(
-		fragmentFilename,
-		[this, &targetProgram](fs::path filePath) -> void
+		std::wstring includeFile = std::filesystem::path(includeName).wstring();
+		if (std::find(included.begin(), included.end(), includeFile) == included.end())
 		{
-			this->UpdateShader(targetProgram, filePath, ShaderType::FRAGMENT);
+			output += "#line 1 " + std::to_string(included.size()) + "\n";
+			if (!ExpandIncludes(includeFile, output, included, dependencies))
+			{
+				return false;
+			}
 		}
-	);
+		output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(sourceNumber) + "\n";
+	}
+
+	return true;
+}
+
+bool ShaderManager::ReadSources(ShaderSources& sources, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename, const ShaderDefines& defines)
+{
+	sources.vertex = "";
+	sources.fragment = "";
+	sources.geometry = "";
+	sources.dependencies.clear();
+
+	// Each stage is a separate compilation unit and gets its own copy of the includes
+	std::vector<std::wstring> included;
+	if (!ExpandIncludes(vertexFilename, sources.vertex, included, sources.dependencies))
+	{
+		return false;
+	}
+
+	included.clear();
+	if (!ExpandIncludes(fragmentFilename, sources.fragment, included, sources.dependencies))
+	{
+		return false;
+	}
 
 	if (geometryFilename != L"")
 	{
-		fileListener.Bind(
-			geometryFilename,
-			[this, &targetProgram](fs::path filePath) -> void
-			{
-				this->UpdateShader(targetProgram, filePath, ShaderType::GEOMETRY);
-			}
-		);
+		included.clear();
+		if (!ExpandIncludes(geometryFilename, sources.geometry, included, sources.dependencies))
+		{
+			return false;
+		}
 	}
+
+	InsertDefines(sources.fragment, defines);
+	InsertDefines(sources.vertex, defines);
+	InsertDefines(sources.geometry, defines);
+	return true;
 }
 
-void ShaderManager::LoadShader(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename)
+bool ShaderManager::ReadComputeSources(ShaderSources& sources, std::wstring computeFilename, const ShaderDefines& defines)
 {
-	std::string fragment, vertex, geometry;
-	if (!LoadText(rootFolder/vertexFilename, vertex))
+	sources = ShaderSources{};
+
+	std::vector<std::wstring> included;
+	if (!ExpandIncludes(computeFilename, sources.compute, included, sources.dependencies))
 	{
-		wprintf(L"\r\nFailed to read shader: %Ls\r\n", vertexFilename.c_str());
-		return;
+		return false;
 	}
 
-	if (!LoadText(rootFolder/fragmentFilename, fragment))
+	InsertDefines(sources.compute, defines);
+	return true;
+}
+
+bool ShaderManager::ReadLiveSources(ShaderSources& sources, LiveProgram& live)
+{
+	bool bRead = (live.computeFilename != L"") ?
+		ReadComputeSources(sources, live.computeFilename, live.defines) :
+		ReadSources(sources, live.vertexFilename, live.fragmentFilename, live.geometryFilename, live.defines);
+
+	// Keep watching the files that were found, an #include may have been added or removed.
+	// The stage files are watched even when missing, to retry after a failed read.
+	live.dependencies = sources.dependencies;
+	live.dependencies.insert({ live.vertexFilename, live.fragmentFilename, live.geometryFilename, live.computeFilename });
+	return bRead;
+}
+
+fs::path ShaderManager::BinaryCacheFile(const ShaderSources& sources, const std::vector<std::string>& feedbackVaryings)
+{
+	uint64_t key = driverHash;
+	key = HashString(sources.vertex, key);
+	key = HashString(sources.fragment, key);
+	key = HashString(sources.geometry, key);
+	key = HashString(sources.compute, key);
+	for (auto& varying : feedbackVaryings)
 	{
-		wprintf(L"\r\nFailed to read shader: %Ls\r\n", fragmentFilename.c_str());
+		key = HashString(varying, key);
+	}
+	return binaryCacheFolder / (HashToHex(key) + ".bin");
+}
+
+void ShaderManager::AttachSources(GLProgram& targetProgram, const ShaderSources& sources)
+{
+	if (!sources.compute.empty())
+	{
+		targetProgram.LoadComputeShader(sources.compute);
 		return;
 	}
 
-	bool bShouldLoadGeometryShader = (geometryFilename != L"");
-	if (bShouldLoadGeometryShader)
+	targetProgram.LoadFragmentShader(sources.fragment);
+	targetProgram.LoadVertexShader(sources.vertex);
+	if (!sources.geometry.empty())
+	{
+		targetProgram.LoadGeometryShader(sources.geometry);
+	}
+}
+
+void ShaderManager::LoadShader(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename, const ShaderDefines& defines)
+{
+	ShaderSources sources;
+	if (ReadSources(sources, vertexFilename, fragmentFilename, geometryFilename, defines))
+	{
+		LinkSources(targetProgram, sources);
+	}
+}
+
+void ShaderManager::LinkSources(GLProgram& targetProgram, const ShaderSources& sources)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	fs::path cacheFile;
+	bool bLoadedFromCache = false;
+	if (bUseBinaryCache)
+	{
+		cacheFile = BinaryCacheFile(sources, targetProgram.FeedbackVaryings());
+		targetProgram.SetBinaryRetrievable(true);
+		bLoadedFromCache = LoadCachedBinary(targetProgram, cacheFile);
+	}
+
+	if (bLoadedFromCache)
 	{
-		if (!LoadText(rootFolder/geometryFilename, geometry))
+		cachedPrograms++;
+	}
+	else
+	{
+		AttachSources(targetProgram, sources);
+
+		GLuint revision = targetProgram.Revision();
+		targetProgram.CompileAndLink();
+		compiledPrograms++;
+
+		if (bUseBinaryCache && targetProgram.Revision() != revision)
 		{
-			wprintf(L"\r\nFailed to read shader: %Ls\r\n", geometryFilename.c_str());
-			return;
+			SaveCachedBinary(targetProgram, cacheFile);
 		}
 	}
 
-	targetProgram.LoadFragmentShader(fragment);
-	targetProgram.LoadVertexShader(vertex);
-	if (bShouldLoadGeometryShader)
+	auto endTime = std::chrono::high_resolution_clock::now();
+	loadMilliseconds += std::chrono::duration<double, std::milli>(endTime - startTime).count();
+}
+
+void ShaderManager::OnFileChanged(fs::path filePath)
+{
+	std::wstring filename = filePath.filename().wstring();
+	for (LiveProgram& live : livePrograms)
 	{
-		targetProgram.LoadGeometryShader(geometry);
+		if (live.dependencies.count(filename) > 0)
+		{
+			RecompileAsync(live, filePath);
+		}
 	}
-	targetProgram.CompileAndLink();
 }
 
-void ShaderManager::UpdateShader(GLProgram& targetProgram, fs::path filePath, ShaderType type)
+void ShaderManager::RecompileAsync(LiveProgram& live, fs::path changedFile)
 {
-	std::string text;
-	if (!LoadText(filePath, text))
+	GLProgram& targetProgram = *live.target;
+
+	ShaderSources sources;
+	if (!ReadLiveSources(sources, live))
 	{
-		wprintf(L"\r\nUpdateShader failed to read file: %Ls\r\n", filePath.c_str());
 		return;
 	}
 
-	//printf("\r\n=======\r\n%s\r\n=======\r\n\r\n", text.c_str());
-	std::wstring MessageType = L"";
-	switch (type)
-	{
-	case ShaderType::VERTEX:
+	// A newer edit of the same program replaces the one still compiling
+	pendingPrograms.erase(
+		std::remove_if(pendingPrograms.begin(), pendingPrograms.end(), [&](const PendingProgram& p) { return p.target == &targetProgram; }),
+		pendingPrograms.end()
+	);
+
+	PendingProgram pending;
+	pending.target = &targetProgram;
+	pending.program = std::make_unique<GLProgram>();
+	pending.program->SetFeedbackVaryings(targetProgram.FeedbackVaryings());
+	pending.changedFile = changedFile;
+	if (bUseBinaryCache)
 	{
-		MessageType = L"Vertex";
-		targetProgram.LoadVertexShader(text);
-		break;
+		pending.cacheFile = BinaryCacheFile(sources, targetProgram.FeedbackVaryings());
+		pending.program->SetBinaryRetrievable(true);
 	}
-	case ShaderType::FRAGMENT:
+
+	AttachSources(*pending.program, sources);
+	pending.program->CompileAndLinkAsync();
+	pendingPrograms.push_back(std::move(pending));
+}
+
+void ShaderManager::FinishPendingPrograms()
+{
+	for (size_t i = 0; i < pendingPrograms.size();)
 	{
-		MessageType = L"Fragment";
-		targetProgram.LoadFragmentShader(text);
-		break;
+		PendingProgram& pending = pendingPrograms[i];
+		if (pending.program->IsLinkPending())
+		{
+			++i;
+			continue;
+		}
+
+		if (pending.program->FinishLink())
+		{
+			if (bUseBinaryCache)
+			{
+				SaveCachedBinary(*pending.program, pending.cacheFile);
+			}
+			pending.target->AdoptProgram(*pending.program);
+			wprintf(L"\r\nShader updated: %Ls\r\n", pending.changedFile.c_str());
+		}
+		else
+		{
+			wprintf(L"\r\nShader update failed, keeping the previous program: %Ls\r\n", pending.changedFile.c_str());
+		}
+
+		pendingPrograms.erase(pendingPrograms.begin() + i);
 	}
-	case ShaderType::GEOMETRY:
+}
+
+ShaderPermutations& ShaderManager::AddPermutations(std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename)
+{
+	permutations.push_back(std::make_unique<ShaderPermutations>());
+	ShaderPermutations& set = *permutations.back();
+	set.vertexFilename = vertexFilename;
+	set.fragmentFilename = fragmentFilename;
+	set.geometryFilename = geometryFilename;
+	return set;
+}
+
+GLProgram& ShaderManager::GetProgram(ShaderPermutations& set, ShaderDefines defines)
+{
+	std::sort(defines.begin(), defines.end());
+
+	std::string key;
+	for (auto& define : defines)
 	{
-		MessageType = L"Geometry";
-		targetProgram.LoadGeometryShader(text);
-		break;
+		key += define + ";";
 	}
+
+	auto it = set.variants.find(key);
+	if (it != set.variants.end())
+	{
+		return *it->second.program;
 	}
-	targetProgram.CompileAndLink();
 
-	wprintf(
-		L"\r\n%Ls shader updated: %Ls\r\n", 
-		MessageType.c_str(),
-		filePath.c_str()
-	);
+	ShaderPermutations::Variant& variant = set.variants[key];
+	variant.defines = defines;
+	variant.program = std::make_unique<GLProgram>();
+	variant.program->SetFeedbackVaryings(set.feedbackVaryings);
+	LoadLiveProgram(*variant.program, set.vertexFilename, set.fragmentFilename, VariantGeometryFilename(set, variant), variant.defines);
+	return *variant.program;
+}
+
+std::wstring ShaderManager::VariantGeometryFilename(const ShaderPermutations& set, const ShaderPermutations::Variant& variant)
+{
+	bool bUseGeometryStage = set.geometryDefine.empty() ||
+		std::find(variant.defines.begin(), variant.defines.end(), set.geometryDefine) != variant.defines.end();
+	return bUseGeometryStage ? set.geometryFilename : L"";
 }
 
 void ShaderManager::CheckLiveShaders()
 {
 	fileListener.ProcessCallbacksOnMainThread();
+	FinishPendingPrograms();
 }
@@ -2,29 +2,136 @@
 #include "program.h"
 #include "../core/filelistener.h"
 #include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
 #include <filesystem>
 
-enum class ShaderType
+// Each entry is inserted as "#define <entry>" after the #version line, e.g. "DEBUG_NORMALS"
+using ShaderDefines = std::vector<std::string>;
+
+/*
+	One set of shader files compiled into #define specialized variants.
+
+	Variants are compiled the first time they are requested and cached, so debug features
+	cost nothing in the production variant. Every variant is a live program, see ShaderManager.
+*/
+struct ShaderPermutations
+{
+	struct Variant
+	{
+		ShaderDefines defines;
+		std::unique_ptr<GLProgram> program;
+	};
+
+	std::wstring vertexFilename;
+	std::wstring fragmentFilename;
+	std::wstring geometryFilename;
+	std::string geometryDefine; // if set, only variants with this define get the geometry stage
+	std::vector<std::string> feedbackVaryings;
+	std::map<std::string, Variant> variants; // keyed by the sorted defines
+};
+
+struct ShaderSources
 {
-	VERTEX = 0,
-	FRAGMENT = 1,
-	GEOMETRY = 2,
-	UNKNOWN = 3
+	std::string vertex;
+	std::string fragment;
+	std::string geometry; // empty without a geometry stage
+	std::string compute;  // set for compute programs, which have no other stages
+	std::set<std::wstring> dependencies; // stage files and everything they #include
 };
 
+/*
+	Loads programs from the shader folder.
+
+	Stages may use #include "file.glsl" for code shared between programs. A file is inserted
+	once per stage, further includes of it are skipped. Compiler messages refer to included
+	files by source string number, in the order they were first included (0 = the stage file).
+
+	Live programs remember every file they were built from. When a file changes, each program
+	that depends on it is recompiled once, however many of its stages include the file.
+*/
 class ShaderManager
 {
 protected:
+	struct LiveProgram
+	{
+		GLProgram* target = nullptr;
+		std::wstring vertexFilename;
+		std::wstring fragmentFilename;
+		std::wstring geometryFilename;
+		std::wstring computeFilename; // replaces the other stages when set
+		ShaderDefines defines;
+		std::set<std::wstring> dependencies;
+	};
+
+	// Live edits compile into a separate program that replaces the target once it links
+	struct PendingProgram
+	{
+		GLProgram* target = nullptr;
+		std::unique_ptr<GLProgram> program;
+		std::filesystem::path changedFile;
+		std::filesystem::path cacheFile;
+	};
+
 	std::filesystem::path rootFolder;
 	FileListener fileListener;
+	std::vector<std::unique_ptr<ShaderPermutations>> permutations;
+	std::vector<LiveProgram> livePrograms;
+
+	// Linked programs are stored per source hash, see EnableBinaryCache
+	std::filesystem::path binaryCacheFolder;
+	bool bUseBinaryCache = false;
+	uint64_t driverHash = 0;
+
+	int compiledPrograms = 0;
+	int cachedPrograms = 0;
+	double loadMilliseconds = 0.0;
+
+	std::vector<PendingProgram> pendingPrograms;
+
+	bool LoadCachedBinary(GLProgram& targetProgram, std::filesystem::path cacheFile);
+	void SaveCachedBinary(GLProgram& targetProgram, std::filesystem::path cacheFile);
+
+	std::filesystem::path BinaryCacheFile(const ShaderSources& sources, const std::vector<std::string>& feedbackVaryings);
+
+	bool ExpandIncludes(std::wstring filename, std::string& output, std::vector<std::wstring>& included, std::set<std::wstring>& dependencies);
+	bool ReadSources(ShaderSources& sources, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename, const ShaderDefines& defines);
+	bool ReadComputeSources(ShaderSources& sources, std::wstring computeFilename, const ShaderDefines& defines);
+	bool ReadLiveSources(ShaderSources& sources, LiveProgram& live);
+	void AttachSources(GLProgram& targetProgram, const ShaderSources& sources);
+	void LinkSources(GLProgram& targetProgram, const ShaderSources& sources);
+
+	void LoadLiveProgram(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename, const ShaderDefines& defines);
+	void LoadLiveProgram(LiveProgram live);
+	void RecompileAsync(LiveProgram& live, std::filesystem::path changedFile);
+	void OnFileChanged(std::filesystem::path filePath);
+	void FinishPendingPrograms();
+
+	std::wstring VariantGeometryFilename(const ShaderPermutations& set, const ShaderPermutations::Variant& variant);
 
 public:
 	ShaderManager() = default;
 	~ShaderManager() = default;
 
 	void InitializeFolder(std::filesystem::path shaderFolder);
+
+	/*
+		Programs are looked up in cacheFolder before compiling. The key is a hash of all
+		stages after #define insertion, the feedback varyings and the driver strings, so a
+		source edit or driver update compiles again. Ignored without program binary support.
+	*/
+	void EnableBinaryCache(std::filesystem::path cacheFolder);
+	void PrintLoadStatistics();
 	void LoadLiveShader(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename = L"");
-	void LoadShader(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename = L"");
-	void UpdateShader(GLProgram& targetProgram, std::filesystem::path filePath, ShaderType type);
+	void LoadShader(GLProgram& targetProgram, std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename = L"", const ShaderDefines& defines = {});
+
+	// Compute programs are always live, check HasComputeShader before loading one
+	void LoadLiveComputeShader(GLProgram& targetProgram, std::wstring computeFilename, const ShaderDefines& defines = {});
+	ShaderPermutations& AddPermutations(std::wstring vertexFilename, std::wstring fragmentFilename, std::wstring geometryFilename = L"");
+	GLProgram& GetProgram(ShaderPermutations& set, ShaderDefines defines = {});
+
+	// Call once per frame, starts recompiling edited files and swaps in programs that have linked
 	void CheckLiveShaders();
 };
\ No newline at end of file
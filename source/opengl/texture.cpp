@@ -1,4 +1,5 @@
 #include "texture.h"
+#include "renderstate.h"
 
 #include <iostream>
 #include <memory>
@@ -11,7 +12,7 @@
 
 void GLTexture::UpdateParameters()
 {
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	GLState::BindTexture(0, GL_TEXTURE_2D, textureId);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -83,13 +84,12 @@ unsigned int GLTexture::PixelArrayIndex(unsigned int x, unsigned int y)
 
 void GLTexture::UseForDrawing(unsigned int TextureUnit)
 {
-	glActiveTexture(GL_TEXTURE0 + TextureUnit);
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	GLState::BindTexture(TextureUnit, GL_TEXTURE_2D, textureId);
 }
 
 void GLTexture::CopyToGPU()
 {
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	GLState::BindTexture(0, GL_TEXTURE_2D, textureId);
 	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, PIXEL_FORMAT, PIXEL_TYPE, (GLvoid*)glData.data());
 }
 
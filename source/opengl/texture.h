@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include "glad/glad.h"
+#include "renderstate.h"
 #include "../core/math.h"
 #include <filesystem>
 
@@ -40,6 +41,7 @@ public:
 
 	~GLTexture()
 	{
+		GLState::ForgetTexture(textureId);
 		glDeleteTextures(1, &textureId);
 	}
 
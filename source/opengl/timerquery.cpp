@@ -0,0 +1,98 @@
+#include "timerquery.h"
+#include "glextensions.h"
+
+GLTimerQuery::GLTimerQuery()
+{
+	glGenQueries(2, queries);
+}
+
+GLTimerQuery::~GLTimerQuery()
+{
+	glDeleteQueries(2, queries);
+}
+
+void GLTimerQuery::Begin()
+{
+	// Collect the result of the other query before it is reused next frame
+	int previous = 1 - current;
+	if (issued[previous])
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(queries[previous], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(queries[previous], GL_QUERY_RESULT, &nanoseconds);
+			milliseconds = nanoseconds / 1000000.0;
+			issued[previous] = false;
+		}
+	}
+
+	glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+}
+
+void GLTimerQuery::End()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	issued[current] = true;
+
+	// Keep writing to the same query until its previous result has been read
+	if (!issued[1 - current])
+	{
+		current = 1 - current;
+	}
+}
+
+const GLenum GLPipelineQuery::targets[NUM_COUNTERS] = {
+	GL_GEOMETRY_SHADER_INVOCATIONS,
+	GL_GEOMETRY_SHADER_PRIMITIVES_EMITTED,
+	GL_FRAGMENT_SHADER_INVOCATIONS
+};
+
+GLPipelineQuery::GLPipelineQuery()
+{
+	glGenQueries(2 * NUM_COUNTERS, &queries[0][0]);
+}
+
+GLPipelineQuery::~GLPipelineQuery()
+{
+	glDeleteQueries(2 * NUM_COUNTERS, &queries[0][0]);
+}
+
+void GLPipelineQuery::Begin()
+{
+	// Same double-buffering as GLTimerQuery, the counters of a pair finish together
+	int previous = 1 - current;
+	if (issued[previous])
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(queries[previous][NUM_COUNTERS - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			for (int i = 0; i < NUM_COUNTERS; ++i)
+			{
+				glGetQueryObjectui64v(queries[previous][i], GL_QUERY_RESULT, &results[i]);
+			}
+			issued[previous] = false;
+		}
+	}
+
+	for (int i = 0; i < NUM_COUNTERS; ++i)
+	{
+		glBeginQuery(targets[i], queries[current][i]);
+	}
+}
+
+void GLPipelineQuery::End()
+{
+	for (int i = 0; i < NUM_COUNTERS; ++i)
+	{
+		glEndQuery(targets[i]);
+	}
+	issued[current] = true;
+
+	if (!issued[1 - current])
+	{
+		current = 1 - current;
+	}
+}
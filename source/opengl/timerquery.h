@@ -0,0 +1,66 @@
+#pragma once
+#include "glad/glad.h"
+
+/*
+	Measures GPU time between Begin and End with GL_TIME_ELAPSED.
+
+	Two queries are used in turns so that the result of the previous frame is read
+	while the current frame is recorded. Reading never waits for the GPU, if the
+	result is not available yet the last known value is kept.
+*/
+class GLTimerQuery
+{
+protected:
+	GLuint queries[2] = { 0, 0 };
+	bool issued[2] = { false, false };
+	int current = 0;
+	double milliseconds = 0.0;
+
+public:
+	GLTimerQuery();
+	~GLTimerQuery();
+
+	GLTimerQuery(const GLTimerQuery& other) = delete;
+
+	void Begin();
+	void End();
+
+	// GPU time of the most recently completed Begin/End pair
+	double Milliseconds() { return milliseconds; }
+};
+
+/*
+	Pipeline statistics between Begin and End, one query per counter. Read without waiting
+	like GLTimerQuery. Only one query per counter can be active, so these do not nest either.
+	Requires HasPipelineStatistics.
+*/
+class GLPipelineQuery
+{
+public:
+	enum Counter
+	{
+		GEOMETRY_SHADER_INVOCATIONS,
+		GEOMETRY_SHADER_PRIMITIVES_EMITTED,
+		FRAGMENT_SHADER_INVOCATIONS,
+		NUM_COUNTERS
+	};
+
+protected:
+	static const GLenum targets[NUM_COUNTERS];
+	GLuint queries[2][NUM_COUNTERS] = {};
+	bool issued[2] = { false, false };
+	int current = 0;
+	GLuint64 results[NUM_COUNTERS] = {};
+
+public:
+	GLPipelineQuery();
+	~GLPipelineQuery();
+
+	GLPipelineQuery(const GLPipelineQuery& other) = delete;
+
+	void Begin();
+	void End();
+
+	// Count of the most recently completed Begin/End pair
+	GLuint64 Result(Counter counter) const { return results[counter]; }
+};
@@ -0,0 +1,121 @@
+#include "uniformbuffer.h"
+#include "glextensions.h"
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+
+GLUniformRing::GLUniformRing()
+{
+	glGenBuffers(1, &bufferId);
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+}
+
+GLUniformRing::~GLUniformRing()
+{
+	RetireBuffer();
+	glDeleteBuffers(1, &retiredBufferId);
+}
+
+void GLUniformRing::RetireBuffer()
+{
+	// Nothing is written to the old buffer again, its fences are not needed
+	for (GLsync& fence : fences)
+	{
+		if (fence) glDeleteSync(fence);
+		fence = 0;
+	}
+
+	if (mapped)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		mapped = nullptr;
+	}
+	if (retiredBufferId)
+	{
+		glDeleteBuffers(1, &retiredBufferId);
+	}
+	retiredBufferId = bufferId;
+	bufferId = 0;
+}
+
+void GLUniformRing::Allocate(GLsizeiptr bytesPerFrame)
+{
+	assert(!mapped); // buffer storage is immutable, allocate once
+
+	regionSize = (bytesPerFrame + alignment - 1) / alignment * alignment;
+	GLsizeiptr totalSize = regionSize * NUM_REGIONS;
+
+	glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+	if (HasBufferStorage())
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, totalSize, NULL, flags);
+		mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, totalSize, flags);
+	}
+	else
+	{
+		glBufferData(GL_UNIFORM_BUFFER, totalSize, NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	head = 0;
+	region = 0;
+}
+
+void GLUniformRing::BeginFrame()
+{
+	GLsync& fence = fences[region];
+	if (fence)
+	{
+		// Normally already signaled, the GPU is two frames behind at most
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+	head = 0;
+}
+
+void GLUniformRing::EndFrame()
+{
+	if (retiredBufferId)
+	{
+		// The GL keeps the storage until the draws of this frame are done
+		glDeleteBuffers(1, &retiredBufferId);
+		retiredBufferId = 0;
+	}
+	fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	region = (region + 1) % NUM_REGIONS;
+}
+
+GLintptr GLUniformRing::Reserve(GLsizeiptr numbytes)
+{
+	if (head + numbytes > regionSize)
+	{
+		// Writing on would reach into the next region, which the GPU may still be reading
+		GLsizeiptr grownSize = std::max(regionSize * 2, numbytes);
+		printf("\r\nGLUniformRing: %lld bytes per frame are not enough, growing to %lld\r\n", (long long)regionSize, (long long)grownSize);
+		RetireBuffer();
+		glGenBuffers(1, &bufferId);
+		Allocate(grownSize);
+	}
+
+	GLintptr offset = region * regionSize + head;
+	head += (numbytes + alignment - 1) / alignment * alignment;
+	return offset;
+}
+
+void GLUniformRing::Write(GLintptr offset, const void* data, GLsizeiptr numbytes)
+{
+	if (mapped)
+	{
+		memcpy(mapped + offset, data, numbytes);
+	}
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, numbytes, data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstring>
+
+/*
+	C++ mirrors of the std140 uniform blocks declared in the shaders.
+
+	std140 aligns vec3 and vec4 to 16 bytes and stores matrices as four vec4 columns.
+	The static_asserts below fail to compile if a struct drifts from the glsl layout.
+*/
+struct CameraBlock
+{
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::mat4 view_projection;
+	alignas(16) glm::fvec3 camera_position;
+};
+static_assert(offsetof(CameraBlock, projection) == 0, "std140 Camera.projection");
+static_assert(offsetof(CameraBlock, view) == 64, "std140 Camera.view");
+static_assert(offsetof(CameraBlock, view_projection) == 128, "std140 Camera.view_projection");
+static_assert(offsetof(CameraBlock, camera_position) == 192, "std140 Camera.camera_position");
+static_assert(sizeof(CameraBlock) == 208, "std140 Camera size");
+
+struct LightBlock
+{
+	alignas(16) glm::fvec3 light_position;
+	alignas(16) glm::fvec4 light_color;
+};
+static_assert(offsetof(LightBlock, light_position) == 0, "std140 Light.light_position");
+static_assert(offsetof(LightBlock, light_color) == 16, "std140 Light.light_color");
+static_assert(sizeof(LightBlock) == 32, "std140 Light size");
+
+struct ObjectBlock
+{
+	glm::mat4 model;
+};
+static_assert(offsetof(ObjectBlock, model) == 0, "std140 Object.model");
+static_assert(sizeof(ObjectBlock) == 64, "std140 Object size");
+
+// Binding points, must match the binding = N qualifiers in the shaders
+const GLuint CAMERA_BLOCK_BINDING = 1;
+const GLuint LIGHT_BLOCK_BINDING = 2;
+const GLuint OBJECT_BLOCK_BINDING = 3;
+
+/*
+	Ring buffer for uniform blocks that change every frame or every draw.
+
+	The buffer is split into one region per frame in flight. Each Push copies the block to
+	the next aligned offset of the current region and binds that range, so a draw costs one
+	memcpy and one glBindBufferRange. A fence is placed when the frame ends and the region
+	is not written again until the GPU has passed it.
+
+	A frame that pushes more than bytesPerFrame grows the ring to twice the size. The rest
+	of the frame goes to the new buffer, the old one is deleted when the frame ends because
+	the blocks bound earlier in the frame still point into it.
+
+	With GL 4.4 (ARB_buffer_storage) the buffer is mapped once, persistently and coherently.
+	Otherwise every Push falls back to glBufferSubData into the same layout.
+*/
+class GLUniformRing
+{
+public:
+	static const int NUM_REGIONS = 3;
+
+protected:
+	GLuint bufferId = 0;
+	GLuint retiredBufferId = 0; // replaced by a grow during the current frame
+	unsigned char* mapped = nullptr;
+	GLsizeiptr regionSize = 0;
+	GLsizeiptr head = 0;
+	GLint alignment = 256;
+	int region = 0;
+	GLsync fences[NUM_REGIONS] = { 0, 0, 0 };
+
+	GLintptr Reserve(GLsizeiptr numbytes);
+	void Write(GLintptr offset, const void* data, GLsizeiptr numbytes);
+	void RetireBuffer();
+
+public:
+	GLUniformRing();
+	~GLUniformRing();
+
+	GLUniformRing(const GLUniformRing& other) = delete;
+
+	void Allocate(GLsizeiptr bytesPerFrame);
+	bool IsPersistent() { return mapped != nullptr; }
+
+	// Waits until the GPU is done with the region that is about to be reused
+	void BeginFrame();
+	void EndFrame();
+
+	// Set point to the same binding value as used in the glsl shader
+	template<typename T>
+	void Push(GLuint point, const T& block)
+	{
+		GLintptr offset = Reserve(sizeof(T));
+		Write(offset, &block, sizeof(T));
+		glBindBufferRange(GL_UNIFORM_BUFFER, point, bufferId, offset, sizeof(T));
+	}
+};
@@ -0,0 +1,45 @@
+#include "volumetexture.h"
+#include "renderstate.h"
+
+GLVolumeTexture::GLVolumeTexture()
+{
+	glGenTextures(1, &textureId);
+	GLState::BindTexture(0, GL_TEXTURE_3D, textureId);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+}
+
+GLVolumeTexture::~GLVolumeTexture()
+{
+	GLState::ForgetTexture(textureId);
+	glDeleteTextures(1, &textureId);
+}
+
+void GLVolumeTexture::Upload(const float* voxels, glm::ivec3 newResolution, int firstSlice, int sliceCount)
+{
+	if (glm::any(glm::lessThanEqual(newResolution, glm::ivec3(0))))
+	{
+		return;
+	}
+
+	GLState::BindTexture(0, GL_TEXTURE_3D, textureId);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (newResolution != resolution)
+	{
+		resolution = newResolution;
+		glTexImage3D(GL_TEXTURE_3D, 0, GL_R16F, resolution.x, resolution.y, resolution.z, 0, GL_RED, GL_FLOAT, voxels);
+		return;
+	}
+
+	const float* slices = voxels + size_t(firstSlice) * resolution.x * resolution.y;
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, firstSlice, resolution.x, resolution.y, sliceCount, GL_RED, GL_FLOAT, slices);
+}
+
+void GLVolumeTexture::Bind(unsigned int textureUnit)
+{
+	GLState::BindTexture(textureUnit, GL_TEXTURE_3D, textureId);
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "glad/glad.h"
+#include "../core/math.h"
+
+/*
+	Single channel R16F 3D texture with linear filtering, clamped to the border texels.
+	Slices can be re-uploaded on their own, so a volume that changes locally only sends
+	the changed part.
+*/
+class GLVolumeTexture
+{
+protected:
+	GLuint textureId = 0;
+	glm::ivec3 resolution{ 0 };
+
+public:
+	GLVolumeTexture();
+	~GLVolumeTexture();
+
+	GLVolumeTexture(const GLVolumeTexture& other) = delete;
+
+	// voxels holds the whole volume, x fastest. The texture is reallocated when the resolution
+	// changes, all slices are uploaded then.
+	void Upload(const float* voxels, glm::ivec3 resolution, int firstSlice, int sliceCount);
+
+	void Bind(unsigned int textureUnit);
+	GLuint Id() const { return textureId; }
+	glm::ivec3 Resolution() const { return resolution; }
+};
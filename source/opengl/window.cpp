@@ -1,6 +1,8 @@
 #include "window.h"
 #include "../core/application.h"
 #include "glad/glad.h"
+#include "glextensions.h"
+#include "bufferheap.h"
 #include <string>
 
 // IMGUI support
@@ -66,6 +68,7 @@ OpenGLWindow::~OpenGLWindow()
 	ShutdownIMGUI();
 	if (window)
 	{
+		GetBufferHeap().Release();
 		SDL_GL_DeleteContext(maincontext);
 		SDL_DestroyWindow(window);
 	}
@@ -164,6 +167,7 @@ void OpenGLWindow::Initialize(int width, int height, bool fullscreen, bool vsync
 	// Check OpenGL properties
 	printf("OpenGL loaded\n");
 	gladLoadGLLoader(SDL_GL_GetProcAddress);
+	LoadGLExtensions(SDL_GL_GetProcAddress);
 	printf("Vendor:   %s\n", glGetString(GL_VENDOR));
 	printf("Renderer: %s\n", glGetString(GL_RENDERER));
 	printf("Version:  %s\n", glGetString(GL_VERSION));